@@ -0,0 +1,665 @@
+//
+//  core_benchmark.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <benchmark/benchmark.h>
+#include "BackupGenerator.h"
+#include "Digest.h"
+#include "FileSystem.h"
+#include "ITunesParser.h"
+
+// Usage: core_benchmark [--itb_files=<n>] [--itb_domains=<n>] [--itb_backups=<n>] [--itb_work_dir=<path>] [benchmark options]
+// The backups are generated by BackupGenerator in the work folder before the cases run. A temporary folder is used and
+// deleted by default, with --itb_work_dir the backups are kept there and reused by the next runs with the same sizes.
+// Every case reports files/s, MB/s and the peak RSS of the case (VmHWM is reset before each case on Linux,
+// elsewhere it is the peak of the process so far)
+
+struct BenchmarkConfig
+{
+    uint64_t numberOfFiles;
+    unsigned int numberOfDomains;
+    unsigned int numberOfBackups;
+    std::string workPath;
+    bool keepingWorkPath;
+
+    BenchmarkConfig() : numberOfFiles(20000), numberOfDomains(10), numberOfBackups(32), keepingWorkPath(false)
+    {
+    }
+};
+
+static BenchmarkConfig g_config;
+
+static size_t getPeakRss()
+{
+#ifdef __linux__
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (NULL != fp)
+    {
+        char line[256];
+        size_t kb = 0;
+        while (NULL != fgets(line, sizeof(line), fp))
+        {
+            if (std::strncmp(line, "VmHWM:", 6) == 0)
+            {
+                kb = std::strtoul(line + 6, NULL, 10);
+                break;
+            }
+        }
+        fclose(fp);
+        if (kb > 0)
+        {
+            return kb * 1024;
+        }
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+static void resetPeakRss()
+{
+#ifdef __linux__
+    // "5" resets the peak RSS of the process to its current RSS (Linux 4.0+)
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+    if (NULL != fp)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+#endif
+}
+
+static void setCounters(benchmark::State& state, uint64_t numberOfFiles, uint64_t bytes)
+{
+    state.counters["files"] = benchmark::Counter(static_cast<double>(numberOfFiles), benchmark::Counter::kIsRate);
+    state.counters["MB"] = benchmark::Counter(bytes / (1024.0 * 1024.0), benchmark::Counter::kIsRate);
+    state.counters["peak_rss"] = benchmark::Counter(static_cast<double>(getPeakRss()), benchmark::Counter::kDefaults, benchmark::Counter::OneK::kIs1024);
+}
+
+// Fixtures
+
+static std::string getBackupPath(bool mbdb)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s-%llu-%u", mbdb ? "mbdb" : "db", (unsigned long long)g_config.numberOfFiles, g_config.numberOfDomains);
+    return combinePath(g_config.workPath, name);
+}
+
+// A folder of numberOfBackups small backups for ManifestParser
+static std::string getBackupsPath()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "backups-%u", g_config.numberOfBackups);
+    return combinePath(g_config.workPath, name);
+}
+
+static bool generateFixture(GeneratorOptions& options)
+{
+    // The mark is written once the backup is complete, an interrupted one is generated again
+    std::string markPath = combinePath(options.outputPath, ".generated");
+    if (existsFile(markPath))
+    {
+        return true;
+    }
+    deleteDirectory(options.outputPath);
+    return generateBackup(options) && writeFile(markPath, std::string());
+}
+
+static bool generateFixtures()
+{
+    GeneratorOptions options;
+    options.numberOfFiles = g_config.numberOfFiles;
+    options.numberOfDomains = g_config.numberOfDomains;
+    // Small files as the attachments of the messengers are, ~6.7KB on average
+    options.sizeDistribution = GeneratorOptions::SIZE_LOGNORMAL;
+    options.sizeParam1 = 4096;
+    options.sizeParam2 = 1.0;
+    options.maxSize = 1024 * 1024;
+
+    options.outputPath = getBackupPath(false);
+    if (!generateFixture(options))
+    {
+        return false;
+    }
+
+    // Manifest.mbdb is only loaded, its payloads are not needed
+    options.mbdb = true;
+    options.payload = false;
+    options.outputPath = getBackupPath(true);
+    if (!generateFixture(options))
+    {
+        return false;
+    }
+
+    GeneratorOptions manifestOptions;
+    manifestOptions.numberOfDomains = 5;
+    manifestOptions.numberOfFiles = 100;
+    manifestOptions.payload = false;
+    manifestOptions.blobShape = GeneratorOptions::BLOB_NONE;
+    std::string backupsPath = getBackupsPath();
+    makeDirectory(backupsPath);
+    for (unsigned int idx = 0; idx < g_config.numberOfBackups; ++idx)
+    {
+        char backupId[64];
+        snprintf(backupId, sizeof(backupId), "%08u-%016u", idx, idx);
+        manifestOptions.outputPath = combinePath(backupsPath, backupId);
+        manifestOptions.seed = idx + 1;
+        if (!generateFixture(manifestOptions))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t getFileSizes(const ITunesFileRange& range)
+{
+    uint64_t bytes = 0;
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        if (!(*it)->isDir())
+        {
+            ITunesDb::parseFileInfo(*it);
+            bytes += (*it)->size;
+        }
+    }
+    return bytes;
+}
+
+// Manifest discovery
+
+static void benchmarkManifestParse(benchmark::State& state)
+{
+    std::string backupsPath = getBackupsPath();
+    unsigned int jobs = static_cast<unsigned int>(state.range(0));
+    uint64_t numberOfBackups = 0;
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        ManifestParser parser(backupsPath, false);
+        parser.setJobs(jobs);
+        std::vector<BackupManifest> manifests;
+        if (!parser.parse(manifests) || manifests.size() != g_config.numberOfBackups)
+        {
+            state.SkipWithError("ManifestParser::parse failed");
+            break;
+        }
+        numberOfBackups += manifests.size();
+    }
+
+    // Info.plist and Manifest.plist are read for each backup
+    std::vector<std::string> subDirectories;
+    listSubDirectories(backupsPath, subDirectories);
+    uint64_t bytesPerRun = 0;
+    for (std::vector<std::string>::const_iterator it = subDirectories.cbegin(); it != subDirectories.cend(); ++it)
+    {
+        bytesPerRun += getFileSize(combinePath(backupsPath, *it, "Info.plist")) + getFileSize(combinePath(backupsPath, *it, "Manifest.plist"));
+    }
+    setCounters(state, numberOfBackups, bytesPerRun * state.iterations());
+}
+
+// Load of the file table, MB/s is the size of the manifest
+
+static void benchmarkLoad(benchmark::State& state, bool mbdb, bool allDomains)
+{
+    std::string backupPath = getBackupPath(mbdb);
+    uint64_t manifestSize = getFileSize(combinePath(backupPath, mbdb ? "Manifest.mbdb" : "Manifest.db"));
+    std::vector<std::string> domains;
+    if (allDomains)
+    {
+        for (unsigned int idx = 0; idx < g_config.numberOfDomains; ++idx)
+        {
+            domains.push_back(getSyntheticDomain(idx));
+        }
+    }
+    else
+    {
+        domains.push_back(getSyntheticDomain(0));
+    }
+
+    uint64_t numberOfFiles = 0;
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        ITunesDb db(backupPath, mbdb ? "Manifest.mbdb" : "Manifest.db");
+        db.setLoadingMode(ITunesDb::LOADING_METADATA);
+        if (!db.load(domains, false))
+        {
+            state.SkipWithError("ITunesDb::load failed");
+            break;
+        }
+        ITunesFileRange range = db.getFiles();
+        numberOfFiles += static_cast<uint64_t>(std::distance(range.first, range.second));
+    }
+    setCounters(state, numberOfFiles, manifestSize * state.iterations());
+}
+
+// Lookups, MB/s is the length of the looked up paths
+
+static std::vector<std::string> getLookupPaths(const ITunesDb& db, const std::string& domain)
+{
+    std::vector<std::string> paths;
+    ITunesFileRange range = db.getFiles(domain);
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        paths.push_back((*it)->relativePath);
+    }
+    // The order of the callers, not the order of the table
+    uint64_t seed = 1;
+    for (size_t idx = paths.size(); idx > 1; --idx)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::swap(paths[idx - 1], paths[static_cast<size_t>((seed >> 33) % idx)]);
+    }
+    return paths;
+}
+
+static void benchmarkFindITunesFile(benchmark::State& state, bool withDomain, bool pathIndex)
+{
+    std::string domain = getSyntheticDomain(0);
+    ITunesDb db(getBackupPath(false), "Manifest.db");
+    db.setLoadingMode(ITunesDb::LOADING_PATH_ONLY);
+    db.setPathIndexEnabled(pathIndex);
+    if (!db.load(domain))
+    {
+        state.SkipWithError("ITunesDb::load failed");
+        return;
+    }
+    std::vector<std::string> paths = getLookupPaths(db, domain);
+    uint64_t pathBytes = 0;
+    for (std::vector<std::string>::const_iterator it = paths.cbegin(); it != paths.cend(); ++it)
+    {
+        pathBytes += it->size();
+    }
+
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        for (std::vector<std::string>::const_iterator it = paths.cbegin(); it != paths.cend(); ++it)
+        {
+            const ITunesFile* file = withDomain ? db.findITunesFile(domain, *it) : db.findITunesFile(*it);
+            benchmark::DoNotOptimize(file);
+        }
+    }
+    setCounters(state, paths.size() * state.iterations(), pathBytes * state.iterations());
+}
+
+// Files of a folder, e.g. Documents/d00003/
+struct FolderFilter
+{
+    std::string prefix;
+
+    bool operator()(const ITunesFile* file, const FolderFilter& filter) const
+    {
+        return std::strncmp(file->relativePath, filter.prefix.c_str(), filter.prefix.size()) < 0;
+    }
+
+    bool operator()(const FolderFilter& filter, const ITunesFile* file) const
+    {
+        return std::strncmp(file->relativePath, filter.prefix.c_str(), filter.prefix.size()) > 0;
+    }
+
+    bool operator==(const ITunesFile* file) const
+    {
+        return std::strncmp(file->relativePath, prefix.c_str(), prefix.size()) == 0;
+    }
+};
+
+static void benchmarkFilter(benchmark::State& state)
+{
+    ITunesDb db(getBackupPath(false), "Manifest.db");
+    db.setLoadingMode(ITunesDb::LOADING_PATH_ONLY);
+    if (!db.load())
+    {
+        state.SkipWithError("ITunesDb::load failed");
+        return;
+    }
+
+    std::vector<FolderFilter> filters;
+    for (uint64_t idx = 0; idx * 100 < g_config.numberOfFiles / g_config.numberOfDomains; ++idx)
+    {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "Documents/d%05llu/", (unsigned long long)idx);
+        FolderFilter filter;
+        filter.prefix = prefix;
+        filters.push_back(filter);
+    }
+
+    uint64_t numberOfFiles = 0;
+    uint64_t bytes = 0;
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        for (std::vector<FolderFilter>::const_iterator it = filters.cbegin(); it != filters.cend(); ++it)
+        {
+            ITunesFileVector files = db.filter(*it);
+            numberOfFiles += files.size();
+            bytes += it->prefix.size();
+        }
+    }
+    setCounters(state, numberOfFiles, bytes);
+}
+
+// Decoding of the blobs, MB/s is the size of the blobs
+
+static void benchmarkParseModifiedTime(benchmark::State& state)
+{
+    ITunesDb db(getBackupPath(false), "Manifest.db");
+    db.setLoadingMode(ITunesDb::LOADING_BLOB);
+    if (!db.load())
+    {
+        state.SkipWithError("ITunesDb::load failed");
+        return;
+    }
+    ITunesFileRange range = db.getFiles();
+    uint64_t blobBytes = 0;
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        blobBytes += (*it)->blobLength;
+    }
+
+    uint64_t numberOfFiles = 0;
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+        {
+            unsigned int modifiedTime = ITunesDb::parseModifiedTime((*it)->blob, (*it)->blobLength);
+            benchmark::DoNotOptimize(modifiedTime);
+        }
+        numberOfFiles += static_cast<uint64_t>(std::distance(range.first, range.second));
+    }
+    setCounters(state, numberOfFiles, blobBytes * state.iterations());
+}
+
+// Copy of a single file of range(0) bytes
+
+static void benchmarkCopyFile(benchmark::State& state)
+{
+    size_t size = static_cast<size_t>(state.range(0));
+    std::string srcPath = combinePath(g_config.workPath, "copy_src_" + std::to_string(size));
+    std::string destPath = combinePath(g_config.workPath, "copy_dest_" + std::to_string(size));
+    std::vector<unsigned char> data(size);
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        data[idx] = static_cast<unsigned char>(idx * 131);
+    }
+    if (!writeFile(srcPath, data))
+    {
+        state.SkipWithError("Failed to write the source");
+        return;
+    }
+    std::vector<unsigned char>().swap(data);
+
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        if (!copyFile(srcPath, destPath, true))
+        {
+            state.SkipWithError("copyFile failed");
+            break;
+        }
+    }
+    setCounters(state, state.iterations(), static_cast<uint64_t>(size) * state.iterations());
+    deleteFile(srcPath);
+    deleteFile(destPath);
+}
+
+// End to end export of a domain: load + enumFiles + copyFile, as the apps do
+
+static void benchmarkExportEnumFiles(benchmark::State& state)
+{
+    std::string backupPath = getBackupPath(false);
+    std::string domain = getSyntheticDomain(0);
+    std::string outputPath = combinePath(g_config.workPath, "export_enum");
+    uint64_t numberOfFiles = 0;
+    uint64_t bytes = 0;
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        deleteDirectory(outputPath);
+        makeDirectory(outputPath);
+        state.ResumeTiming();
+
+        ITunesDb db(backupPath, "Manifest.db");
+        db.setLoadingMode(ITunesDb::LOADING_METADATA);
+        if (!db.load(domain))
+        {
+            state.SkipWithError("ITunesDb::load failed");
+            break;
+        }
+        bool result = true;
+        db.enumFiles(domain, [&](const ITunesDb* itunesDb, const ITunesFile* file) {
+            std::string destPath = combinePath(outputPath, file->relativePath);
+            if (file->isDir())
+            {
+                return existsDirectory(destPath) || makeDirectory(destPath);
+            }
+            result = copyFile(itunesDb->getRealPath(file), destPath, true);
+            return result;
+        });
+        if (!result)
+        {
+            state.SkipWithError("copyFile failed");
+            break;
+        }
+        ITunesFileRange range = db.getFiles(domain);
+        numberOfFiles += static_cast<uint64_t>(std::distance(range.first, range.second));
+        bytes += getFileSizes(range);
+    }
+    setCounters(state, numberOfFiles, bytes);
+    deleteDirectory(outputPath);
+}
+
+static void benchmarkExportStreaming(benchmark::State& state)
+{
+    std::string backupPath = getBackupPath(false);
+    std::vector<std::string> domains(1, getSyntheticDomain(0));
+    std::string outputPath = combinePath(g_config.workPath, "export_streaming");
+    unsigned int jobs = static_cast<unsigned int>(state.range(0));
+    uint64_t numberOfFiles = 0;
+    uint64_t bytes = 0;
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        deleteDirectory(outputPath);
+        makeDirectory(outputPath);
+        state.ResumeTiming();
+
+        ITunesDb db(backupPath, "Manifest.db");
+        ITunesDb::ExportStats stats;
+        if (!db.exportStreaming(domains, outputPath, jobs, &stats) || stats.numberOfFailures > 0)
+        {
+            state.SkipWithError("ITunesDb::exportStreaming failed");
+            break;
+        }
+        numberOfFiles += stats.numberOfFiles;
+        bytes += stats.bytes;
+    }
+    setCounters(state, numberOfFiles, bytes);
+    deleteDirectory(outputPath);
+}
+
+// Digests
+
+static void benchmarkSha1(benchmark::State& state)
+{
+    std::vector<unsigned char> data(static_cast<size_t>(state.range(0)), 0x5a);
+    unsigned char digest[Sha1Digest::DIGEST_LENGTH];
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        Sha1Digest sha1;
+        sha1.update(&data[0], data.size());
+        sha1.finish(digest);
+        benchmark::DoNotOptimize(digest);
+    }
+    state.SetLabel(Sha1Digest::isAccelerated() ? "SHA-NI" : "scalar");
+    setCounters(state, state.iterations(), data.size() * state.iterations());
+}
+
+static void benchmarkMd5(benchmark::State& state)
+{
+    std::vector<unsigned char> data(static_cast<size_t>(state.range(0)), 0x5a);
+    unsigned char digest[Md5Digest::DIGEST_LENGTH];
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        Md5Digest md5;
+        md5.update(&data[0], data.size());
+        md5.finish(digest);
+        benchmark::DoNotOptimize(digest);
+    }
+    setCounters(state, state.iterations(), data.size() * state.iterations());
+}
+
+// fileIds of Manifest.mbdb
+static void benchmarkSha1Batch(benchmark::State& state)
+{
+    std::vector<std::string> messages;
+    uint64_t messageBytes = 0;
+    for (size_t idx = 0; idx < 100000; ++idx)
+    {
+        messages.push_back("AppDomain-com.tencent.xin-Documents/" + std::to_string(idx * 7919) + "/Audio/" + std::to_string(idx) + ".aud");
+        messageBytes += messages.back().size();
+    }
+    resetPeakRss();
+    for (auto _ : state)
+    {
+        Sha1Batch batch;
+        for (std::vector<std::string>::const_iterator it = messages.cbegin(); it != messages.cend(); ++it)
+        {
+            batch.add(it->c_str(), it->size());
+        }
+        batch.compute();
+    }
+    setCounters(state, messages.size() * state.iterations(), messageBytes * state.iterations());
+}
+
+static void registerBenchmarks()
+{
+    benchmark::RegisterBenchmark("manifest_parse", benchmarkManifestParse)->ArgName("jobs")->Arg(1)->Arg(0)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("load_domain/db", benchmarkLoad, false, false)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("load_all/db", benchmarkLoad, false, true)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("load_domain/mbdb", benchmarkLoad, true, false)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("load_all/mbdb", benchmarkLoad, true, true)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("find_file/path", benchmarkFindITunesFile, false, false)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("find_file/domain_path", benchmarkFindITunesFile, true, false)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("find_file/path/indexed", benchmarkFindITunesFile, false, true)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("find_file/domain_path/indexed", benchmarkFindITunesFile, true, true)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("filter/folder", benchmarkFilter)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("parse_modified_time", benchmarkParseModifiedTime)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("copy_file", benchmarkCopyFile)->ArgName("bytes")->Arg(4 * 1024)->Arg(256 * 1024)->Arg(16 * 1024 * 1024)->UseRealTime()->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("export/enum_files", benchmarkExportEnumFiles)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("export/streaming", benchmarkExportStreaming)->ArgName("jobs")->Arg(1)->Arg(0)->UseRealTime()->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark("digest/sha1", benchmarkSha1)->ArgName("bytes")->Arg(4 * 1024)->Arg(16 * 1024 * 1024)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("digest/md5", benchmarkMd5)->ArgName("bytes")->Arg(4 * 1024)->Arg(16 * 1024 * 1024)->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("digest/sha1_batch", benchmarkSha1Batch)->Unit(benchmark::kMillisecond);
+}
+
+// Take the options of the suite out of argv, the rest is for benchmark::Initialize
+static bool parseOptions(int& argc, char* argv[])
+{
+    int numberOfArgs = 1;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        std::string arg = argv[idx];
+        std::string::size_type pos = arg.find('=');
+        std::string name = arg.substr(0, pos);
+        std::string value = pos == std::string::npos ? "" : arg.substr(pos + 1);
+        if (name == "--itb_files")
+        {
+            g_config.numberOfFiles = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else if (name == "--itb_domains")
+        {
+            g_config.numberOfDomains = static_cast<unsigned int>(std::strtoul(value.c_str(), NULL, 10));
+            if (g_config.numberOfDomains == 0)
+            {
+                return false;
+            }
+        }
+        else if (name == "--itb_backups")
+        {
+            g_config.numberOfBackups = static_cast<unsigned int>(std::strtoul(value.c_str(), NULL, 10));
+        }
+        else if (name == "--itb_work_dir")
+        {
+            char* fullPath = realpath(value.c_str(), NULL);
+            if (NULL == fullPath)
+            {
+                return false;
+            }
+            g_config.workPath = fullPath;
+            g_config.keepingWorkPath = true;
+            free(fullPath);
+        }
+        else
+        {
+            argv[numberOfArgs++] = argv[idx];
+        }
+    }
+    argc = numberOfArgs;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parseOptions(argc, argv))
+    {
+        fprintf(stderr, "Invalid option, usage: core_benchmark [--itb_files=<n>] [--itb_domains=<n>] [--itb_backups=<n>] [--itb_work_dir=<existing path>] [benchmark options]\n");
+        return 2;
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 2;
+    }
+
+    if (g_config.workPath.empty())
+    {
+        char tempPath[] = "/tmp/itunesbackup_benchmark.XXXXXX";
+        if (NULL == mkdtemp(tempPath))
+        {
+            fprintf(stderr, "Failed to create the temporary folder\n");
+            return 1;
+        }
+        g_config.workPath = tempPath;
+    }
+    if (!generateFixtures())
+    {
+        fprintf(stderr, "Failed to generate the backups in %s\n", g_config.workPath.c_str());
+        return 1;
+    }
+
+    registerBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    if (!g_config.keepingWorkPath)
+    {
+        deleteDirectory(g_config.workPath);
+    }
+    return 0;
+}
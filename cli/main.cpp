@@ -0,0 +1,518 @@
+//
+//  main.cpp
+//  itunesbackup-cli
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../iTunesBackup/core/FileSystem.h"
+#include "../iTunesBackup/core/ITunesParser.h"
+
+// Set by SIGINT/SIGTERM, the streaming export and verify stop queuing files and return what was done
+static std::atomic_bool g_cancelled(false);
+
+static void onSignal(int)
+{
+    g_cancelled = true;
+}
+
+struct Options
+{
+    std::string command;
+    std::vector<std::string> arguments;
+    std::vector<std::string> bundleIds;
+    std::vector<std::string> domains;
+    std::string outputPath;     // verify --output
+    std::string backupId;       // copy --backup-id
+    unsigned int jobs;
+    bool json;
+    bool progress;
+    bool incremental;
+    bool link;
+    bool verify;
+
+    Options() : jobs(0), json(false), progress(false), incremental(false), link(false), verify(false)
+    {
+    }
+};
+
+static void printUsage()
+{
+    fprintf(stderr,
+            "Usage: itunesbackup-cli <command> [options]\n"
+            "\n"
+            "Commands:\n"
+            "  list <backup-dir>                      List the backups in the folder (e.g. MobileSync/Backup)\n"
+            "  apps <backup-path>                     List the apps installed in the backup\n"
+            "  export <backup-path> <output-dir>      Export the files of the apps to output-dir/domain/relativePath\n"
+            "  copy <backup-path> <output-dir>        Create a backup with the apps only in output-dir/Backup/<backup-id>\n"
+            "  verify <backup-path>                   Check the files of the apps with the digests of the backup\n"
+            "\n"
+            "Options:\n"
+            "  --app <bundle-id>      App to export/copy/verify (AppDomain- and AppDomainGroup-group. domains), repeatable\n"
+            "  --domain <domain>      Domain to export/verify, repeatable\n"
+            "  --jobs <n>             Number of threads (default: one per core)\n"
+            "  --incremental          export: skip the files which are unchanged since the last export\n"
+            "  --link                 export/copy: clone or hard link the files instead of copying them\n"
+            "  --verify               export: check the files with the digests of the backup while exporting\n"
+            "  --output <dir>         verify: compare the files exported to dir with the backup too\n"
+            "  --backup-id <id>       copy: name of the new backup (default: the name of backup-path)\n"
+            "  --progress             Write the progress to stderr as JSON lines\n"
+            "  --json                 Write the result to stdout as JSON\n");
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    if (argc < 2)
+    {
+        return false;
+    }
+    options.command = argv[1];
+    for (int idx = 2; idx < argc; ++idx)
+    {
+        std::string arg = argv[idx];
+        bool hasValue = idx + 1 < argc;
+        if (arg == "--app" && hasValue)
+        {
+            options.bundleIds.push_back(argv[++idx]);
+        }
+        else if (arg == "--domain" && hasValue)
+        {
+            options.domains.push_back(argv[++idx]);
+        }
+        else if (arg == "--jobs" && hasValue)
+        {
+            options.jobs = static_cast<unsigned int>(std::strtoul(argv[++idx], NULL, 10));
+        }
+        else if (arg == "--output" && hasValue)
+        {
+            options.outputPath = argv[++idx];
+        }
+        else if (arg == "--backup-id" && hasValue)
+        {
+            options.backupId = argv[++idx];
+        }
+        else if (arg == "--json")
+        {
+            options.json = true;
+        }
+        else if (arg == "--progress")
+        {
+            options.progress = true;
+        }
+        else if (arg == "--incremental")
+        {
+            options.incremental = true;
+        }
+        else if (arg == "--link")
+        {
+            options.link = true;
+        }
+        else if (arg == "--verify")
+        {
+            options.verify = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", arg.c_str());
+            return false;
+        }
+        else
+        {
+            options.arguments.push_back(arg);
+        }
+    }
+    return true;
+}
+
+static std::string escapeJson(const std::string& value)
+{
+    std::string escaped;
+    escaped.reserve(value.size() + 2);
+    for (std::string::const_iterator it = value.cbegin(); it != value.cend(); ++it)
+    {
+        unsigned char ch = static_cast<unsigned char>(*it);
+        switch (ch)
+        {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if (ch < 0x20)
+                {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", ch);
+                    escaped += buffer;
+                }
+                else
+                {
+                    escaped += *it;
+                }
+                break;
+        }
+    }
+    return escaped;
+}
+
+static const char* getVerifyStatusName(ITunesDb::VerifyStatus status)
+{
+    switch (status)
+    {
+        case ITunesDb::VERIFY_OK:
+            return "ok";
+        case ITunesDb::VERIFY_NO_DIGEST:
+            return "no-digest";
+        case ITunesDb::VERIFY_DIGEST_MISMATCH:
+            return "digest-mismatch";
+        case ITunesDb::VERIFY_OUTPUT_MISMATCH:
+            return "output-mismatch";
+        case ITunesDb::VERIFY_READ_ERROR:
+            return "read-error";
+    }
+    return "unknown";
+}
+
+// The core opens Manifest.db with a file: URI, which takes absolute paths only
+static bool getFullPath(const std::string& path, std::string& fullPath)
+{
+#ifdef _WIN32
+    char* resolvedPath = _fullpath(NULL, path.c_str(), 0);
+#else
+    char* resolvedPath = realpath(path.c_str(), NULL);
+#endif
+    if (NULL == resolvedPath)
+    {
+        fprintf(stderr, "Failed to resolve the path: %s\n", path.c_str());
+        return false;
+    }
+    fullPath = resolvedPath;
+    free(resolvedPath);
+    return true;
+}
+
+// The domains of the apps and the ones given by --domain
+static std::vector<std::string> getDomains(const Options& options)
+{
+    std::vector<std::string> domains;
+    for (std::vector<std::string>::const_iterator it = options.bundleIds.cbegin(); it != options.bundleIds.cend(); ++it)
+    {
+        domains.push_back("AppDomain-" + *it);
+        domains.push_back("AppDomainGroup-group." + *it);
+    }
+    domains.insert(domains.end(), options.domains.cbegin(), options.domains.cend());
+    return domains;
+}
+
+static void setupDb(ITunesDb& db, const Options& options, const char* command)
+{
+    db.setIncrementalExport(options.incremental);
+    db.setExportMethod(options.link ? ITunesDb::EXPORT_LINK : ITunesDb::EXPORT_COPY);
+    if (options.progress)
+    {
+        // One JSON object per line, so a wrapper can parse the lines as they come
+        std::string name = command;
+        db.setProgressHandler([name](size_t numberOfProcessedFiles, size_t numberOfFiles, bool done) {
+            fprintf(stderr, "{\"event\":\"progress\",\"command\":\"%s\",\"processed\":%zu,\"queued\":%zu,\"done\":%s}\n", name.c_str(), numberOfProcessedFiles, numberOfFiles, done ? "true" : "false");
+            fflush(stderr);
+        });
+    }
+}
+
+static void printVerifyReport(const ITunesDb::VerifyReport& report, bool json)
+{
+    if (json)
+    {
+        printf("\"verify\":{\"files\":%zu,\"matches\":%zu,\"withoutDigest\":%zu,\"bytes\":%llu,\"seconds\":%.3f,\"issues\":[",
+               report.numberOfFiles, report.numberOfMatches, report.numberOfFilesWithoutDigest, (unsigned long long)report.bytes, report.seconds);
+        for (std::vector<ITunesDb::VerifyIssue>::const_iterator it = report.issues.cbegin(); it != report.issues.cend(); ++it)
+        {
+            printf("%s{\"status\":\"%s\",\"domain\":\"%s\",\"relativePath\":\"%s\",\"fileId\":\"%s\",\"expected\":\"%s\",\"actual\":\"%s\"}",
+                   it == report.issues.cbegin() ? "" : ",", getVerifyStatusName(it->status), escapeJson(it->domain).c_str(), escapeJson(it->relativePath).c_str(),
+                   it->fileId.c_str(), it->expectedDigest.c_str(), it->actualDigest.c_str());
+        }
+        printf("]}");
+        return;
+    }
+
+    printf("Verified: %zu files, %zu matches, %zu without digest, %llu bytes in %.3fs\n",
+           report.numberOfFiles, report.numberOfMatches, report.numberOfFilesWithoutDigest, (unsigned long long)report.bytes, report.seconds);
+    for (std::vector<ITunesDb::VerifyIssue>::const_iterator it = report.issues.cbegin(); it != report.issues.cend(); ++it)
+    {
+        printf("%s\t%s\t%s\t%s\texpected=%s\tactual=%s\n", getVerifyStatusName(it->status), it->domain.c_str(), it->relativePath.c_str(), it->fileId.c_str(), it->expectedDigest.c_str(), it->actualDigest.c_str());
+    }
+}
+
+static int listBackups(const Options& options)
+{
+    if (options.arguments.size() != 1)
+    {
+        printUsage();
+        return 2;
+    }
+
+    ManifestParser parser(options.arguments[0], false);
+    parser.setJobs(options.jobs);
+    std::vector<BackupManifest> manifests;
+    if (!parser.parse(manifests))
+    {
+        fprintf(stderr, "Failed to parse the backups: %s\n", parser.getLastError().c_str());
+        return 1;
+    }
+
+    if (options.json)
+    {
+        printf("[");
+    }
+    for (std::vector<BackupManifest>::const_iterator it = manifests.cbegin(); it != manifests.cend(); ++it)
+    {
+        if (options.json)
+        {
+            printf("%s{\"backupId\":\"%s\",\"displayName\":\"%s\",\"deviceName\":\"%s\",\"backupTime\":\"%s\",\"iOSVersion\":\"%s\",\"encrypted\":%s,\"path\":\"%s\"}",
+                   it == manifests.cbegin() ? "" : ",", escapeJson(it->getBackupId()).c_str(), escapeJson(it->getDisplayName()).c_str(), escapeJson(it->getDeviceName()).c_str(),
+                   escapeJson(it->getBackupTime()).c_str(), escapeJson(it->getIOSVersion()).c_str(), it->isEncrypted() ? "true" : "false", escapeJson(it->getPath()).c_str());
+        }
+        else
+        {
+            printf("%s\t%s\t%s\t%s\t%s%s\n", it->getBackupId().c_str(), it->getDisplayName().c_str(), it->getBackupTime().c_str(), it->getIOSVersion().c_str(), it->getPath().c_str(), it->isEncrypted() ? "\t(encrypted)" : "");
+        }
+    }
+    if (options.json)
+    {
+        printf("]\n");
+    }
+    return 0;
+}
+
+static int listApps(const Options& options)
+{
+    if (options.arguments.size() != 1)
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<BackupManifest::AppInfo> apps;
+    if (!ManifestParser::parseApps(options.arguments[0], apps))
+    {
+        fprintf(stderr, "Failed to read the apps from Info.plist of %s\n", options.arguments[0].c_str());
+        return 1;
+    }
+
+    if (options.json)
+    {
+        printf("[");
+    }
+    for (std::vector<BackupManifest::AppInfo>::const_iterator it = apps.cbegin(); it != apps.cend(); ++it)
+    {
+        if (options.json)
+        {
+            printf("%s{\"bundleId\":\"%s\",\"name\":\"%s\",\"version\":\"%s\",\"build\":\"%s\"}", it == apps.cbegin() ? "" : ",",
+                   escapeJson(it->bundleId).c_str(), escapeJson(it->name).c_str(), escapeJson(it->bundleShortVersion).c_str(), escapeJson(it->bundleVersion).c_str());
+        }
+        else
+        {
+            printf("%s\t%s\t%s\n", it->bundleId.c_str(), it->name.c_str(), it->bundleShortVersion.c_str());
+        }
+    }
+    if (options.json)
+    {
+        printf("]\n");
+    }
+    return 0;
+}
+
+static int exportFiles(const Options& options)
+{
+    std::vector<std::string> domains = getDomains(options);
+    if (options.arguments.size() != 2 || domains.empty())
+    {
+        printUsage();
+        return 2;
+    }
+
+    if (!existsDirectory(options.arguments[1]) && !makeDirectory(options.arguments[1]))
+    {
+        fprintf(stderr, "Failed to create the output folder: %s\n", options.arguments[1].c_str());
+        return 1;
+    }
+    std::string backupPath;
+    std::string outputPath;
+    if (!getFullPath(options.arguments[0], backupPath) || !getFullPath(options.arguments[1], outputPath))
+    {
+        return 1;
+    }
+
+    ITunesDb db(backupPath, "Manifest.db");
+    setupDb(db, options, "export");
+    ITunesDb::ExportStats stats;
+    ITunesDb::VerifyReport report;
+    bool result = db.exportStreaming(domains, outputPath, options.jobs, &stats, &g_cancelled, options.verify ? &report : NULL);
+
+    if (options.json)
+    {
+        printf("{\"result\":%s,\"cancelled\":%s,\"files\":%zu,\"directories\":%zu,\"failures\":%zu,\"skipped\":%zu,\"bytes\":%llu,\"seconds\":%.3f,\"filesPerSecond\":%.1f,\"bytesPerSecond\":%.1f",
+               result ? "true" : "false", g_cancelled ? "true" : "false", stats.numberOfFiles, stats.numberOfDirectories, stats.numberOfFailures, stats.numberOfSkippedFiles,
+               (unsigned long long)stats.bytes, stats.seconds, stats.getFilesPerSecond(), stats.getBytesPerSecond());
+        if (options.verify)
+        {
+            printf(",");
+            printVerifyReport(report, true);
+        }
+        printf("}\n");
+    }
+    else
+    {
+        printf("Exported: %zu files, %zu directories, %zu failures, %zu unchanged, %llu bytes in %.3fs (%.1f files/s, %.1f MB/s)\n",
+               stats.numberOfFiles, stats.numberOfDirectories, stats.numberOfFailures, stats.numberOfSkippedFiles,
+               (unsigned long long)stats.bytes, stats.seconds, stats.getFilesPerSecond(), stats.getBytesPerSecond() / (1024 * 1024));
+        if (options.verify)
+        {
+            printVerifyReport(report, false);
+        }
+    }
+
+    return (result && !g_cancelled && (!options.verify || report.issues.empty())) ? 0 : 1;
+}
+
+static int copyBackup(const Options& options)
+{
+    if (options.arguments.size() != 2 || !options.domains.empty())
+    {
+        // The subset backup is made of the domains of the apps, --domain doesn't apply
+        printUsage();
+        return 2;
+    }
+
+    // Manifest.db of the new backup is created in the output folder, it has to be resolved too
+    if (!existsDirectory(options.arguments[1]) && !makeDirectory(options.arguments[1]))
+    {
+        fprintf(stderr, "Failed to create the output folder: %s\n", options.arguments[1].c_str());
+        return 1;
+    }
+    std::string backupPath;
+    std::string outputPath;
+    if (!getFullPath(options.arguments[0], backupPath) || !getFullPath(options.arguments[1], outputPath))
+    {
+        return 1;
+    }
+    std::string backupId = options.backupId;
+    if (backupId.empty())
+    {
+        // The name given by the user, realpath follows the symbolic links
+        std::string name = options.arguments[0];
+        while (!name.empty() && (name.back() == DIR_SEP || name.back() == ALT_DIR_SEP))
+        {
+            name.pop_back();
+        }
+        std::string::size_type pos = name.find_last_of(DIR_SEP_STR "/");
+        backupId = (pos == std::string::npos) ? name : name.substr(pos + 1);
+    }
+
+    ITunesDb db(backupPath, "Manifest.db");
+    setupDb(db, options, "copy");
+    std::vector<std::string> bundleIds = options.bundleIds;
+    bool result = db.copy(outputPath, backupId, bundleIds, options.jobs);
+
+    std::string destPath = combinePath(outputPath, "Backup", backupId);
+    if (options.json)
+    {
+        printf("{\"result\":%s,\"path\":\"%s\"}\n", result ? "true" : "false", escapeJson(destPath).c_str());
+    }
+    else
+    {
+        printf("%s: %s\n", result ? "Copied" : "Failed to copy", destPath.c_str());
+    }
+    return result ? 0 : 1;
+}
+
+static int verifyFiles(const Options& options)
+{
+    std::vector<std::string> domains = getDomains(options);
+    if (options.arguments.size() != 1 || domains.empty())
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::string backupPath;
+    std::string outputPath;
+    if (!getFullPath(options.arguments[0], backupPath) || (!options.outputPath.empty() && !getFullPath(options.outputPath, outputPath)))
+    {
+        return 1;
+    }
+
+    ITunesDb db(backupPath, "Manifest.db");
+    setupDb(db, options, "verify");
+    ITunesDb::VerifyReport report;
+    bool result = db.verify(domains, outputPath, options.jobs, report, &g_cancelled);
+
+    if (options.json)
+    {
+        printf("{\"result\":%s,\"cancelled\":%s,", result ? "true" : "false", g_cancelled ? "true" : "false");
+        printVerifyReport(report, true);
+        printf("}\n");
+    }
+    else
+    {
+        printVerifyReport(report, false);
+    }
+    return (result && !g_cancelled && report.issues.empty()) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    if (options.command == "list")
+    {
+        return listBackups(options);
+    }
+    else if (options.command == "apps")
+    {
+        return listApps(options);
+    }
+    else if (options.command == "export")
+    {
+        return exportFiles(options);
+    }
+    else if (options.command == "copy")
+    {
+        return copyBackup(options);
+    }
+    else if (options.command == "verify")
+    {
+        return verifyFiles(options);
+    }
+
+    printUsage();
+    return 2;
+}
@@ -13,30 +13,11 @@
 #include "Utils.h"
 #include "FileSystem.h"
 
-static bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITunesFile* file)
-{
-    std::string dest = combinePath(output, file->relativePath);
-    if (file->isDir())
-    {
-        makeDirectory(dest);
-    }
-    else
-    {
-        copyFile(iTunesDb->getRealPath(file), dest, true);
-    }
-
-    unsigned int modifiedTime = ITunesDb::parseModifiedTime(file->blob);
-    if (modifiedTime > 0)
-    {
-        updateFileTime(dest, modifiedTime);
-    }
-
-    return true;
-}
-
 @interface ViewController() <NSTableViewDelegate>
 {
     std::vector<BackupManifest> m_manifests;
+    // The parsers of m_manifests, kept to save the apps decoded on selection to their cache
+    std::vector<std::shared_ptr<ManifestParser>> m_parsers;
     NSInteger m_selectedIndex;
     
     AppDataSource   *m_dataSource;
@@ -143,10 +124,12 @@ static bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITun
     {
         NSString *backupDir = [NSString pathWithComponents:components];
 
-        ManifestParser parser([backupDir UTF8String], true);
+        std::shared_ptr<ManifestParser> parser = std::make_shared<ManifestParser>([backupDir UTF8String], true);
+        parser->setCachePath([[ViewController getManifestCachePath] UTF8String]);
         std::vector<BackupManifest> manifests;
-        if (parser.parse(manifests))
+        if (parser->parse(manifests))
         {
+            m_parsers.push_back(parser);
             [self updateBackups:manifests];
         }
     }
@@ -201,6 +184,16 @@ static bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITun
     return [self getDefaultOutputDir];
 }
 
++ (NSString *)getManifestCachePath
+{
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+    NSString *cacheDir = (nil != paths && paths.count > 0) ? [paths objectAtIndex:0] : [NSHomeDirectory() stringByAppendingPathComponent:@"Library/Caches"];
+    cacheDir = [cacheDir stringByAppendingPathComponent:@"iTunesBackup"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:cacheDir withIntermediateDirectories:YES attributes:nil error:nil];
+    
+    return [cacheDir stringByAppendingPathComponent:@"Manifests.cache"];
+}
+
 + (NSString *)getDefaultOutputDir
 {
     NSMutableArray *components = [NSMutableArray array];
@@ -298,6 +291,11 @@ static bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITun
         }
         
         const std::vector<BackupManifest::AppInfo>& apps = manifest.getApps();
+        // Cache the apps getApps() has just decoded
+        for (std::vector<std::shared_ptr<ManifestParser>>::const_iterator it = m_parsers.cbegin(); it != m_parsers.cend(); ++it)
+        {
+            (*it)->saveCache();
+        }
         [m_dataSource loadData:&apps];
         [self.tblApps reloadData];
     }
@@ -322,10 +320,12 @@ static bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITun
             
             if ([backupPath hasSuffix:@"/Backup"] || [backupPath hasSuffix:@"/Backup/"])
             {
-                ManifestParser parser([backupPath UTF8String], true);
+                std::shared_ptr<ManifestParser> parser = std::make_shared<ManifestParser>([backupPath UTF8String], true);
+                parser->setCachePath([[ViewController getManifestCachePath] UTF8String]);
                 std::vector<BackupManifest> manifests;
-                if (parser.parse(manifests))
+                if (parser->parse(manifests))
                 {
+                    m_parsers.push_back(parser);
                     [self updateBackups:manifests];
                 }
             }
@@ -429,18 +429,16 @@ static bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITun
     std::string output([outputPath UTF8String]);
     std::string backup([backupPath UTF8String]);
     
+    std::vector<std::string> domainNames;
     for(NSString *domain in domains)
     {
-        std::string domainOutput = combinePath(output, [domain UTF8String]);
-        makeDirectory(domainOutput);
-        
-        ITunesDb* iTunesDb = new ITunesDb(backup, "Manifest.db");
-        if (iTunesDb->load([domain UTF8String]))
-        {
-            iTunesDb->enumFiles(std::bind(&handleFile, std::cref(domainOutput), std::placeholders::_1, std::placeholders::_2));
-        }
-        delete iTunesDb;
+        domainNames.push_back([domain UTF8String]);
     }
+    
+    // Files are copied while Manifest.db is scanned, nothing is kept in memory
+    ITunesDb* iTunesDb = new ITunesDb(backup, "Manifest.db");
+    iTunesDb->exportStreaming(domainNames, output, 0);
+    delete iTunesDb;
 }
 
 - (void)exportWechatFiles:(NSString *)outputPath onBackup:(NSString *)backupPath
@@ -0,0 +1,113 @@
+//
+//  Arena.h
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifndef Arena_h
+#define Arena_h
+
+// Bump allocator for data which shares the lifetime of its owner (e.g. the rows of Manifest.db)
+// Memory is handed out from large blocks and released all at once, so
+// loading/freeing N strings costs a few allocations instead of N.
+// Pointers returned by the arena stay valid until clear() or destruction.
+class Arena
+{
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE) : m_blockSize(blockSize), m_ptr(NULL), m_remaining(0), m_allocatedSize(0)
+    {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = sizeof(void *))
+    {
+        size_t padding = (alignment - (reinterpret_cast<uintptr_t>(m_ptr) & (alignment - 1))) & (alignment - 1);
+        if (NULL == m_ptr || size + padding > m_remaining)
+        {
+            if (size > m_blockSize / 4)
+            {
+                // Keep the current block for small allocations
+                return allocateBlock(size);
+            }
+
+            m_ptr = allocateBlock(m_blockSize);
+            m_remaining = m_blockSize;
+            padding = 0;
+        }
+
+        char *ptr = m_ptr + padding;
+        m_ptr = ptr + size;
+        m_remaining -= size + padding;
+
+        return ptr;
+    }
+
+    // Copy the string and append the null terminator
+    const char* copy(const char* str, size_t length)
+    {
+        char *ptr = reinterpret_cast<char *>(allocate(length + 1, 1));
+        if (length > 0)
+        {
+            std::memcpy(ptr, str, length);
+        }
+        ptr[length] = '\0';
+        return ptr;
+    }
+
+    const char* copy(const char* str)
+    {
+        return NULL == str ? copy("", 0) : copy(str, std::strlen(str));
+    }
+
+    const unsigned char* copy(const unsigned char* data, size_t length)
+    {
+        unsigned char *ptr = reinterpret_cast<unsigned char *>(allocate(length, 1));
+        if (length > 0)
+        {
+            std::memcpy(ptr, data, length);
+        }
+        return ptr;
+    }
+
+    void clear()
+    {
+        m_blocks.clear();
+        m_ptr = NULL;
+        m_remaining = 0;
+        m_allocatedSize = 0;
+    }
+
+    size_t getAllocatedSize() const
+    {
+        return m_allocatedSize;
+    }
+
+private:
+    char* allocateBlock(size_t size)
+    {
+        m_blocks.emplace_back(new char[size]);
+        m_allocatedSize += size;
+        return m_blocks.back().get();
+    }
+
+private:
+    size_t m_blockSize;
+    char* m_ptr;
+    size_t m_remaining;
+    size_t m_allocatedSize;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+};
+
+#endif /* Arena_h */
@@ -0,0 +1,902 @@
+//
+//  Digest.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "Digest.h"
+#include <cstring>
+#include "FileSystem.h"
+
+// SHA-NI needs SSSE3/SSE4.1 as well, the SIMD code is compiled for it by the target attribute and
+// only called after cpuid reports the extensions, so the rest of the binary doesn't require them
+// Define DIGEST_DISABLE_SIMD to build the scalar code only
+#if !defined(DIGEST_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <immintrin.h>
+#define DIGEST_SHA_NI
+#define DIGEST_TARGET_SHA
+#define DIGEST_TARGET_AVX2
+#elif defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)
+#include <cpuid.h>
+#include <immintrin.h>
+#define DIGEST_SHA_NI
+#define DIGEST_TARGET_SHA __attribute__((target("sha,ssse3,sse4.1")))
+#define DIGEST_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#define DIGEST_CHUNK_SIZE   (1024 * 1024)
+
+static inline uint32_t rotateLeft(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static inline uint32_t readLittleEndian32(const unsigned char* data)
+{
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static inline uint32_t readBigEndian32(const unsigned char* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+static inline void writeBigEndian32(unsigned char* data, uint32_t value)
+{
+    data[0] = static_cast<unsigned char>(value >> 24);
+    data[1] = static_cast<unsigned char>(value >> 16);
+    data[2] = static_cast<unsigned char>(value >> 8);
+    data[3] = static_cast<unsigned char>(value);
+}
+
+// Shared by both digests: fill the partial block first, then hand over the whole blocks directly
+template<class TTransform>
+static void updateBlocks(uint32_t* state, unsigned char* buffer, size_t& bufferLength, uint64_t& length, const void* data, size_t dataLength, TTransform transform)
+{
+    const unsigned char* ptr = reinterpret_cast<const unsigned char *>(data);
+    length += dataLength;
+
+    if (bufferLength > 0)
+    {
+        size_t bytes = 64 - bufferLength;
+        if (bytes > dataLength)
+        {
+            bytes = dataLength;
+        }
+        memcpy(buffer + bufferLength, ptr, bytes);
+        bufferLength += bytes;
+        ptr += bytes;
+        dataLength -= bytes;
+        if (bufferLength < 64)
+        {
+            return;
+        }
+        transform(state, buffer, 1);
+        bufferLength = 0;
+    }
+
+    if (dataLength >= 64)
+    {
+        transform(state, ptr, dataLength / 64);
+        ptr += dataLength & ~static_cast<size_t>(63);
+        dataLength &= 63;
+    }
+
+    if (dataLength > 0)
+    {
+        memcpy(buffer, ptr, dataLength);
+        bufferLength = dataLength;
+    }
+}
+
+Md5Digest::Md5Digest()
+{
+    reset();
+}
+
+void Md5Digest::reset()
+{
+    m_state[0] = 0x67452301;
+    m_state[1] = 0xefcdab89;
+    m_state[2] = 0x98badcfe;
+    m_state[3] = 0x10325476;
+    m_length = 0;
+    m_bufferLength = 0;
+}
+
+void Md5Digest::update(const void* data, size_t length)
+{
+    updateBlocks(m_state, m_buffer, m_bufferLength, m_length, data, length, &Md5Digest::transform);
+}
+
+void Md5Digest::finish(unsigned char* digest)
+{
+    uint64_t bits = m_length * 8;
+    unsigned char padding[72] = {0x80};
+    size_t paddingLength = (m_bufferLength < 56) ? (56 - m_bufferLength) : (120 - m_bufferLength);
+    for (int idx = 0; idx < 8; ++idx)
+    {
+        padding[paddingLength + idx] = static_cast<unsigned char>(bits >> (idx * 8));
+    }
+    update(padding, paddingLength + 8);
+
+    for (int idx = 0; idx < 4; ++idx)
+    {
+        for (int byteIdx = 0; byteIdx < 4; ++byteIdx)
+        {
+            digest[idx * 4 + byteIdx] = static_cast<unsigned char>(m_state[idx] >> (byteIdx * 8));
+        }
+    }
+}
+
+#define MD5_STEP(f, a, b, c, d, x, t, s) \
+    (a) += f((b), (c), (d)) + (x) + (t); \
+    (a) = rotateLeft((a), (s)) + (b);
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+void Md5Digest::transform(uint32_t* state, const unsigned char* blocks, size_t numberOfBlocks)
+{
+    uint32_t x[16];
+    for (size_t blockIdx = 0; blockIdx < numberOfBlocks; ++blockIdx, blocks += 64)
+    {
+        for (int idx = 0; idx < 16; ++idx)
+        {
+            x[idx] = readLittleEndian32(blocks + idx * 4);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+
+        MD5_STEP(MD5_F, a, b, c, d, x[0], 0xd76aa478, 7)
+        MD5_STEP(MD5_F, d, a, b, c, x[1], 0xe8c7b756, 12)
+        MD5_STEP(MD5_F, c, d, a, b, x[2], 0x242070db, 17)
+        MD5_STEP(MD5_F, b, c, d, a, x[3], 0xc1bdceee, 22)
+        MD5_STEP(MD5_F, a, b, c, d, x[4], 0xf57c0faf, 7)
+        MD5_STEP(MD5_F, d, a, b, c, x[5], 0x4787c62a, 12)
+        MD5_STEP(MD5_F, c, d, a, b, x[6], 0xa8304613, 17)
+        MD5_STEP(MD5_F, b, c, d, a, x[7], 0xfd469501, 22)
+        MD5_STEP(MD5_F, a, b, c, d, x[8], 0x698098d8, 7)
+        MD5_STEP(MD5_F, d, a, b, c, x[9], 0x8b44f7af, 12)
+        MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17)
+        MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22)
+        MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7)
+        MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12)
+        MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17)
+        MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22)
+
+        MD5_STEP(MD5_G, a, b, c, d, x[1], 0xf61e2562, 5)
+        MD5_STEP(MD5_G, d, a, b, c, x[6], 0xc040b340, 9)
+        MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14)
+        MD5_STEP(MD5_G, b, c, d, a, x[0], 0xe9b6c7aa, 20)
+        MD5_STEP(MD5_G, a, b, c, d, x[5], 0xd62f105d, 5)
+        MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9)
+        MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14)
+        MD5_STEP(MD5_G, b, c, d, a, x[4], 0xe7d3fbc8, 20)
+        MD5_STEP(MD5_G, a, b, c, d, x[9], 0x21e1cde6, 5)
+        MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9)
+        MD5_STEP(MD5_G, c, d, a, b, x[3], 0xf4d50d87, 14)
+        MD5_STEP(MD5_G, b, c, d, a, x[8], 0x455a14ed, 20)
+        MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5)
+        MD5_STEP(MD5_G, d, a, b, c, x[2], 0xfcefa3f8, 9)
+        MD5_STEP(MD5_G, c, d, a, b, x[7], 0x676f02d9, 14)
+        MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20)
+
+        MD5_STEP(MD5_H, a, b, c, d, x[5], 0xfffa3942, 4)
+        MD5_STEP(MD5_H, d, a, b, c, x[8], 0x8771f681, 11)
+        MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16)
+        MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23)
+        MD5_STEP(MD5_H, a, b, c, d, x[1], 0xa4beea44, 4)
+        MD5_STEP(MD5_H, d, a, b, c, x[4], 0x4bdecfa9, 11)
+        MD5_STEP(MD5_H, c, d, a, b, x[7], 0xf6bb4b60, 16)
+        MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23)
+        MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4)
+        MD5_STEP(MD5_H, d, a, b, c, x[0], 0xeaa127fa, 11)
+        MD5_STEP(MD5_H, c, d, a, b, x[3], 0xd4ef3085, 16)
+        MD5_STEP(MD5_H, b, c, d, a, x[6], 0x04881d05, 23)
+        MD5_STEP(MD5_H, a, b, c, d, x[9], 0xd9d4d039, 4)
+        MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11)
+        MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16)
+        MD5_STEP(MD5_H, b, c, d, a, x[2], 0xc4ac5665, 23)
+
+        MD5_STEP(MD5_I, a, b, c, d, x[0], 0xf4292244, 6)
+        MD5_STEP(MD5_I, d, a, b, c, x[7], 0x432aff97, 10)
+        MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15)
+        MD5_STEP(MD5_I, b, c, d, a, x[5], 0xfc93a039, 21)
+        MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6)
+        MD5_STEP(MD5_I, d, a, b, c, x[3], 0x8f0ccc92, 10)
+        MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15)
+        MD5_STEP(MD5_I, b, c, d, a, x[1], 0x85845dd1, 21)
+        MD5_STEP(MD5_I, a, b, c, d, x[8], 0x6fa87e4f, 6)
+        MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10)
+        MD5_STEP(MD5_I, c, d, a, b, x[6], 0xa3014314, 15)
+        MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21)
+        MD5_STEP(MD5_I, a, b, c, d, x[4], 0xf7537e82, 6)
+        MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10)
+        MD5_STEP(MD5_I, c, d, a, b, x[2], 0x2ad7d2bb, 15)
+        MD5_STEP(MD5_I, b, c, d, a, x[9], 0xeb86d391, 21)
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+}
+
+#ifdef DIGEST_SHA_NI
+enum CpuFeature
+{
+    CPU_FEATURE_SHA = DIGEST_SIMD_SHA,
+    CPU_FEATURE_AVX2 = DIGEST_SIMD_AVX2,
+};
+
+static unsigned int g_simdMask = DIGEST_SIMD_ALL;
+
+static unsigned int detectCpuFeatures()
+{
+    unsigned int features = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4] = {0};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return 0;
+    }
+    __cpuid(info, 1);
+    unsigned int ecx1 = static_cast<unsigned int>(info[2]);
+    __cpuidex(info, 7, 0);
+    unsigned int ebx7 = static_cast<unsigned int>(info[1]);
+    // AVX2 also needs the OS to save the YMM registers
+    bool ymmEnabled = (ecx1 & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+#else
+    unsigned int eax = 0, ebx = 0, ecx1 = 0, edx = 0;
+    if (__get_cpuid_max(0, NULL) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+    {
+        return 0;
+    }
+    unsigned int ebx7 = 0, ecx = 0;
+    __cpuid_count(7, 0, eax, ebx7, ecx, edx);
+    bool ymmEnabled = false;
+    if ((ecx1 & (1 << 27)) != 0)
+    {
+        unsigned int xcr0 = 0;
+        __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+        ymmEnabled = (xcr0 & 6) == 6;
+    }
+#endif
+    if ((ecx1 & (1 << 9)) != 0 && (ecx1 & (1 << 19)) != 0 && (ebx7 & (1 << 29)) != 0)
+    {
+        features |= CPU_FEATURE_SHA;
+    }
+    if (ymmEnabled && (ebx7 & (1 << 5)) != 0)
+    {
+        features |= CPU_FEATURE_AVX2;
+    }
+    return features;
+}
+
+static unsigned int getCpuFeatures()
+{
+    static const unsigned int features = detectCpuFeatures();
+    return features & g_simdMask;
+}
+
+// Intel's reference sequence, 4 rounds per sha1rnds4 with the message schedule interleaved
+DIGEST_TARGET_SHA static void sha1TransformShaNi(uint32_t* state, const unsigned char* data, size_t numberOfBlocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1B);
+    __m128i E0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    __m128i E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+
+    for (size_t blockIdx = 0; blockIdx < numberOfBlocks; ++blockIdx, data += 64)
+    {
+        __m128i ABCD_SAVE = ABCD;
+        __m128i E0_SAVE = E0;
+
+        // Rounds 0-3
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0)), MASK);
+        E0 = _mm_add_epi32(E0, MSG0);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+        // Rounds 4-7
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+        // Rounds 8-11
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32)), MASK);
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 12-15
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 16-19
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 20-23
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 24-27
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 28-31
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 32-35
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 36-39
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 40-43
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 44-47
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 48-51
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 52-55
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 56-59
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 60-63
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 64-67
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 68-71
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 72-75
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+        // Rounds 76-79
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), ABCD);
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(E0, 3));
+}
+#endif // DIGEST_SHA_NI
+
+static void sha1TransformScalar(uint32_t* state, const unsigned char* blocks, size_t numberOfBlocks)
+{
+    uint32_t w[80];
+    for (size_t blockIdx = 0; blockIdx < numberOfBlocks; ++blockIdx, blocks += 64)
+    {
+        for (int idx = 0; idx < 16; ++idx)
+        {
+            w[idx] = readBigEndian32(blocks + idx * 4);
+        }
+        for (int idx = 16; idx < 80; ++idx)
+        {
+            w[idx] = rotateLeft(w[idx - 3] ^ w[idx - 8] ^ w[idx - 14] ^ w[idx - 16], 1);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+
+#define SHA1_ROUND(f, k) \
+        { \
+            uint32_t temp = rotateLeft(a, 5) + (f) + e + (k) + w[idx]; \
+            e = d; \
+            d = c; \
+            c = rotateLeft(b, 30); \
+            b = a; \
+            a = temp; \
+        }
+
+        int idx = 0;
+        for (; idx < 20; ++idx)
+        {
+            SHA1_ROUND(d ^ (b & (c ^ d)), 0x5a827999)
+        }
+        for (; idx < 40; ++idx)
+        {
+            SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1)
+        }
+        for (; idx < 60; ++idx)
+        {
+            SHA1_ROUND((b & c) | (d & (b | c)), 0x8f1bbcdc)
+        }
+        for (; idx < 80; ++idx)
+        {
+            SHA1_ROUND(b ^ c ^ d, 0xca62c1d6)
+        }
+#undef SHA1_ROUND
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+Sha1Digest::Sha1Digest()
+{
+    reset();
+}
+
+void Sha1Digest::reset()
+{
+    m_state[0] = 0x67452301;
+    m_state[1] = 0xefcdab89;
+    m_state[2] = 0x98badcfe;
+    m_state[3] = 0x10325476;
+    m_state[4] = 0xc3d2e1f0;
+    m_length = 0;
+    m_bufferLength = 0;
+}
+
+void Sha1Digest::update(const void* data, size_t length)
+{
+    updateBlocks(m_state, m_buffer, m_bufferLength, m_length, data, length, &Sha1Digest::transform);
+}
+
+void Sha1Digest::finish(unsigned char* digest)
+{
+    uint64_t bits = m_length * 8;
+    unsigned char padding[72] = {0x80};
+    size_t paddingLength = (m_bufferLength < 56) ? (56 - m_bufferLength) : (120 - m_bufferLength);
+    writeBigEndian32(padding + paddingLength, static_cast<uint32_t>(bits >> 32));
+    writeBigEndian32(padding + paddingLength + 4, static_cast<uint32_t>(bits));
+    update(padding, paddingLength + 8);
+
+    for (int idx = 0; idx < 5; ++idx)
+    {
+        writeBigEndian32(digest + idx * 4, m_state[idx]);
+    }
+}
+
+unsigned int getDigestSimd()
+{
+#ifdef DIGEST_SHA_NI
+    return getCpuFeatures();
+#else
+    return 0;
+#endif
+}
+
+void setDigestSimdMask(unsigned int mask)
+{
+#ifdef DIGEST_SHA_NI
+    g_simdMask = mask;
+#else
+    (void)mask;
+#endif
+}
+
+bool Sha1Digest::isAccelerated()
+{
+#ifdef DIGEST_SHA_NI
+    return (getCpuFeatures() & CPU_FEATURE_SHA) != 0;
+#else
+    return false;
+#endif
+}
+
+void Sha1Digest::transform(uint32_t* state, const unsigned char* blocks, size_t numberOfBlocks)
+{
+#ifdef DIGEST_SHA_NI
+    if (isAccelerated())
+    {
+        sha1TransformShaNi(state, blocks, numberOfBlocks);
+        return;
+    }
+#endif
+    sha1TransformScalar(state, blocks, numberOfBlocks);
+}
+
+// The final 1 or 2 blocks: the bytes after the last whole block, 0x80, zeros and the length in bits
+static size_t sha1PadTail(const unsigned char* data, size_t length, unsigned char* tail)
+{
+    size_t remaining = length & 63;
+    size_t numberOfBlocks = remaining < 56 ? 1 : 2;
+    memset(tail, 0, numberOfBlocks * 64);
+    if (remaining > 0)
+    {
+        memcpy(tail, data + length - remaining, remaining);
+    }
+    tail[remaining] = 0x80;
+    uint64_t bits = static_cast<uint64_t>(length) * 8;
+    writeBigEndian32(tail + numberOfBlocks * 64 - 8, static_cast<uint32_t>(bits >> 32));
+    writeBigEndian32(tail + numberOfBlocks * 64 - 4, static_cast<uint32_t>(bits));
+    return numberOfBlocks;
+}
+
+static const uint32_t SHA1_INITIAL_STATE[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+#ifdef DIGEST_SHA_NI
+
+#define SHA1_LANES  8
+
+DIGEST_TARGET_AVX2 static inline __m256i rotateLeft(__m256i value, int bits)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(value, bits), _mm256_srli_epi32(value, 32 - bits));
+}
+
+// One block of each of the 8 lanes, the state is transposed: state[word][lane]
+DIGEST_TARGET_AVX2 static void sha1TransformAvx2(uint32_t (*state)[SHA1_LANES], const unsigned char* const* blocks)
+{
+    const __m256i BSWAP = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                          12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i w[16];
+    uint32_t words[SHA1_LANES];
+    for (int idx = 0; idx < 16; ++idx)
+    {
+        for (int lane = 0; lane < SHA1_LANES; ++lane)
+        {
+            memcpy(&words[lane], blocks[lane] + idx * 4, 4);
+        }
+        w[idx] = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(words)), BSWAP);
+    }
+
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state[0]));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state[1]));
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state[2]));
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state[3]));
+    __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state[4]));
+    const __m256i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+    for (int idx = 0; idx < 80; ++idx)
+    {
+        if (idx >= 16)
+        {
+            w[idx & 15] = rotateLeft(_mm256_xor_si256(_mm256_xor_si256(w[(idx - 3) & 15], w[(idx - 8) & 15]), _mm256_xor_si256(w[(idx - 14) & 15], w[idx & 15])), 1);
+        }
+        __m256i f;
+        __m256i k;
+        if (idx < 20)
+        {
+            f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+            k = _mm256_set1_epi32(0x5a827999);
+        }
+        else if (idx < 40)
+        {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(0x6ed9eba1);
+        }
+        else if (idx < 60)
+        {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            k = _mm256_set1_epi32(static_cast<int>(0x8f1bbcdc));
+        }
+        else
+        {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(static_cast<int>(0xca62c1d6));
+        }
+        __m256i temp = _mm256_add_epi32(_mm256_add_epi32(rotateLeft(a, 5), f), _mm256_add_epi32(_mm256_add_epi32(e, k), w[idx & 15]));
+        e = d;
+        d = c;
+        c = rotateLeft(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state[0]), _mm256_add_epi32(a, a0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state[1]), _mm256_add_epi32(b, b0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state[2]), _mm256_add_epi32(c, c0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state[3]), _mm256_add_epi32(d, d0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state[4]), _mm256_add_epi32(e, e0));
+}
+
+struct Sha1Lane
+{
+    size_t message;
+    const unsigned char* data;
+    size_t numberOfWholeBlocks;
+    size_t numberOfBlocks;
+    size_t blockIndex;
+    unsigned char tail[128];
+};
+
+// Each lane takes the next message once its current one is done, so messages of different lengths keep all the lanes busy
+// Idle lanes at the end hash a dummy block
+static void sha1BatchAvx2(const unsigned char* const* messages, const size_t* lengths, size_t count, unsigned char* digests)
+{
+    static const unsigned char DUMMY_BLOCK[64] = {0};
+    uint32_t state[5][SHA1_LANES];
+    Sha1Lane lanes[SHA1_LANES];
+    bool busy[SHA1_LANES] = {false};
+    const unsigned char* blocks[SHA1_LANES];
+    size_t nextMessage = 0;
+
+    while (true)
+    {
+        int numberOfBusyLanes = 0;
+        for (int lane = 0; lane < SHA1_LANES; ++lane)
+        {
+            if (!busy[lane] && nextMessage < count)
+            {
+                Sha1Lane& sha1Lane = lanes[lane];
+                sha1Lane.message = nextMessage++;
+                sha1Lane.data = messages[sha1Lane.message];
+                sha1Lane.numberOfWholeBlocks = lengths[sha1Lane.message] / 64;
+                sha1Lane.numberOfBlocks = sha1Lane.numberOfWholeBlocks + sha1PadTail(sha1Lane.data, lengths[sha1Lane.message], sha1Lane.tail);
+                sha1Lane.blockIndex = 0;
+                for (int word = 0; word < 5; ++word)
+                {
+                    state[word][lane] = SHA1_INITIAL_STATE[word];
+                }
+                busy[lane] = true;
+            }
+            if (busy[lane])
+            {
+                const Sha1Lane& sha1Lane = lanes[lane];
+                blocks[lane] = sha1Lane.blockIndex < sha1Lane.numberOfWholeBlocks ? (sha1Lane.data + sha1Lane.blockIndex * 64) : (sha1Lane.tail + (sha1Lane.blockIndex - sha1Lane.numberOfWholeBlocks) * 64);
+                ++numberOfBusyLanes;
+            }
+            else
+            {
+                blocks[lane] = DUMMY_BLOCK;
+            }
+        }
+        if (numberOfBusyLanes == 0)
+        {
+            break;
+        }
+
+        sha1TransformAvx2(state, blocks);
+
+        for (int lane = 0; lane < SHA1_LANES; ++lane)
+        {
+            if (busy[lane] && ++lanes[lane].blockIndex == lanes[lane].numberOfBlocks)
+            {
+                unsigned char* digest = digests + lanes[lane].message * Sha1Digest::DIGEST_LENGTH;
+                for (int word = 0; word < 5; ++word)
+                {
+                    writeBigEndian32(digest + word * 4, state[word][lane]);
+                }
+                busy[lane] = false;
+            }
+        }
+    }
+}
+#endif // DIGEST_SHA_NI
+
+void sha1Batch(const unsigned char* const* messages, const size_t* lengths, size_t count, unsigned char* digests)
+{
+#ifdef DIGEST_SHA_NI
+    // With a few messages most of the lanes would be idle
+    if ((getCpuFeatures() & (CPU_FEATURE_SHA | CPU_FEATURE_AVX2)) == CPU_FEATURE_AVX2 && count >= SHA1_LANES / 2)
+    {
+        sha1BatchAvx2(messages, lengths, count, digests);
+        return;
+    }
+#endif
+
+    unsigned char tail[128];
+    uint32_t state[5];
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        memcpy(state, SHA1_INITIAL_STATE, sizeof(state));
+        size_t numberOfWholeBlocks = lengths[idx] / 64;
+        size_t numberOfTailBlocks = sha1PadTail(messages[idx], lengths[idx], tail);
+        if (numberOfWholeBlocks > 0)
+        {
+            Sha1Digest::transform(state, messages[idx], numberOfWholeBlocks);
+        }
+        Sha1Digest::transform(state, tail, numberOfTailBlocks);
+        for (int word = 0; word < 5; ++word)
+        {
+            writeBigEndian32(digests + idx * Sha1Digest::DIGEST_LENGTH + word * 4, state[word]);
+        }
+    }
+}
+
+Sha1Batch::Sha1Batch()
+{
+    m_offsets.push_back(0);
+}
+
+void Sha1Batch::reserve(size_t numberOfMessages, size_t numberOfBytes)
+{
+    m_offsets.reserve(numberOfMessages + 1);
+    m_data.reserve(numberOfBytes);
+    m_digests.reserve(numberOfMessages * DIGEST_LENGTH);
+}
+
+void Sha1Batch::clear()
+{
+    m_data.clear();
+    m_offsets.resize(1);
+    m_digests.clear();
+}
+
+size_t Sha1Batch::add(const void* data, size_t length)
+{
+    m_offsets.push_back(m_offsets.back());
+    append(data, length);
+    return size() - 1;
+}
+
+void Sha1Batch::append(const void* data, size_t length)
+{
+    const unsigned char* ptr = reinterpret_cast<const unsigned char *>(data);
+    m_data.insert(m_data.end(), ptr, ptr + length);
+    m_offsets.back() += length;
+}
+
+void Sha1Batch::compute()
+{
+    size_t count = size();
+    m_digests.resize(count * DIGEST_LENGTH);
+    if (count == 0)
+    {
+        return;
+    }
+
+    std::vector<const unsigned char *> messages(count);
+    std::vector<size_t> lengths(count);
+    // m_data may be empty if all the messages are
+    const unsigned char* base = m_data.empty() ? NULL : &m_data[0];
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        messages[idx] = base + m_offsets[idx];
+        lengths[idx] = m_offsets[idx + 1] - m_offsets[idx];
+    }
+    sha1Batch(&messages[0], &lengths[0], count, &m_digests[0]);
+}
+
+void Sha1Batch::getHexDigest(size_t index, char* hex) const
+{
+    toHexString(getDigest(index), DIGEST_LENGTH, hex);
+}
+
+std::string Sha1Batch::getHexDigest(size_t index) const
+{
+    return toHexString(getDigest(index), DIGEST_LENGTH);
+}
+
+void toHexString(const unsigned char* data, size_t length, char* hex)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    for (size_t idx = 0; idx < length; ++idx)
+    {
+        hex[idx * 2] = HEX_DIGITS[data[idx] >> 4];
+        hex[idx * 2 + 1] = HEX_DIGITS[data[idx] & 0x0F];
+    }
+}
+
+std::string toHexString(const unsigned char* data, size_t length)
+{
+    std::string hex(length * 2, '0');
+    if (length > 0)
+    {
+        toHexString(data, length, &hex[0]);
+    }
+    return hex;
+}
+
+template<class TDigest>
+static bool digestFileImpl(const std::string& path, TDigest& digest)
+{
+    return readFile(path, DIGEST_CHUNK_SIZE, [&digest](const unsigned char* data, size_t length) {
+        digest.update(data, length);
+        return true;
+    });
+}
+
+bool digestFile(const std::string& path, Md5Digest& digest)
+{
+    return digestFileImpl(path, digest);
+}
+
+bool digestFile(const std::string& path, Sha1Digest& digest)
+{
+    return digestFileImpl(path, digest);
+}
@@ -0,0 +1,137 @@
+//
+//  Digest.h
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef Digest_h
+#define Digest_h
+
+// Incremental MD5, the data can be fed in pieces of any size
+class Md5Digest
+{
+public:
+    static const size_t DIGEST_LENGTH = 16;
+
+    Md5Digest();
+
+    void reset();
+    void update(const void* data, size_t length);
+    // The digest is DIGEST_LENGTH bytes, call reset() before reusing the object
+    void finish(unsigned char* digest);
+
+protected:
+    static void transform(uint32_t* state, const unsigned char* blocks, size_t numberOfBlocks);
+
+protected:
+    uint32_t m_state[4];
+    uint64_t m_length;
+    unsigned char m_buffer[64];
+    size_t m_bufferLength;
+};
+
+// Incremental SHA-1
+// The compression uses the SHA extensions (SHA-NI) when the CPU supports them
+class Sha1Digest
+{
+public:
+    static const size_t DIGEST_LENGTH = 20;
+
+    Sha1Digest();
+
+    void reset();
+    void update(const void* data, size_t length);
+    void finish(unsigned char* digest);
+
+    static bool isAccelerated();
+
+protected:
+    friend void sha1Batch(const unsigned char* const* messages, const size_t* lengths, size_t count, unsigned char* digests);
+    static void transform(uint32_t* state, const unsigned char* blocks, size_t numberOfBlocks);
+
+protected:
+    uint32_t m_state[5];
+    uint64_t m_length;
+    unsigned char m_buffer[64];
+    size_t m_bufferLength;
+};
+
+// SHA-1 of many short messages, e.g. the fileIds (SHA-1 of "domain-path") of Manifest.mbdb
+// The messages are packed into one buffer and hashed together by compute(), eight at a time with AVX2
+// when the CPU has it (SHA-NI is used per message instead as it is faster on the CPUs supporting it).
+// The raw digests are kept in a table of DIGEST_LENGTH bytes per message, hex formatting is left to the caller
+class Sha1Batch
+{
+public:
+    static const size_t DIGEST_LENGTH = Sha1Digest::DIGEST_LENGTH;
+
+    Sha1Batch();
+
+    void reserve(size_t numberOfMessages, size_t numberOfBytes);
+    void clear();
+
+    // Start a new message, append() extends it, so "domain-path" is hashed without building a temporary string
+    size_t add(const void* data, size_t length);
+    void append(const void* data, size_t length);
+
+    // Hash all the messages which were added since the last clear()
+    void compute();
+
+    size_t size() const
+    {
+        return m_offsets.size() - 1;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // Valid after compute()
+    const unsigned char* getDigest(size_t index) const
+    {
+        return &m_digests[index * DIGEST_LENGTH];
+    }
+
+    // Write DIGEST_LENGTH * 2 hex chars, no null terminator
+    void getHexDigest(size_t index, char* hex) const;
+    std::string getHexDigest(size_t index) const;
+
+protected:
+    std::vector<unsigned char> m_data;
+    std::vector<size_t> m_offsets;      // Message i is [m_offsets[i], m_offsets[i + 1]) of m_data
+    std::vector<unsigned char> m_digests;
+};
+
+// Hash count messages and write DIGEST_LENGTH bytes per message to digests
+void sha1Batch(const unsigned char* const* messages, const size_t* lengths, size_t count, unsigned char* digests);
+
+// SIMD extensions of the digests, used when the CPU has them
+enum DigestSimd
+{
+    DIGEST_SIMD_SHA = 1,
+    DIGEST_SIMD_AVX2 = 2,
+    DIGEST_SIMD_ALL = DIGEST_SIMD_SHA | DIGEST_SIMD_AVX2,
+};
+
+// The extensions in use: supported by the CPU and not masked by setDigestSimdMask
+unsigned int getDigestSimd();
+// Keep the extensions of mask only, e.g. DIGEST_SIMD_AVX2 runs sha1Batch on the AVX2 lanes of a CPU with SHA-NI.
+// Meant for the tests and the benchmarks, it isn't synchronized with the hashing threads
+void setDigestSimdMask(unsigned int mask);
+
+std::string toHexString(const unsigned char* data, size_t length);
+void toHexString(const unsigned char* data, size_t length, char* hex);
+
+// Hash the file in fixed-size chunks
+bool digestFile(const std::string& path, Md5Digest& digest);
+bool digestFile(const std::string& path, Sha1Digest& digest);
+
+#endif /* Digest_h */
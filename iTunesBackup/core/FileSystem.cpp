@@ -13,6 +13,7 @@
 #endif
 // #include <iomanip>
 #include <fstream>
+#include <cstring>
 
 #ifdef _WIN32
 #include <algorithm>
@@ -25,12 +26,25 @@
 #ifdef __APPLE__
 // https://developer.apple.com/library/archive/documentation/System/Conceptual/ManPages_iPhoneOS/man3/copyfile.3.html
 #include <copyfile.h>
+#include <sys/clonefile.h>
 #endif
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fts.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <algorithm>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif // __linux__
 #endif //  _WIN32
 
 size_t getFileSize(const std::string& path)
@@ -59,6 +73,33 @@ size_t getFileSize(const std::string& path)
 #endif
 }
 
+bool getFileStat(const std::string& path, uint64_t& size, int64_t& modifiedTime)
+{
+#ifdef _WIN32
+    CW2T pszT(CA2W(path.c_str(), CP_UTF8));
+    WIN32_FILE_ATTRIBUTE_DATA fileData;
+    if (!::GetFileAttributesEx((LPCTSTR)pszT, GetFileExInfoStandard, &fileData))
+    {
+        return false;
+    }
+    
+    size = ((uint64_t)fileData.nFileSizeHigh << 32) | fileData.nFileSizeLow;
+    // FILETIME: 100-nanosecond intervals since 1601-01-01
+    uint64_t fileTime = ((uint64_t)fileData.ftLastWriteTime.dwHighDateTime << 32) | fileData.ftLastWriteTime.dwLowDateTime;
+    modifiedTime = (int64_t)(fileTime / 10000000ULL) - 11644473600LL;
+    return true;
+#else
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0)
+    {
+        return false;
+    }
+    size = (uint64_t)sb.st_size;
+    modifiedTime = (int64_t)sb.st_mtime;
+    return true;
+#endif
+}
+
 bool existsDirectory(const std::string& path)
 {
 #ifdef _WIN32
@@ -310,8 +351,203 @@ bool listSubDirectories(const std::string& path, std::vector<std::string>& subDi
     return true;
 }
 
+#ifdef __linux__
+// Return 1 if copied, 0 if the method is not supported (nothing copied), -1 on error or if the source ended before size
+static int copyFileRange(int srcFd, int destFd, off_t size)
+{
+    off_t offset = 0;
+    while (offset < size)
+    {
+        ssize_t bytes = copy_file_range(srcFd, NULL, destFd, NULL, static_cast<size_t>(size - offset), 0);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (offset == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) ? 0 : -1;
+        }
+        if (bytes == 0)
+        {
+            // Some filesystems (e.g. FUSE) copy nothing instead of failing, the source may also have shrunk
+            if (offset == 0)
+            {
+                return 0;
+            }
+            break;
+        }
+        offset += bytes;
+    }
+    return offset == size ? 1 : -1;
+}
+
+static int sendFile(int srcFd, int destFd, off_t size)
+{
+    off_t offset = 0;
+    while (offset < size)
+    {
+        ssize_t bytes = sendfile(destFd, srcFd, &offset, static_cast<size_t>(size - offset));
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (offset == 0 && (errno == ENOSYS || errno == EINVAL)) ? 0 : -1;
+        }
+        if (bytes == 0)
+        {
+            if (offset == 0)
+            {
+                return 0;
+            }
+            break;
+        }
+    }
+    return offset == size ? 1 : -1;
+}
+
+static bool readWriteFile(int srcFd, int destFd, off_t size)
+{
+    const size_t bufferSize = 1024 * 1024;
+    std::vector<char> buffer(static_cast<size_t>(std::min(static_cast<off_t>(bufferSize), std::max(size, static_cast<off_t>(4096)))));
+    while (true)
+    {
+        ssize_t bytesRead = read(srcFd, &buffer[0], buffer.size());
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if (bytesRead == 0)
+        {
+            break;
+        }
+        
+        const char *ptr = &buffer[0];
+        while (bytesRead > 0)
+        {
+            ssize_t bytesWritten = write(destFd, ptr, static_cast<size_t>(bytesRead));
+            if (bytesWritten < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            ptr += bytesWritten;
+            bytesRead -= bytesWritten;
+        }
+    }
+    return true;
+}
+
+// Reflink only, dest is removed if the filesystem can't clone
+static bool cloneFile(const std::string& src, const std::string& dest)
+{
+    int srcFd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (srcFd < 0)
+    {
+        return false;
+    }
+    int destFd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (destFd < 0)
+    {
+        close(srcFd);
+        return false;
+    }
+    bool result = ioctl(destFd, FICLONE, srcFd) == 0;
+    close(srcFd);
+    if (close(destFd) != 0)
+    {
+        result = false;
+    }
+    if (!result)
+    {
+        unlink(dest.c_str());
+    }
+    return result;
+}
+
+// Try the fastest method first: reflink, then copy in kernel and at last through user space
+static bool copyFileImpl(const std::string& src, const std::string& dest, CopyFileMethod* method)
+{
+    int srcFd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (srcFd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(srcFd, &st) != 0)
+    {
+        close(srcFd);
+        return false;
+    }
+    int destFd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (destFd < 0)
+    {
+        close(srcFd);
+        return false;
+    }
+    
+    bool result = false;
+    CopyFileMethod usedMethod = COPY_FILE_NONE;
+    int ret = 0;
+    if (ioctl(destFd, FICLONE, srcFd) == 0)
+    {
+        result = true;
+        usedMethod = COPY_FILE_CLONE;
+    }
+    else if (st.st_size == 0)
+    {
+        // procfs and the like report 0 bytes, only reading up to the end gets their content
+        result = readWriteFile(srcFd, destFd, st.st_size);
+        usedMethod = COPY_FILE_READ_WRITE;
+    }
+    else if ((ret = copyFileRange(srcFd, destFd, st.st_size)) != 0)
+    {
+        result = ret > 0;
+        usedMethod = COPY_FILE_RANGE;
+    }
+    else if ((ret = sendFile(srcFd, destFd, st.st_size)) != 0)
+    {
+        result = ret > 0;
+        usedMethod = COPY_FILE_SENDFILE;
+    }
+    else
+    {
+        result = readWriteFile(srcFd, destFd, st.st_size);
+        usedMethod = COPY_FILE_READ_WRITE;
+    }
+    
+    close(srcFd);
+    if (close(destFd) != 0)
+    {
+        result = false;
+    }
+    if (NULL != method)
+    {
+        *method = result ? usedMethod : COPY_FILE_NONE;
+    }
+    return result;
+}
+#endif // __linux__
+
 bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
 {
+    return copyFile(src, dest, overwrite, NULL);
+}
+
+bool copyFile(const std::string& src, const std::string& dest, bool overwrite, CopyFileMethod* method)
+{
+    if (NULL != method)
+    {
+        *method = COPY_FILE_NONE;
+    }
 #ifdef _WIN32
 	CW2T pszSrc(CA2W(src.c_str(), CP_UTF8));
 	CW2T pszDest(CA2W(dest.c_str(), CP_UTF8));
@@ -319,7 +555,16 @@ bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
 	BOOL bRet = FALSE;
 	if (::PathFileExists((LPCTSTR)pszSrc))
 	{
+		if (overwrite)
+		{
+			// dest may be a hard link to a file in the backup, replace it instead of writing through it
+			::DeleteFile((LPCTSTR)pszDest);
+		}
 		bRet = ::CopyFile((LPCTSTR)pszSrc, (LPCTSTR)pszDest, (overwrite ? FALSE : TRUE));
+		if (bRet == TRUE && NULL != method)
+		{
+			*method = COPY_FILE_SYSTEM;
+		}
 #ifndef NDEBUG
 		DWORD err = ::GetLastError();
 		TCHAR buffer[256] = { 0 };
@@ -335,6 +580,8 @@ bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
     {
         return false;
     }
+    // dest may be a hard link to a file in the backup, replace it instead of writing through it
+    unlink(dest.c_str());
     
     /* Initialize a state variable */
     copyfile_state_t s;
@@ -344,12 +591,27 @@ bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
     /* Release the state variable */
     copyfile_state_free(s);
 
+    if (ret == 0 && NULL != method)
+    {
+        *method = COPY_FILE_SYSTEM;
+    }
     return (ret == 0);
+#elif defined(__linux__)
+    if (existsFile(dest) && !overwrite)
+    {
+        return false;
+    }
+    // dest may be a hard link to a file in the backup, replace it instead of writing through it
+    unlink(dest.c_str());
+    
+    return copyFileImpl(src, dest, method);
 #else
     if (existsFile(dest) && !overwrite)
     {
         return false;
     }
+    // dest may be a hard link to a file in the backup, replace it instead of writing through it
+    std::remove(dest.c_str());
     
     std::ifstream ss(src, std::ios::in | std::ios::binary);
     if (!ss.is_open())
@@ -373,10 +635,120 @@ bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
     ss.close();
     ds.close();
     
+    if (NULL != method)
+    {
+        *method = COPY_FILE_READ_WRITE;
+    }
     return true;
 #endif
 }
 
+bool linkFile(const std::string& src, const std::string& dest, CopyFileMethod* method/* = NULL*/)
+{
+    if (NULL != method)
+    {
+        *method = COPY_FILE_NONE;
+    }
+#ifdef _WIN32
+    CW2T pszSrc(CA2W(src.c_str(), CP_UTF8));
+    CW2T pszDest(CA2W(dest.c_str(), CP_UTF8));
+    ::DeleteFile((LPCTSTR)pszDest);
+    if (::CreateHardLink((LPCTSTR)pszDest, (LPCTSTR)pszSrc, NULL))
+    {
+        if (NULL != method)
+        {
+            *method = COPY_FILE_HARD_LINK;
+        }
+        return true;
+    }
+#else
+    unlink(dest.c_str());
+#if defined(__APPLE__)
+    bool cloned = clonefile(src.c_str(), dest.c_str(), 0) == 0;
+#elif defined(__linux__)
+    bool cloned = cloneFile(src, dest);
+#else
+    bool cloned = false;
+#endif
+    if (cloned)
+    {
+        if (NULL != method)
+        {
+            *method = COPY_FILE_CLONE;
+        }
+        return true;
+    }
+    if (link(src.c_str(), dest.c_str()) == 0)
+    {
+        if (NULL != method)
+        {
+            *method = COPY_FILE_HARD_LINK;
+        }
+        return true;
+    }
+#endif
+    return copyFile(src, dest, true, method);
+}
+
+bool isSameFile(const std::string& path1, const std::string& path2)
+{
+#ifdef _WIN32
+    CW2T pszPath1(CA2W(path1.c_str(), CP_UTF8));
+    CW2T pszPath2(CA2W(path2.c_str(), CP_UTF8));
+    HANDLE hFile1 = ::CreateFile((LPCTSTR)pszPath1, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (hFile1 == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    HANDLE hFile2 = ::CreateFile((LPCTSTR)pszPath2, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (hFile2 == INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(hFile1);
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION info1;
+    BY_HANDLE_FILE_INFORMATION info2;
+    bool result = ::GetFileInformationByHandle(hFile1, &info1) && ::GetFileInformationByHandle(hFile2, &info2) &&
+        info1.dwVolumeSerialNumber == info2.dwVolumeSerialNumber && info1.nFileIndexHigh == info2.nFileIndexHigh && info1.nFileIndexLow == info2.nFileIndexLow;
+    ::CloseHandle(hFile1);
+    ::CloseHandle(hFile2);
+    return result;
+#else
+    struct stat sb1;
+    struct stat sb2;
+    return stat(path1.c_str(), &sb1) == 0 && stat(path2.c_str(), &sb2) == 0 && sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
+#endif
+}
+
+bool copyFileInChunks(const std::string& src, const std::string& dest, size_t chunkSize, const std::function<void(const unsigned char*, size_t)>& observer)
+{
+    if (!existsFile(src))
+    {
+        return false;
+    }
+
+    // dest may be a hard link to a file in the backup, replace it instead of writing through it
+    deleteFile(dest);
+#ifdef _WIN32
+    CA2W pszW(dest.c_str(), CP_UTF8);
+    std::ofstream ofs(pszW, std::ios::out | std::ios::binary | std::ios::trunc);
+#else
+    std::ofstream ofs(dest, std::ios::out | std::ios::binary | std::ios::trunc);
+#endif
+    if (!ofs.is_open())
+    {
+        return false;
+    }
+
+    bool result = readFile(src, chunkSize, [&ofs, &observer](const unsigned char* data, size_t length) {
+        observer(data, length);
+        ofs.write(reinterpret_cast<const char *>(data), length);
+        return ofs.good();
+    });
+    ofs.close();
+    return result && !ofs.fail();
+}
+
 bool moveFile(const std::string& src, const std::string& dest, bool overwrite/* = true*/)
 {
 #ifndef NDEBUG
@@ -602,6 +974,150 @@ bool readFile(const std::string& path, std::vector<unsigned char>& data)
     return false;
 }
 
+bool readFile(const std::string& path, size_t chunkSize, const std::function<bool(const unsigned char*, size_t)>& handler)
+{
+#ifdef _WIN32
+    CA2W pszW(path.c_str(), CP_UTF8);
+    std::ifstream ifs(pszW, std::ios::in | std::ios::binary);
+#else
+    std::ifstream ifs(path, std::ios::in | std::ios::binary);
+#endif
+
+    if (!ifs.is_open() || chunkSize == 0)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(chunkSize);
+    while (ifs)
+    {
+        ifs.read(reinterpret_cast<char *>(&buffer[0]), chunkSize);
+        std::streamsize bytesRead = ifs.gcount();
+        if (bytesRead > 0 && !handler(&buffer[0], static_cast<size_t>(bytesRead)))
+        {
+            return false;
+        }
+    }
+
+    return ifs.eof() && !ifs.bad();
+}
+
+MappedFile::MappedFile() : m_data(NULL), m_size(0)
+#ifdef _WIN32
+    , m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path, bool sequential/* = true*/)
+{
+    close();
+#ifdef _WIN32
+    CW2T pszT(CA2W(path.c_str(), CP_UTF8));
+    HANDLE hFile = CreateFile((LPCTSTR)pszT, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0), NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    m_file = hFile;
+    
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size))
+    {
+        close();
+        return false;
+    }
+    if (size.QuadPart == 0)
+    {
+        // Nothing to map for an empty file
+        return true;
+    }
+    
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == hMapping)
+    {
+        close();
+        return false;
+    }
+    m_mapping = hMapping;
+    
+    void *data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (NULL == data)
+    {
+        close();
+        return false;
+    }
+    m_data = reinterpret_cast<const unsigned char *>(data);
+    m_size = (size_t)size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    
+    struct stat sb;
+    if (fstat(fd, &sb) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    if (sb.st_size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+    
+    void *data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    if (sequential)
+    {
+        madvise(data, (size_t)sb.st_size, MADV_SEQUENTIAL);
+    }
+    m_data = reinterpret_cast<const unsigned char *>(data);
+    m_size = (size_t)sb.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (NULL != m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (NULL != m_mapping)
+    {
+        CloseHandle((HANDLE)m_mapping);
+        m_mapping = NULL;
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle((HANDLE)m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (NULL != m_data)
+    {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+#endif
+    m_data = NULL;
+    m_size = 0;
+}
+
 bool writeFile(const std::string& path, const std::vector<unsigned char>& data)
 {
     return writeFile(path, &(data[0]), data.size());
@@ -9,6 +9,8 @@
 #ifndef FileSystem_h
 #define FileSystem_h
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -23,13 +25,35 @@
 #endif
 
 size_t getFileSize(const std::string& path);
+// Size and last modified time (unix time) of the file
+bool getFileStat(const std::string& path, uint64_t& size, int64_t& modifiedTime);
 bool existsDirectory(const std::string& path);
 bool makeDirectory(const std::string& path);
 bool deleteFile(const std::string& path);
 bool deleteDirectory(const std::string& path);
 bool existsFile(const std::string& path);
 bool listSubDirectories(const std::string& path, std::vector<std::string>& subDirectories);
+enum CopyFileMethod
+{
+    COPY_FILE_NONE = 0,
+    COPY_FILE_SYSTEM,       // CopyFile on Windows, copyfile on MacOS
+    COPY_FILE_CLONE,        // ioctl(FICLONE): reflink on btrfs/XFS, clonefile on APFS
+    COPY_FILE_RANGE,        // copy_file_range: copy in kernel (or server-side)
+    COPY_FILE_SENDFILE,     // sendfile: copy in kernel
+    COPY_FILE_READ_WRITE,   // read/write through user space
+    COPY_FILE_HARD_LINK,    // link/CreateHardLink: dest shares the data and the attributes (e.g. the modified time) with src
+};
+
 bool copyFile(const std::string& src, const std::string& dest, bool overwrite = true);
+bool copyFile(const std::string& src, const std::string& dest, bool overwrite, CopyFileMethod* method);
+// Make dest refer to the data of src instead of copying it, dest is replaced
+// A clone (reflink on btrfs/XFS, clonefile on APFS) is tried first as it has its own attributes, then a hard link,
+// and at last copyFile, e.g. when src and dest are on different volumes
+bool linkFile(const std::string& src, const std::string& dest, CopyFileMethod* method = NULL);
+// Both paths refer to the same file (device and inode), e.g. one is a hard link of the other
+bool isSameFile(const std::string& path1, const std::string& path2);
+// Copy through user space (dest is overwritten) and pass every chunk to the observer, e.g. to hash the data while it is copied
+bool copyFileInChunks(const std::string& src, const std::string& dest, size_t chunkSize, const std::function<void(const unsigned char*, size_t)>& observer);
 bool moveFile(const std::string& src, const std::string& dest, bool overwrite = true);
 // ref: https://blackbeltreview.wordpress.com/2015/01/27/illegal-filename-characters-on-windows-vs-mac-os/
 bool isValidFileName(const std::string& fileName);
@@ -37,12 +61,48 @@ std::string removeInvalidCharsForFileName(const std::string& fileName);
 
 std::string readFile(const std::string& path);
 bool readFile(const std::string& path, std::vector<unsigned char>& data);
+// Read the file sequentially in chunks of chunkSize bytes, memory use doesn't depend on the file size
+// The handler returns false to stop reading, which fails the call
+bool readFile(const std::string& path, size_t chunkSize, const std::function<bool(const unsigned char*, size_t)>& handler);
 bool writeFile(const std::string& path, const std::vector<unsigned char>& data);
 bool writeFile(const std::string& path, const std::string& data);
 bool writeFile(const std::string& path, const unsigned char* data, size_t dataLength);
 bool appendFile(const std::string& path, const std::string& data);
 bool appendFile(const std::string& path, const unsigned char* data, size_t dataLength);
 
+// Read-only mapping of a whole file, the data stays valid until close() or destruction
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    // sequential: hint the OS to read ahead as the data will be scanned once from the beginning
+    bool open(const std::string& path, bool sequential = true);
+    void close();
+    
+    const unsigned char* getData() const
+    {
+        return m_data;
+    }
+    
+    size_t getSize() const
+    {
+        return m_size;
+    }
+    
+private:
+    const unsigned char* m_data;
+    size_t m_size;
+#ifdef _WIN32
+    void* m_file;
+    void* m_mapping;
+#endif
+};
+
 
 
 std::string combinePath(const std::string& p1, const std::string& p2);
@@ -8,11 +8,18 @@
 
 #include "ITunesParser.h"
 #include <stdio.h>
+#include <cstring>
 #include <map>
 #include <set>
+#include <unordered_set>
 #include <sys/types.h>
 #include <sqlite3.h>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 #include <plist/plist.h>
 
 #ifndef NDEBUG
@@ -29,6 +36,9 @@
 #endif
 
 #include "MbdbReader.h"
+#include "Digest.h"
+#include "ManifestCache.h"
+#include "PlistScanner.h"
 #include "Utils.h"
 #include "FileSystem.h"
 
@@ -74,15 +84,444 @@ struct __string_less
 {
     // _LIBCPP_INLINE_VISIBILITY _LIBCPP_CONSTEXPR_AFTER_CXX11
     bool operator()(const std::string& __x, const std::string& __y) const {return __x < __y;}
+    bool operator()(const std::string& __x, const char* __y) const {return __x.compare(__y) < 0;}
     bool operator()(const std::pair<std::string, std::string>& __x, const std::string& __y) const {return __x.first < __y;}
-    bool operator()(const ITunesFile* __x, const std::string& __y) const {return __x->relativePath < __y;}
-    bool operator()(const ITunesFile* __x, const ITunesFile* __y) const {return __x->relativePath < __y->relativePath;}
+    bool operator()(const ITunesFile* __x, const std::string& __y) const {return __y.compare(__x->relativePath) > 0;}
+    bool operator()(const ITunesFile* __x, const ITunesFile* __y) const {return std::strcmp(__x->relativePath, __y->relativePath) < 0;}
 };
 
+// Compare the domains with the strings of the mapped Manifest.mbdb without copying them
+struct __mbdb_string_less
+{
+    bool operator()(const std::string& __x, const MbdbString& __y) const { return __x.compare(0, __x.size(), __y.data, __y.length) < 0; }
+    bool operator()(const MbdbString& __x, const std::string& __y) const { return __y.compare(0, __y.size(), __x.data, __x.length) > 0; }
+};
+
+// Reader of the NSKeyedArchiver bplist in the column 'file' of Manifest.db
+// It reads the integers of the MBFile dictionary ($objects[1]) in place, without building the plist tree or allocating
+class MBFileReader
+{
+public:
+    struct FileInfo
+    {
+        uint64_t lastModified;
+        uint64_t size;
+        uint64_t mode;
+        uint64_t birth;
+        uint64_t flags;
+        // Points into the blob
+        const unsigned char* digest;
+        size_t digestLength;
+    };
+    
+    MBFileReader(const unsigned char* data, size_t length) : m_data(data), m_length(length), m_offsetTableOffset(0), m_numberOfObjects(0), m_topObject(0), m_offsetSize(0), m_refSize(0)
+    {
+    }
+    
+    bool read(FileInfo& info)
+    {
+        std::memset(&info, 0, sizeof(FileInfo));
+        
+        // Header: bplist00, Trailer: 6 unused bytes, offsetSize, refSize, numberOfObjects, topObject, offsetTableOffset
+        if (NULL == m_data || m_length < 40 || std::memcmp(m_data, "bplist00", 8) != 0)
+        {
+            return false;
+        }
+        const unsigned char *trailer = m_data + m_length - 32;
+        m_offsetSize = trailer[6];
+        m_refSize = trailer[7];
+        m_numberOfObjects = readBigEndian(trailer + 8, 8);
+        m_topObject = readBigEndian(trailer + 16, 8);
+        m_offsetTableOffset = readBigEndian(trailer + 24, 8);
+        if (m_offsetSize == 0 || m_offsetSize > 8 || m_refSize == 0 || m_refSize > 8 || m_offsetTableOffset >= m_length ||
+            m_numberOfObjects > (m_length - m_offsetTableOffset) / m_offsetSize)
+        {
+            return false;
+        }
+        
+        uint64_t ref = 0;
+        size_t topOffset = 0;
+        size_t objectsOffset = 0;
+        size_t fileOffset = 0;
+        if (!getObjectOffset(m_topObject, topOffset) || !findValue(topOffset, "$objects", ref) || !getObjectOffset(ref, objectsOffset) ||
+            !getArrayItem(objectsOffset, 1, ref) || !getObjectOffset(ref, fileOffset))
+        {
+            return false;
+        }
+        
+        // One pass over the dictionary
+        size_t count = 0;
+        size_t refsOffset = 0;
+        if (!readContainer(fileOffset, 0xD, count, refsOffset) || refsOffset + count * 2 * m_refSize > m_length)
+        {
+            return false;
+        }
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            const char *key = NULL;
+            size_t keyLength = 0;
+            if (!getString(readBigEndian(m_data + refsOffset + idx * m_refSize, m_refSize), key, keyLength))
+            {
+                continue;
+            }
+            uint64_t valueRef = readBigEndian(m_data + refsOffset + (count + idx) * m_refSize, m_refSize);
+            if (equals(key, keyLength, "Digest"))
+            {
+                getData(valueRef, objectsOffset, info.digest, info.digestLength);
+                continue;
+            }
+            uint64_t *value = NULL;
+            if (equals(key, keyLength, "LastModified")) value = &info.lastModified;
+            else if (equals(key, keyLength, "Size")) value = &info.size;
+            else if (equals(key, keyLength, "Mode")) value = &info.mode;
+            else if (equals(key, keyLength, "Birth")) value = &info.birth;
+            else if (equals(key, keyLength, "Flags")) value = &info.flags;
+            if (NULL != value)
+            {
+                size_t valueOffset = 0;
+                if (getObjectOffset(valueRef, valueOffset))
+                {
+                    readInteger(valueOffset, *value);
+                }
+            }
+        }
+        
+        return true;
+    }
+    
+private:
+    static uint64_t readBigEndian(const unsigned char* ptr, size_t bytes)
+    {
+        uint64_t value = 0;
+        for (size_t idx = 0; idx < bytes; ++idx)
+        {
+            value = (value << 8) | ptr[idx];
+        }
+        return value;
+    }
+    
+    static bool equals(const char* str, size_t length, const char* key)
+    {
+        return std::strlen(key) == length && std::memcmp(str, key, length) == 0;
+    }
+    
+    bool getObjectOffset(uint64_t ref, size_t& offset) const
+    {
+        if (ref >= m_numberOfObjects)
+        {
+            return false;
+        }
+        uint64_t value = readBigEndian(m_data + m_offsetTableOffset + ref * m_offsetSize, m_offsetSize);
+        if (value < 8 || value >= m_offsetTableOffset)
+        {
+            return false;
+        }
+        offset = static_cast<size_t>(value);
+        return true;
+    }
+    
+    bool readInteger(size_t offset, uint64_t& value) const
+    {
+        unsigned char marker = m_data[offset];
+        if ((marker & 0xF0) != 0x10)
+        {
+            return false;
+        }
+        // 16-byte integers keep the value in the low 8 bytes
+        size_t bytes = static_cast<size_t>(1) << (marker & 0x0F);
+        if (bytes > 16 || offset + 1 + bytes > m_offsetTableOffset)
+        {
+            return false;
+        }
+        value = bytes > 8 ? readBigEndian(m_data + offset + 1 + bytes - 8, 8) : readBigEndian(m_data + offset + 1, bytes);
+        return true;
+    }
+    
+    // Marker of objects with length: low nibble is the length or 0xF followed by an integer
+    bool readContainer(size_t offset, unsigned char type, size_t& count, size_t& dataOffset) const
+    {
+        unsigned char marker = m_data[offset];
+        if ((marker >> 4) != type)
+        {
+            return false;
+        }
+        count = marker & 0x0F;
+        dataOffset = offset + 1;
+        if (count == 0x0F)
+        {
+            uint64_t value = 0;
+            if (offset + 1 >= m_offsetTableOffset || !readInteger(offset + 1, value))
+            {
+                return false;
+            }
+            count = static_cast<size_t>(value);
+            dataOffset = offset + 2 + (static_cast<size_t>(1) << (m_data[offset + 1] & 0x0F));
+        }
+        return dataOffset <= m_offsetTableOffset && count <= m_length;
+    }
+    
+    bool getString(uint64_t ref, const char*& str, size_t& length) const
+    {
+        size_t offset = 0;
+        if (!getObjectOffset(ref, offset) || !readContainer(offset, 0x5, length, offset) || offset + length > m_offsetTableOffset)
+        {
+            return false;
+        }
+        str = reinterpret_cast<const char *>(m_data + offset);
+        return true;
+    }
+    
+    // The data is inline, or referred by a UID to $objects where it is NSData or NSMutableData ({NS.data: data})
+    bool getData(uint64_t ref, size_t objectsOffset, const unsigned char*& data, size_t& length) const
+    {
+        size_t offset = 0;
+        if (!getObjectOffset(ref, offset))
+        {
+            return false;
+        }
+        if ((m_data[offset] >> 4) == 0x8)
+        {
+            size_t uidLength = (m_data[offset] & 0x0F) + 1;
+            if (uidLength > 8 || offset + 1 + uidLength > m_offsetTableOffset || !getArrayItem(objectsOffset, static_cast<size_t>(readBigEndian(m_data + offset + 1, uidLength)), ref) ||
+                !getObjectOffset(ref, offset))
+            {
+                return false;
+            }
+        }
+        if ((m_data[offset] >> 4) == 0xD)
+        {
+            if (!findValue(offset, "NS.data", ref) || !getObjectOffset(ref, offset))
+            {
+                return false;
+            }
+        }
+        size_t dataOffset = 0;
+        if (!readContainer(offset, 0x4, length, dataOffset) || dataOffset + length > m_offsetTableOffset)
+        {
+            return false;
+        }
+        data = m_data + dataOffset;
+        return true;
+    }
+    
+    bool findValue(size_t dictOffset, const char* key, uint64_t& valueRef) const
+    {
+        size_t count = 0;
+        size_t refsOffset = 0;
+        if (!readContainer(dictOffset, 0xD, count, refsOffset) || refsOffset + count * 2 * m_refSize > m_length)
+        {
+            return false;
+        }
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            const char *str = NULL;
+            size_t length = 0;
+            if (getString(readBigEndian(m_data + refsOffset + idx * m_refSize, m_refSize), str, length) && equals(str, length, key))
+            {
+                valueRef = readBigEndian(m_data + refsOffset + (count + idx) * m_refSize, m_refSize);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool getArrayItem(size_t arrayOffset, size_t index, uint64_t& ref) const
+    {
+        size_t count = 0;
+        size_t refsOffset = 0;
+        if (!readContainer(arrayOffset, 0xA, count, refsOffset) || index >= count || refsOffset + count * m_refSize > m_length)
+        {
+            return false;
+        }
+        ref = readBigEndian(m_data + refsOffset + index * m_refSize, m_refSize);
+        return true;
+    }
+    
+private:
+    const unsigned char*    m_data;
+    size_t                  m_length;
+    uint64_t                m_offsetTableOffset;
+    uint64_t                m_numberOfObjects;
+    uint64_t                m_topObject;
+    size_t                  m_offsetSize;
+    size_t                  m_refSize;
+};
+
+// Blocking queue with a fixed capacity, the producer waits while it is full so memory stays flat
+template<class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false)
+    {
+    }
+    
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+        if (m_closed)
+        {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+        return true;
+    }
+    
+    // Return false when the queue is closed and drained
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+        {
+            return false;
+        }
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+    
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+    
+private:
+    std::deque<T> m_items;
+    size_t m_capacity;
+    bool m_closed;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
+
+#define PROGRESS_INTERVAL 256
+
+// Copy threads of ITunesDb::copy/copyMbdb, the producer adds the files while it reads the manifest
+class CopyStage
+{
+public:
+    typedef std::function<bool(const std::string&, const std::string&)> Copier;
+    
+    // jobs: 0 for one thread per core
+    CopyStage(unsigned int jobs, const Copier& copier, const ITunesDb::ProgressHandler& progressHandler) : m_jobs(getNumberOfJobs(jobs)), m_queue(m_jobs * 64), m_copier(copier), m_progressHandler(progressHandler), m_numberOfFiles(0), m_numberOfProcessedFiles(0), m_numberOfCopiedFiles(0), m_numberOfFailedFiles(0)
+    {
+        m_threads.reserve(m_jobs);
+        for (unsigned int idx = 0; idx < m_jobs; ++idx)
+        {
+            m_threads.emplace_back(&CopyStage::run, this);
+        }
+    }
+    
+    ~CopyStage()
+    {
+        finish();
+    }
+    
+    void add(std::string&& src, std::string&& dest)
+    {
+        ++m_numberOfFiles;
+        m_queue.push(std::make_pair(std::move(src), std::move(dest)));
+    }
+    
+    // Wait for the queued copies, returns the number of failures
+    size_t finish()
+    {
+        m_queue.close();
+        for (std::vector<std::thread>::iterator it = m_threads.begin(); it != m_threads.end(); ++it)
+        {
+            it->join();
+        }
+        if (!m_threads.empty() && m_progressHandler)
+        {
+            m_progressHandler(m_numberOfCopiedFiles + m_numberOfFailedFiles, m_numberOfFiles, true);
+        }
+        m_threads.clear();
+        return m_numberOfFailedFiles;
+    }
+    
+    size_t getNumberOfCopiedFiles() const
+    {
+        return m_numberOfCopiedFiles;
+    }
+    
+private:
+    static unsigned int getNumberOfJobs(unsigned int jobs)
+    {
+        return std::max(1u, 0 == jobs ? std::thread::hardware_concurrency() : jobs);
+    }
+    
+    void run()
+    {
+        std::pair<std::string, std::string> job;
+        while (m_queue.pop(job))
+        {
+            if (m_copier(job.first, job.second))
+            {
+                ++m_numberOfCopiedFiles;
+            }
+            else
+            {
+                ++m_numberOfFailedFiles;
+            }
+            size_t numberOfProcessedFiles = ++m_numberOfProcessedFiles;
+            if (m_progressHandler && numberOfProcessedFiles % PROGRESS_INTERVAL == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_progressMutex);
+                m_progressHandler(numberOfProcessedFiles, m_numberOfFiles, false);
+            }
+        }
+    }
+    
+private:
+    unsigned int m_jobs;
+    BoundedQueue<std::pair<std::string, std::string>> m_queue;
+    Copier m_copier;
+    ITunesDb::ProgressHandler m_progressHandler;
+    std::mutex m_progressMutex;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_numberOfFiles;
+    std::atomic<size_t> m_numberOfProcessedFiles;
+    std::atomic<size_t> m_numberOfCopiedFiles;
+    std::atomic<size_t> m_numberOfFailedFiles;
+};
+
+// Restrict the reader to the records of the domains with the sidecar index, which is built with a full scan if it is missing or stale
+static bool useMbdbIndex(MbdbReader& reader, const std::string& indexPath, const std::vector<std::string>& domains)
+{
+    if (indexPath.empty() || domains.empty())
+    {
+        return false;
+    }
+    
+    MbdbIndex index;
+    if (!index.load(indexPath, reader))
+    {
+        if (!index.build(reader))
+        {
+            reader.seek(6);
+            return false;
+        }
+        // Failing to save it (e.g. read-only location) only costs a full scan next time
+        index.save(indexPath);
+    }
+    
+    std::vector<uint32_t> offsets;
+    index.getOffsets(domains, offsets);
+    reader.setOffsets(offsets);
+    return true;
+}
+
 class SqliteITunesFileEnumerator : public ITunesDb::ITunesFileEnumerator
 {
 public:
-    SqliteITunesFileEnumerator(const std::string& dbPath, const std::string& domain, bool onlyFile) : m_db(NULL), m_stmt(NULL), m_onlyFile(onlyFile)
+    SqliteITunesFileEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile) : m_db(NULL), m_stmt(NULL), m_domains(domains), m_bindingDomains(false), m_onlyFile(onlyFile)
     {
         int rc = openSqlite3Database(dbPath, &m_db);
         if (rc != SQLITE_OK)
@@ -95,11 +534,22 @@ public:
         sqlite3_exec(m_db, "PRAGMA mmap_size=2097152;", NULL, NULL, NULL); // 8M:8388608  2M 2097152
         sqlite3_exec(m_db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
         
-        std::string sql = "SELECT fileID,relativePath,flags,file FROM Files";
-        if (domain.size() > 0)
+        // SQLITE_MAX_VARIABLE_NUMBER is 999 on old versions of sqlite3, filter the domains with the code if there are more (as load does)
+        m_bindingDomains = !m_domains.empty() && m_domains.size() < 999;
+        if (!m_bindingDomains)
+        {
+            std::sort(m_domains.begin(), m_domains.end());
+        }
+        std::string sql = "SELECT fileID,relativePath,flags,file,domain FROM Files";
+        if (m_domains.size() == 1)
         {
             sql += " WHERE domain=?";
         }
+        else if (m_bindingDomains)
+        {
+            std::vector<std::string> placeHolders(m_domains.size(), "?");
+            sql += " WHERE domain IN (" + join(placeHolders, ",") + ")";
+        }
 
         rc = sqlite3_prepare_v2(m_db, sql.c_str(), (int)(sql.size()), &m_stmt, NULL);
         if (rc != SQLITE_OK)
@@ -109,9 +559,14 @@ public:
             return;
         }
         
-        if (domain.size() > 0)
+        if (!m_bindingDomains)
+        {
+            return;
+        }
+        int idx = 1;
+        for (std::vector<std::string>::const_iterator it = m_domains.cbegin(); it != m_domains.cend(); ++it, ++idx)
         {
-            rc = sqlite3_bind_text(m_stmt, 1, domain.c_str(), (int)(domain.size()), NULL);
+            rc = sqlite3_bind_text(m_stmt, idx, it->c_str(), (int)(it->size()), NULL);
             if (rc != SQLITE_OK)
             {
                 finalizeStmt();
@@ -123,11 +578,16 @@ public:
     
     virtual bool isInvalid() const
     {
-        return NULL != m_db && NULL != m_stmt;
+        return NULL == m_db || NULL == m_stmt;
     }
     
     virtual bool nextFile(ITunesFile& file)
     {
+        if (isInvalid())
+        {
+            return false;
+        }
+        
         while (sqlite3_step(m_stmt) == SQLITE_ROW)
         {
             int flags = sqlite3_column_int(m_stmt, 2);
@@ -138,37 +598,35 @@ public:
                 continue;
             }
             
+            // The columns stay valid until the next step, so the file refers to them directly
             const char *relativePath = reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, 1));
-            if (NULL != relativePath)
-            {
-                file.relativePath = relativePath;
-            }
-            else
-            {
-                file.relativePath.clear();
-            }
+            file.relativePath = (NULL != relativePath) ? relativePath : "";
             const char *fileId = reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, 0));
-            if (NULL != fileId)
-            {
-                file.fileId = fileId;
-            }
-            else
+            file.fileId = (NULL != fileId) ? fileId : "";
+            const char *domain = reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, 4));
+            file.domain = (NULL != domain) ? domain : "";
+            if (!m_bindingDomains && !m_domains.empty())
             {
-                file.fileId.clear();
+                std::vector<std::string>::const_iterator it = std::lower_bound(m_domains.cbegin(), m_domains.cend(), file.domain, __string_less());
+                if (it == m_domains.cend() || *it != file.domain)
+                {
+                    continue;
+                }
             }
 
             file.flags = static_cast<unsigned int>(flags);
             // Files
             const unsigned char *blob = reinterpret_cast<const unsigned char*>(sqlite3_column_blob(m_stmt, 3));
             int blobBytes = sqlite3_column_bytes(m_stmt, 3);
-            file.blob.clear();
-            if (blobBytes > 0 && NULL != blob)
-            {
-                std::vector<unsigned char> blobVector(blob, blob + blobBytes);
-                file.blob.insert(file.blob.end(), blob, blob + blobBytes);
-            }
-
-            break;
+            file.blob = (blobBytes > 0) ? blob : NULL;
+            file.blobLength = (blobBytes > 0 && NULL != blob) ? static_cast<unsigned int>(blobBytes) : 0;
+            file.modifiedTime = 0;
+            file.size = 0;
+            file.digest = NULL;
+            file.digestLength = 0;
+            file.blobParsed = false;
+
+            return true;
         }
 
         return false;
@@ -201,148 +659,146 @@ private:
 private:
     sqlite3*        m_db;
     sqlite3_stmt*   m_stmt;
+    // The bound parameters refer to the strings, sorted when the domains are filtered with the code
+    std::vector<std::string> m_domains;
+    bool m_bindingDomains;
     
     bool m_onlyFile;
 };
 
+// Number of fileIds (SHA-1 of "domain-path") hashed together
+#define MBDB_FILEID_BATCH_SIZE      4096
+#define MBDB_ENUMERATOR_BATCH_SIZE  256
+
 class MbdbITunesFileEnumerator : public ITunesDb::ITunesFileEnumerator
 {
 public:
-    MbdbITunesFileEnumerator(const std::string& dbPath, const std::string& domain, bool onlyFile) : m_valid(false), m_domain(domain), m_onlyFile(onlyFile)
+    MbdbITunesFileEnumerator(const std::string& dbPath, const std::string& indexPath, const std::vector<std::string>& domains, bool onlyFile) : m_valid(false), m_domains(domains), m_onlyFile(onlyFile), m_numberOfFiles(0), m_fileIndex(0)
     {
-        std::memset(m_fixedData, 0, 40);
+        std::sort(m_domains.begin(), m_domains.end());
+        m_files.resize(MBDB_ENUMERATOR_BATCH_SIZE);
         if (!m_reader.open(dbPath))
         {
             return;
         }
+        useMbdbIndex(m_reader, indexPath, m_domains);
         
         m_valid = true;
     }
     
     virtual bool isInvalid() const
     {
-        return m_valid;
+        return !m_valid;
     }
     
     virtual bool nextFile(ITunesFile& file)
     {
-        std::string domainInFile;
-        std::string path;
-        std::string linkTarget;
-        std::string dataHash;
-        std::string alwaysNull;
-        unsigned short fileMode = 0;
-        bool isDir = false;
-        bool skipped = false;
+        if (m_fileIndex >= m_numberOfFiles && !readFiles())
+        {
+            return false;
+        }
         
-        // bool hasFilter = (bool)m_loadingFilter;
+        const BufferedFile& bufferedFile = m_files[m_fileIndex++];
+        file.relativePath = bufferedFile.path.c_str();
+        file.fileId = bufferedFile.fileId;
+        file.domain = bufferedFile.domain.c_str();
+        file.flags = bufferedFile.flags;
+        file.blob = NULL;
+        file.blobLength = 0;
+        file.modifiedTime = bufferedFile.modifiedTime;
+        file.size = bufferedFile.size;
+        file.mode = bufferedFile.mode;
+        file.digest = bufferedFile.digestLength > 0 ? bufferedFile.digest : NULL;
+        file.digestLength = bufferedFile.digestLength;
+        
+        return true;
+    }
+    
+    virtual ~MbdbITunesFileEnumerator()
+    {
+    }
 
-        while (m_reader.hasMoreData())
+private:
+    // Read ahead a batch of files so their fileIds are hashed together
+    bool readFiles()
+    {
+        m_numberOfFiles = 0;
+        m_fileIndex = 0;
+        m_fileIds.clear();
+        
+        MbdbRecord record;
+        while (m_valid && m_numberOfFiles < m_files.size() && m_reader.next(record))
         {
-            if (!m_reader.read(domainInFile))
+            if (!m_domains.empty() && !std::binary_search(m_domains.cbegin(), m_domains.cend(), record.domain, __mbdb_string_less()))
             {
-                break;
+                continue;
             }
             
-            skipped = false;
-            if (!m_domain.empty() && m_domain != domainInFile)
+            unsigned short fileMode = record.getMode();
+            bool isDir = S_ISDIR(fileMode);
+            if (m_onlyFile && isDir)
             {
-                skipped = true;
+                continue;
             }
             
-            if (skipped)
+            unsigned int aTime = record.getTime1();
+            unsigned int bTime = record.getTime2();
+            
+            BufferedFile& bufferedFile = m_files[m_numberOfFiles++];
+            bufferedFile.domain.assign(record.domain.data, record.domain.length);
+            bufferedFile.path.assign(record.path.data, record.path.length);
+            bufferedFile.flags = isDir ? 2 : 1;
+            bufferedFile.modifiedTime = aTime != 0 ? aTime : bTime;
+            bufferedFile.size = static_cast<size_t>(record.getFileLength());
+            bufferedFile.mode = fileMode;
+            bufferedFile.digestLength = 0;
+            if (record.dataHash.length == Sha1Digest::DIGEST_LENGTH)
             {
-                // will skip it
-                m_reader.skipString();    // path
-                m_reader.skipString();    // linkTarget
-                m_reader.skipString();    // dataHash
-                m_reader.skipString();    // alwaysNull;
-                
-                m_reader.read(m_fixedData, 40);
-                int propertyCount = m_fixedData[39];
-
-                for (int j = 0; j < propertyCount; ++j)
-                {
-                    m_reader.skipString();
-                    m_reader.skipString();
-                }
-            }
-            else
-            {
-                m_reader.read(path);
-                m_reader.read(linkTarget);
-                m_reader.readD(dataHash);
-                m_reader.readD(alwaysNull);
-                
-                m_reader.read(m_fixedData, 40);
-
-                fileMode = (m_fixedData[0] << 8) | m_fixedData[1];
-                
-                isDir = S_ISDIR(fileMode);
-                
-                // unsigned char flags = fixedData[38];
-                
-                if (m_onlyFile && isDir)
-                {
-                    skipped = true;
-                }
-                
-                unsigned int aTime = bigEndianToNative(*((uint32_t *)(m_fixedData + 18)));
-                unsigned int bTime = bigEndianToNative(*((uint32_t *)(m_fixedData + 22)));
-                // unsigned int cTime = bigEndianToNative(*((uint32_t *)(m_fixedData + 26)));
-                
-                file.size = bigEndianToNative(*((int64_t *)(m_fixedData + 30)));
-                
-                int propertyCount = m_fixedData[39];
-                
-                for (int j = 0; j < propertyCount; ++j)
-                {
-                    if (skipped)
-                    {
-                        m_reader.skipString(); // name
-                        m_reader.skipString(); // value
-                    }
-                    else
-                    {
-                        std::string name;
-                        std::string value;
-                        
-                        m_reader.read(name);
-                        m_reader.read(value);
-                    }
-                }
-                
-                if (!skipped)
-                {
-                    file.relativePath = path;
-                    file.fileId = sha1(domainInFile + "-" + path);
-                    file.flags = isDir ? 2 : 1;
-                    file.modifiedTime = aTime != 0 ? aTime : bTime;
-                    // file.size =
-                    
-                    return true;
-                }
-                
+                std::memcpy(bufferedFile.digest, record.dataHash.data, Sha1Digest::DIGEST_LENGTH);
+                bufferedFile.digestLength = Sha1Digest::DIGEST_LENGTH;
             }
+            
+            m_fileIds.add(record.domain.data, record.domain.length);
+            m_fileIds.append("-", 1);
+            m_fileIds.append(record.path.data, record.path.length);
         }
         
-        return false;
+        m_fileIds.compute();
+        for (size_t idx = 0; idx < m_numberOfFiles; ++idx)
+        {
+            m_fileIds.getHexDigest(idx, m_files[idx].fileId);
+            m_files[idx].fileId[Sha1Batch::DIGEST_LENGTH * 2] = '\0';
+        }
+        
+        return m_numberOfFiles > 0;
     }
     
-    virtual ~MbdbITunesFileEnumerator()
-    {
-    }
-
 private:
+    struct BufferedFile
+    {
+        std::string domain;
+        std::string path;
+        char fileId[Sha1Batch::DIGEST_LENGTH * 2 + 1];
+        unsigned int flags;
+        unsigned int modifiedTime;
+        size_t size;
+        unsigned int mode;
+        unsigned char digest[Sha1Digest::DIGEST_LENGTH];
+        unsigned int digestLength;
+    };
+    
     MbdbReader      m_reader;
     bool            m_valid;
-    std::string     m_domain;
+    std::vector<std::string> m_domains;
     bool            m_onlyFile;
-    unsigned char   m_fixedData[40];
+    // The returned files point to the buffer, which is refilled once all of them are returned
+    std::vector<BufferedFile> m_files;
+    size_t          m_numberOfFiles;
+    size_t          m_fileIndex;
+    Sha1Batch       m_fileIds;
 };
 
-
-ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileName) : m_isMbdb(false), m_rootPath(rootPath), m_manifestFileName(manifestFileName)
+ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileName) : m_isMbdb(false), m_rootPath(rootPath), m_manifestFileName(manifestFileName), m_loadingMode(LOADING_BLOB), m_pathIndexEnabled(false), m_incrementalExport(false), m_exportMethod(EXPORT_COPY)
 {
     std::replace(m_rootPath.begin(), m_rootPath.end(), ALT_DIR_SEP, DIR_SEP);
     
@@ -354,11 +810,29 @@ ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileN
 
 ITunesDb::~ITunesDb()
 {
-    for (std::vector<ITunesFile *>::iterator it = m_files.begin(); it != m_files.end(); ++it)
+}
+
+ITunesDb::ITunesFileEnumerator* ITunesDb::buildEnumerator(const std::string& domain, bool onlyFile)
+{
+    std::vector<std::string> domains;
+    if (!domain.empty())
     {
-        delete *it;
+        domains.push_back(domain);
     }
-    m_files.clear();
+    return buildEnumerator(domains, onlyFile);
+}
+
+ITunesDb::ITunesFileEnumerator* ITunesDb::buildEnumerator(const std::vector<std::string>& domains, bool onlyFile)
+{
+    std::string dbPath = combinePath(m_rootPath, "Manifest.mbdb");
+    if (existsFile(dbPath))
+    {
+        m_isMbdb = true;
+        return new MbdbITunesFileEnumerator(dbPath, m_mbdbIndexPath, domains, onlyFile);
+    }
+    
+    m_isMbdb = false;
+    return new SqliteITunesFileEnumerator(combinePath(m_rootPath, "Manifest.db"), domains, onlyFile);
 }
 
 bool ITunesDb::load()
@@ -372,6 +846,16 @@ bool ITunesDb::load(const std::string& domain)
 }
 
 bool ITunesDb::load(const std::string& domain, bool onlyFile)
+{
+    std::vector<std::string> domains;
+    if (!domain.empty())
+    {
+        domains.push_back(domain);
+    }
+    return load(domains, onlyFile);
+}
+
+bool ITunesDb::load(const std::vector<std::string>& domains, bool onlyFile)
 {
     m_version.clear();
     BackupManifest manifest;
@@ -381,11 +865,20 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
         m_iOSVersion = manifest.getIOSVersion();
     }
     
+    m_domains = domains;
+    std::sort(m_domains.begin(), m_domains.end());
+    m_domains.erase(std::unique(m_domains.begin(), m_domains.end()), m_domains.end());
+    m_domainNames.clear();
+    for (std::vector<std::string>::const_iterator it = m_domains.cbegin(); it != m_domains.cend(); ++it)
+    {
+        m_domainNames.push_back(m_arena.copy(it->c_str(), it->size()));
+    }
+    
     std::string dbPath = combinePath(m_rootPath, "Manifest.mbdb");
     if (existsFile(dbPath))
     {
         m_isMbdb = true;
-        return loadMbdb(domain, onlyFile);
+        return loadMbdb(onlyFile);
     }
     
     m_isMbdb = false;
@@ -407,11 +900,19 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
     sqlite3_exec(db, "PRAGMA mmap_size=2097152;", NULL, NULL, NULL); // 8M:8388608  2M 2097152
     sqlite3_exec(db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
     
-    std::string sql = "SELECT fileID,relativePath,flags,file FROM Files";
-    if (domain.size() > 0)
+    // SQLITE_MAX_VARIABLE_NUMBER is 999 on old versions of sqlite3, filter the domains with the code if there are more
+    bool bindingDomains = !m_domains.empty() && m_domains.size() < 999;
+    // Don't read the blob (and its overflow pages) if it is not required
+    std::string sql = (m_loadingMode == LOADING_PATH_ONLY) ? "SELECT fileID,relativePath,flags,NULL,domain FROM Files" : "SELECT fileID,relativePath,flags,file,domain FROM Files";
+    if (m_domains.size() == 1)
     {
         sql += " WHERE domain=?";
     }
+    else if (bindingDomains)
+    {
+        std::vector<std::string> placeHolders(m_domains.size(), "?");
+        sql += " WHERE domain IN (" + join(placeHolders, ",") + ")";
+    }
     
     sqlite3_stmt* stmt = NULL;
     rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
@@ -422,24 +923,28 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
         return false;
     }
     
-    if (domain.size() > 0)
+    if (bindingDomains)
     {
-        rc = sqlite3_bind_text(stmt, 1, domain.c_str(), (int)(domain.size()), NULL);
-        if (rc != SQLITE_OK)
+        int idx = 1;
+        for (std::vector<std::string>::const_iterator it = m_domains.cbegin(); it != m_domains.cend(); ++it, ++idx)
         {
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
-            return false;
+            rc = sqlite3_bind_text(stmt, idx, it->c_str(), (int)(it->size()), NULL);
+            if (rc != SQLITE_OK)
+            {
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+                return false;
+            }
         }
     }
     
 #if !defined(NDEBUG) || defined(DBG_PERF)
-    printf("PERF: %s sql=%s, domain=%s\r\n", getTimestampString(false, true).c_str(), sql.c_str(), domain.c_str());
+    printf("PERF: %s sql=%s, domains=%s\r\n", getTimestampString(false, true).c_str(), sql.c_str(), join(m_domains, ",").c_str());
 #endif
     
     bool hasFilter = (bool)m_loadingFilter;
     
-    m_files.reserve(2048);
+    m_fileSlab.reserve(m_fileSlab.size() + 2048);
     while (sqlite3_step(stmt) == SQLITE_ROW)
     {
         int flags = sqlite3_column_int(stmt, 2);
@@ -450,47 +955,72 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
             continue;
         }
         
+        int domainIndex = -1;
+        if (!m_domains.empty())
+        {
+            domainIndex = findDomainIndex(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4)));
+            if (domainIndex < 0)
+            {
+                continue;
+            }
+        }
+        
         const char *relativePath = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
         if (hasFilter && !m_loadingFilter(relativePath, flags))
         {
             continue;
         }
         
-        ITunesFile *file = new ITunesFile();
+        m_fileSlab.emplace_back();
+        ITunesFile& file = m_fileSlab.back();
         const char *fileId = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
         if (NULL != fileId)
         {
-            file->fileId = fileId;
+            file.fileId = m_arena.copy(fileId, sqlite3_column_bytes(stmt, 0));
+        }
+        if (domainIndex >= 0)
+        {
+            file.domain = m_domainNames[domainIndex];
         }
         
         if (NULL != relativePath)
         {
-            file->relativePath = relativePath;
+            file.relativePath = m_arena.copy(relativePath, sqlite3_column_bytes(stmt, 1));
         }
-        file->flags = static_cast<unsigned int>(flags);
-        if (flags == 1)
+        file.flags = static_cast<unsigned int>(flags);
+        if (flags == 1 && m_loadingMode != LOADING_PATH_ONLY)
         {
             // Files
-            int blobBytes = sqlite3_column_bytes(stmt, 3);
             const unsigned char *blob = reinterpret_cast<const unsigned char*>(sqlite3_column_blob(stmt, 3));
+            int blobBytes = sqlite3_column_bytes(stmt, 3);
             if (blobBytes > 0 && NULL != blob)
             {
-                std::vector<unsigned char> blobVector(blob, blob + blobBytes);
-                file->blob.swap(blobVector);
+                if (m_loadingMode == LOADING_BLOB)
+                {
+                    file.blob = m_arena.copy(blob, blobBytes);
+                    file.blobLength = static_cast<unsigned int>(blobBytes);
+                }
+                else
+                {
+                    parseFileInfo(&file, blob, blobBytes);
+                    if (NULL != file.digest)
+                    {
+                        // The blob is dropped, keep a copy of the digest
+                        file.digest = m_arena.copy(file.digest, file.digestLength);
+                    }
+                }
             }
         }
-        
-        m_files.push_back(file);
     }
     
     sqlite3_finalize(stmt);
     sqlite3_close(db);
 
 #if !defined(NDEBUG) || defined(DBG_PERF)
-    printf("PERF: end.....%s, size=%lu\r\n", getTimestampString(false, true).c_str(), m_files.size());
+    printf("PERF: end.....%s, size=%lu\r\n", getTimestampString(false, true).c_str(), m_fileSlab.size());
 #endif
     
-    std::sort(m_files.begin(), m_files.end(), __string_less());
+    buildFileIndex();
     
 #if !defined(NDEBUG) || defined(DBG_PERF)
     printf("PERF: after sort.....%s\r\n", getTimestampString(false, true).c_str());
@@ -498,395 +1028,694 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
     return true;
 }
 
-bool ITunesDb::loadMbdb(const std::string& domain, bool onlyFile)
+bool ITunesDb::loadMbdb(bool onlyFile)
 {
     MbdbReader reader;
     if (!reader.open(combinePath(m_rootPath, "Manifest.mbdb")))
     {
         return false;
     }
+    useMbdbIndex(reader, m_mbdbIndexPath, m_domains);
     
-    // unsigned char mdbxBuffer[26];           // buffer for .mbdx record
-    unsigned char fixedData[40] = { 0 };    // buffer for the fixed part of .mbdb record
-    // SHA1CryptoServiceProvider hasher = new SHA1CryptoServiceProvider();
-
-    // System.DateTime unixEpoch = new System.DateTime(1970, 1, 1, 0, 0, 0, 0, DateTimeKind.Utc);
-
-    std::string domainInFile;
+    bool hasFilter = (bool)m_loadingFilter;
+    int domainIndex = -1;
     std::string path;
-    std::string linkTarget;
-    std::string dataHash;
-    std::string alwaysNull;
-    unsigned short fileMode = 0;
-    bool isDir = false;
-    bool skipped = false;
+    MbdbRecord record;
     
-    bool hasFilter = (bool)m_loadingFilter;
+    // The fileIds of m_fileSlab[batchStart, end) are hashed together, the hex strings go to the arena directly
+    Sha1Batch fileIds;
+    size_t batchStart = m_fileSlab.size();
+    auto assignFileIds = [this, &fileIds, &batchStart]()
+    {
+        fileIds.compute();
+        for (size_t idx = 0; idx < fileIds.size(); ++idx)
+        {
+            char* fileId = reinterpret_cast<char *>(m_arena.allocate(Sha1Batch::DIGEST_LENGTH * 2 + 1, 1));
+            fileIds.getHexDigest(idx, fileId);
+            fileId[Sha1Batch::DIGEST_LENGTH * 2] = '\0';
+            m_fileSlab[batchStart + idx].fileId = fileId;
+        }
+        fileIds.clear();
+        batchStart = m_fileSlab.size();
+    };
 
-    while (reader.hasMoreData())
+    while (reader.next(record))
     {
-        if (!reader.read(domainInFile))
+        domainIndex = -1;
+        if (!m_domains.empty())
         {
-            break;
+            // Compare with the view directly, no string is built for the skipped records
+            std::vector<std::string>::const_iterator it = std::lower_bound(m_domains.cbegin(), m_domains.cend(), record.domain, __mbdb_string_less());
+            if (it == m_domains.cend() || !record.domain.equals(*it))
+            {
+                continue;
+            }
+            domainIndex = static_cast<int>(std::distance(m_domains.cbegin(), it));
         }
         
-        skipped = false;
-        if (!domain.empty() && domain != domainInFile)
+        unsigned short fileMode = record.getMode();
+        bool isDir = S_ISDIR(fileMode);
+        if (onlyFile && isDir)
         {
-            skipped = true;
+            continue;
         }
         
-        if (skipped)
+        path.assign(record.path.data, record.path.length);
+        if (hasFilter && !m_loadingFilter(path.c_str(), (isDir ? 2 : 1)))
         {
-            // will skip it
-            reader.skipString();    // path
-            reader.skipString();    // linkTarget
-            reader.skipString();    // dataHash
-            reader.skipString();    // alwaysNull;
-            
-            reader.read(fixedData, 40);
-            int propertyCount = fixedData[39];
-
-            for (int j = 0; j < propertyCount; ++j)
-            {
-                reader.skipString();
-                reader.skipString();
-            }
+            continue;
         }
-        else
+        
+        unsigned int aTime = record.getTime1();
+        unsigned int bTime = record.getTime2();
+        
+        m_fileSlab.emplace_back();
+        ITunesFile& file = m_fileSlab.back();
+        file.relativePath = m_arena.copy(path.c_str(), path.size());
+        file.size = static_cast<size_t>(record.getFileLength());
+        if (domainIndex >= 0)
         {
-            reader.read(path);
-            reader.read(linkTarget);
-            reader.readD(dataHash);
-            reader.readD(alwaysNull);
-            
-            reader.read(fixedData, 40);
-
-            fileMode = (fixedData[0] << 8) | fixedData[1];
-            
-            isDir = S_ISDIR(fileMode);
-            
-            // unsigned char flags = fixedData[38];
-            
-            if (onlyFile && isDir)
-            {
-                skipped = true;
-            }
-            
-            if (hasFilter && !m_loadingFilter(path.c_str(), (isDir ? 2 : 1)))
-            {
-                skipped = true;
-            }
-            
-            unsigned int aTime = GetBigEndianInteger(fixedData, 18);
-            unsigned int bTime = GetBigEndianInteger(fixedData, 22);
-            // unsigned int cTime = GetBigEndianInteger(fixedData, 26);
-            
-            int propertyCount = fixedData[39];
-            
-            // rec.Properties = new MBFileRecord.Property[rec.PropertyCount];
-            for (int j = 0; j < propertyCount; ++j)
-            {
-                if (skipped)
-                {
-                    reader.skipString(); // name
-                    reader.skipString(); // value
-                }
-                else
-                {
-                    std::string name;
-                    std::string value;
-                    
-                    reader.read(name);
-                    reader.read(value);
-                }
-                
-            }
-            /*
-            StringBuilder fileName = new StringBuilder();
-            byte[] fb = hasher.ComputeHash(ASCIIEncoding.UTF8.GetBytes(rec.Domain + "-" + rec.Path));
-            for (int k = 0; k < fb.Length; k++)
-            {
-                fileName.Append(fb[k].ToString("x2"));
-            }
-
-            rec.key = fileName.ToString();
-             */
-            
-            if (!skipped)
-            {
-                ITunesFile *file = new ITunesFile();
-                file->relativePath = path;
-                file->fileId = sha1(domainInFile + "-" + path);
-                file->flags = isDir ? 2 : 1;
-                file->modifiedTime = aTime != 0 ? aTime : bTime;
-                
-                m_files.push_back(file);
-            }
-            
+            file.domain = m_domainNames[domainIndex];
+        }
+        file.flags = isDir ? 2 : 1;
+        file.modifiedTime = aTime != 0 ? aTime : bTime;
+        file.mode = fileMode;
+        if (record.dataHash.length == Sha1Digest::DIGEST_LENGTH)
+        {
+            file.digest = m_arena.copy(reinterpret_cast<const unsigned char *>(record.dataHash.data), record.dataHash.length);
+            file.digestLength = static_cast<unsigned int>(record.dataHash.length);
         }
         
-        
+        fileIds.add(record.domain.data, record.domain.length);
+        fileIds.append("-", 1);
+        fileIds.append(path.c_str(), path.size());
+        if (fileIds.size() >= MBDB_FILEID_BATCH_SIZE)
+        {
+            assignFileIds();
+        }
     }
+    assignFileIds();
     
-    std::sort(m_files.begin(), m_files.end(), __string_less());
+    buildFileIndex();
 
     return true;
 }
 
-bool ITunesDb::copy(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains) const
+// FNV-1a of the path, '\\' is hashed as '/' as findITunesFile accepts both separators
+static inline uint64_t hashPath(uint64_t hash, const char* path, size_t length)
 {
-    std::string dbPath = combinePath(m_rootPath, "Manifest.mbdb");
-    if (existsFile(dbPath))
-    {
-        return copyMbdb(destPath, backupId, domains);
-    }
-    
-    std::string destBackupPath = backupId.empty() ? combinePath(destPath, "Backup") : combinePath(destPath, "Backup", backupId);
-    if (!existsDirectory(destBackupPath))
+    for (size_t idx = 0; idx < length; ++idx)
     {
-        makeDirectory(destBackupPath);
-    }
-    
-    // Copy control files
-    const char* files[] = {"Info.plist", "Manifest.db", "Manifest.plist", "Status.plist"};
-    for (int idx = 0; idx < sizeof(files) / sizeof(const char *); ++idx)
-    {
-        ::copyFile(combinePath(m_rootPath, files[idx]), combinePath(destBackupPath, files[idx]));
+        hash ^= static_cast<unsigned char>(path[idx] == '\\' ? '/' : path[idx]);
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
 
-    dbPath = combinePath(destBackupPath, "Manifest.db");
-    
-    sqlite3 *db = NULL;
-    int rc = openSqlite3Database(dbPath, &db, false);
-    if (rc != SQLITE_OK)
-    {
-        // printf("Open database failed!");
-        sqlite3_close(db);
-        return false;
-    }
+static inline uint64_t hashPath(const char* path, size_t length)
+{
+    return hashPath(14695981039346656037ULL, path, length);
+}
 
-    sqlite3_exec(db, "PRAGMA mmap_size=2097152;", NULL, NULL, NULL); // 8M:8388608  2M 2097152
-    sqlite3_exec(db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
-    
-    std::string sql = "DELETE FROM Files";
-    
-    std::vector<std::string> appDomains;
-    std::vector<std::string> appPluginDomains;
-    if (domains.size() > 0)
+static inline uint64_t hashPath(const char* domain, size_t domainLength, const char* path, size_t length)
+{
+    // As fileIds are built: domain-relativePath
+    return hashPath(hashPath(hashPath(domain, domainLength), "-", 1), path, length);
+}
+
+// Compare the path of the file with the path passed to findITunesFile, in which '\\' stands for '/'
+static inline bool equalsPath(const char* relativePath, const std::string& path)
+{
+    for (std::string::size_type idx = 0; idx < path.size(); ++idx)
     {
-        appDomains.reserve(domains.size() * 2);
-        appPluginDomains.reserve(domains.size());
-        
-        for (std::vector<std::string>::const_iterator it = domains.cbegin(); it != domains.cend(); ++it)
+        if (relativePath[idx] == '\0' || relativePath[idx] != (path[idx] == '\\' ? '/' : path[idx]))
         {
-            appDomains.push_back("AppDomain-" + *it);
-            appDomains.push_back("AppDomainGroup-group." + *it);
-            
-            appPluginDomains.push_back("AppDomainPlugin-" + *it + ".%");
+            return false;
         }
-        sql += " WHERE ";
-        // domain=?";
-        std::vector<std::string> conditions(appDomains.size(), "domain<>?");
-        conditions.reserve(conditions.size() + appPluginDomains.size());
-        std::vector<std::string> conditions2(appDomains.size(), "(domain NOT LIKE )");
-        
-        sql += join(conditions, " AND ");
     }
-    
-    sqlite3_stmt* stmt = NULL;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
-    if (rc != SQLITE_OK)
+    return relativePath[path.size()] == '\0';
+}
+
+static inline size_t getPathIndexSlot(uint64_t hash, size_t mask)
+{
+    return static_cast<size_t>(hash ^ (hash >> 32)) & mask;
+}
+
+void ITunesDb::buildFileIndex()
+{
+    // Build the pointers after the slab stops growing, as growing it may move the files
+    m_files.clear();
+    m_files.reserve(m_fileSlab.size());
+    for (std::vector<ITunesFile>::iterator it = m_fileSlab.begin(); it != m_fileSlab.end(); ++it)
     {
-        std::string error = sqlite3_errmsg(db);
-        sqlite3_close(db);
-        return false;
+        m_files.push_back(&(*it));
     }
-
-    int idx = 1;
-    for (std::vector<std::string>::const_iterator it = domains.cbegin(); it != domains.cend(); ++it, ++idx)
+    
+    std::sort(m_files.begin(), m_files.end(), __string_less());
+    
+    m_domainFiles.clear();
+    m_domainFiles.resize(m_domains.size());
+    for (std::vector<ITunesFile *>::const_iterator it = m_files.cbegin(); it != m_files.cend(); ++it)
     {
-        rc = sqlite3_bind_text(stmt, idx, (*it).c_str(), (int)((*it).size()), NULL);
-        if (rc != SQLITE_OK)
+        int domainIndex = findDomainIndex((*it)->domain);
+        if (domainIndex >= 0)
         {
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
-            return false;
+            // m_files is sorted, so is each domain
+            m_domainFiles[domainIndex].push_back(*it);
         }
     }
     
-#if !defined(NDEBUG)
-#ifdef __APPLE__
-    if (__builtin_available(macOS 10.12, *))
+    buildPathIndex();
+}
+
+void ITunesDb::buildPathIndex()
+{
+    m_pathIndex.clear();
+    m_domainPathIndex.clear();
+    if (!m_pathIndexEnabled || m_files.empty())
     {
-#endif
-		char *expandedSql = sqlite3_expanded_sql(stmt);
-        printf("PERF: %s sql=%s\r\n", getTimestampString(false, true).c_str(), sqlite3_expanded_sql(stmt));
-#ifdef __APPLE__
+        return;
     }
-#endif
-#endif
     
-    if ((rc = sqlite3_step(stmt)) != SQLITE_DONE)
+    // Load factor <= 0.5, most lookups hit on the first slot
+    size_t numberOfSlots = 16;
+    while (numberOfSlots < m_files.size() * 2)
     {
-#ifndef NDEBUG
-		const char *errMsg = sqlite3_errmsg(db);
-        m_lastError = std::string(errMsg);
-#endif
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return false;
+        numberOfSlots <<= 1;
     }
-    
-    sqlite3_finalize(stmt);
-    
-    sqlite3_exec(db, "VACUUM;", NULL, NULL, NULL);
-    
-    std::set<std::string> subFolders;
-    sql = "SELECT fileID,flags FROM Files";
-    stmt = NULL;
-    std::string fileId;
-    std::string subFolder;
-    std::string subPath;
-    std::string srcFilePath;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+    PathIndexSlot emptySlot = {0, NULL};
+    size_t mask = numberOfSlots - 1;
+    m_pathIndex.assign(numberOfSlots, emptySlot);
+    for (std::vector<ITunesFile *>::const_iterator it = m_files.cbegin(); it != m_files.cend(); ++it)
     {
-        const char *str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        if (NULL == str)
+        size_t length = std::strlen((*it)->relativePath);
+        uint64_t hash = hashPath((*it)->relativePath, length);
+        size_t slot = getPathIndexSlot(hash, mask);
+        // The same path in several domains: keep the first one in m_files as the binary search finds
+        while (NULL != m_pathIndex[slot].file && (m_pathIndex[slot].hash != hash || std::strcmp(m_pathIndex[slot].file->relativePath, (*it)->relativePath) != 0))
         {
-            continue;
+            slot = (slot + 1) & mask;
         }
-        fileId = str;
-        subFolder = fileId.substr(0, 2);
-        
-        srcFilePath = combinePath(m_rootPath, subFolder, fileId);
-        if (!existsFile(srcFilePath))
+        if (NULL == m_pathIndex[slot].file)
         {
-#ifndef NDEBUG
-			int flags = sqlite3_column_int(stmt, 1);
-			if (flags == 1)
-			{
-				assert(!"Source file not exists.");
-			}
-#endif
-            continue;
+            m_pathIndex[slot].hash = hash;
+            m_pathIndex[slot].file = *it;
         }
-
-        subPath = combinePath(destBackupPath, subFolder);
-        if (subFolders.find(subFolder) == subFolders.cend())
+    }
+    
+    if (m_domains.empty())
+    {
+        return;
+    }
+    m_domainPathIndex.assign(numberOfSlots, emptySlot);
+    for (std::vector<ITunesFileVector>::const_iterator itDomain = m_domainFiles.cbegin(); itDomain != m_domainFiles.cend(); ++itDomain)
+    {
+        for (ITunesFilesConstIterator it = itDomain->cbegin(); it != itDomain->cend(); ++it)
         {
-            if (!existsDirectory(subPath))
+            uint64_t hash = hashPath((*it)->domain, std::strlen((*it)->domain), (*it)->relativePath, std::strlen((*it)->relativePath));
+            size_t slot = getPathIndexSlot(hash, mask);
+            while (NULL != m_domainPathIndex[slot].file)
             {
-                makeDirectory(subPath);
+                slot = (slot + 1) & mask;
             }
-            subFolders.insert(subFolder);
+            m_domainPathIndex[slot].hash = hash;
+            m_domainPathIndex[slot].file = *it;
         }
-        bool ret = ::copyFile(srcFilePath, combinePath(subPath, fileId));
-#ifndef NDEBUG
-		if (!ret)
-		{
-			std::string msg = "Failed to copy file" + combinePath(subPath, fileId);
-			assert(!msg.c_str());
-		}
-#endif
     }
-    
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-
-    return true;
 }
 
-bool ITunesDb::copyMbdb(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains) const
+int ITunesDb::findDomainIndex(const char* domain) const
 {
-    std::string destBackupPath = backupId.empty() ? combinePath(destPath, "Backup") : combinePath(destPath, "Backup", backupId);
-    if (!existsDirectory(destBackupPath))
+    if (NULL == domain || m_domains.empty())
     {
-        makeDirectory(destBackupPath);
+        return -1;
     }
-    
-    // Copy control files
-    const char* files[] = {"Info.plist", "Manifest.mbdb", "Manifest.plist", "Status.plist"};
-    for (int idx = 0; idx < sizeof(files) / sizeof(const char *); ++idx)
+    std::vector<std::string>::const_iterator it = std::lower_bound(m_domains.cbegin(), m_domains.cend(), domain, __string_less());
+    return (it != m_domains.cend() && *it == domain) ? static_cast<int>(std::distance(m_domains.cbegin(), it)) : -1;
+}
+
+ITunesFileRange ITunesDb::getFiles() const
+{
+    return ITunesFileRange(m_files.cbegin(), m_files.cend());
+}
+
+ITunesFileRange ITunesDb::getFiles(const std::string& domain) const
+{
+    int domainIndex = findDomainIndex(domain.c_str());
+    if (domainIndex < 0)
     {
-        ::copyFile(combinePath(m_rootPath, files[idx]), combinePath(destBackupPath, files[idx]));
+        return ITunesFileRange(m_files.cend(), m_files.cend());
     }
     
-    MbdbReader reader;
-    if (!reader.open(combinePath(destBackupPath, "Manifest.mbdb")))
+    const ITunesFileVector& files = m_domainFiles[domainIndex];
+    return ITunesFileRange(files.cbegin(), files.cend());
+}
+
+static bool attachSqlite3Database(sqlite3* db, const std::string& path, const char* schema)
+{
+    std::string sql = "ATTACH DATABASE ? AS ";
+    sql += schema;
+    sqlite3_stmt* stmt = NULL;
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+    if (rc != SQLITE_OK)
     {
         return false;
     }
-    
-    // unsigned char mdbxBuffer[26];           // buffer for .mbdx record
-    unsigned char fixedData[40] = { 0 };    // buffer for the fixed part of .mbdb record
-    // SHA1CryptoServiceProvider hasher = new SHA1CryptoServiceProvider();
+    rc = sqlite3_bind_text(stmt, 1, path.c_str(), (int)(path.size()), NULL);
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
 
-    // System.DateTime unixEpoch = new System.DateTime(1970, 1, 1, 0, 0, 0, 0, DateTimeKind.Utc);
+static std::string quoteSqlIdentifier(const std::string& name)
+{
+    std::string quoted = "\"";
+    for (std::string::const_iterator it = name.cbegin(); it != name.cend(); ++it)
+    {
+        if (*it == '"')
+        {
+            quoted += '"';
+        }
+        quoted += *it;
+    }
+    quoted += '"';
+    return quoted;
+}
 
-    std::string domainInFile;
-    std::string path;
-    std::string fileId;
-    bool skipped = false;
+// AppDomain-<id>, AppDomainGroup-group.<id> or AppDomainPlugin-<id>.<plugin> of the apps
+static bool isAppDomain(const std::string& domain, const std::unordered_set<std::string>& appDomains, const std::unordered_set<std::string>& bundleIds)
+{
+    if (appDomains.find(domain) != appDomains.cend())
+    {
+        return true;
+    }
     
-    bool hasFilter = (bool)m_loadingFilter;
+    const size_t prefixLength = sizeof("AppDomainPlugin-") - 1;
+    if (domain.compare(0, prefixLength, "AppDomainPlugin-") != 0)
+    {
+        return false;
+    }
+    // The bundle id has dots too, try each prefix which ends before a dot
+    for (size_t pos = domain.find('.', prefixLength); pos != std::string::npos; pos = domain.find('.', pos + 1))
+    {
+        if (bundleIds.find(domain.substr(prefixLength, pos - prefixLength)) != bundleIds.cend())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// is_app_domain(domain) of copyManifestDb, the user data is the AppDomainFilter
+struct AppDomainFilter
+{
+    std::unordered_set<std::string> appDomains;
+    std::unordered_set<std::string> bundleIds;
+};
+
+static void isAppDomainFunction(sqlite3_context* context, int /*argc*/, sqlite3_value** argv)
+{
+    const AppDomainFilter* filter = reinterpret_cast<const AppDomainFilter*>(sqlite3_user_data(context));
+    const char* domain = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+    bool result = NULL != domain && isAppDomain(std::string(domain, sqlite3_value_bytes(argv[0])), filter->appDomains, filter->bundleIds);
+    sqlite3_result_int(context, result ? 1 : 0);
+}
 
-    while (reader.hasMoreData())
+// Build the database in main from the attached database src: the tables are created from its schema and filled with INSERT ... SELECT,
+// Files is restricted to the domains of the apps (all the rows are kept if there is no app).
+// Indexes are created after the rows are inserted, which is cheaper than updating them row by row
+static bool copyManifestDb(sqlite3* db, const std::vector<std::string>& bundleIds)
+{
+    std::vector<std::pair<std::string, std::string>> tables;
+    std::vector<std::string> others;
+    
+    std::string sql = "SELECT type,name,sql FROM src.sqlite_master WHERE sql IS NOT NULL AND name NOT LIKE 'sqlite_%'";
+    sqlite3_stmt* stmt = NULL;
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+    if (rc != SQLITE_OK)
+    {
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char *type = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        const char *name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        const char *tableSql = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        if (NULL == type || NULL == name || NULL == tableSql)
+        {
+            continue;
+        }
+        if (std::strcmp(type, "table") == 0)
+        {
+            tables.push_back(std::make_pair(std::string(name), std::string(tableSql)));
+        }
+        else
+        {
+            others.push_back(tableSql);
+        }
+    }
+    sqlite3_finalize(stmt);
+    
+    std::vector<std::string> domains;
+    std::string condition;
+    AppDomainFilter filter;
+    // SQLITE_MAX_VARIABLE_NUMBER is 999 on old versions of sqlite3, there are 3 parameters per app.
+    // With more apps, the rows are filtered by is_app_domain as copyMbdb does
+    bool bindingDomains = bundleIds.size() * 3 < 999;
+    if (!bundleIds.empty() && !bindingDomains)
+    {
+        filter.bundleIds.insert(bundleIds.cbegin(), bundleIds.cend());
+        filter.appDomains.reserve(bundleIds.size() * 2);
+        for (std::vector<std::string>::const_iterator it = bundleIds.cbegin(); it != bundleIds.cend(); ++it)
+        {
+            filter.appDomains.insert("AppDomain-" + *it);
+            filter.appDomains.insert("AppDomainGroup-group." + *it);
+        }
+        if (sqlite3_create_function(db, "is_app_domain", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, &filter, isAppDomainFunction, NULL, NULL) != SQLITE_OK)
+        {
+            return false;
+        }
+        condition = " WHERE is_app_domain(domain)";
+    }
+    else if (!bundleIds.empty())
+    {
+        domains.reserve(bundleIds.size() * 3);
+        for (std::vector<std::string>::const_iterator it = bundleIds.cbegin(); it != bundleIds.cend(); ++it)
+        {
+            domains.push_back("AppDomain-" + *it);
+            domains.push_back("AppDomainGroup-group." + *it);
+        }
+        std::vector<std::string> placeHolders(domains.size(), "?");
+        condition = " WHERE domain IN (" + join(placeHolders, ",") + ")";
+        // GLOB is case sensitive as the domains are, the bundle ids have no wildcard chars
+        for (std::vector<std::string>::const_iterator it = bundleIds.cbegin(); it != bundleIds.cend(); ++it)
+        {
+            domains.push_back("AppDomainPlugin-" + *it + ".*");
+            condition += " OR domain GLOB ?";
+        }
+    }
+    
+    bool result = sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) == SQLITE_OK;
+    for (std::vector<std::pair<std::string, std::string>>::const_iterator it = tables.cbegin(); result && it != tables.cend(); ++it)
     {
-        if (!reader.read(domainInFile))
+        if (sqlite3_exec(db, it->second.c_str(), NULL, NULL, NULL) != SQLITE_OK)
         {
+            result = false;
             break;
         }
         
-        skipped = false;
-        if (!domains.empty() && (std::find(domains.cbegin(), domains.cend(), domainInFile) != domains.cend()))
+        std::string name = quoteSqlIdentifier(it->first);
+        sql = "INSERT INTO main." + name + " SELECT * FROM src." + name;
+        bool filtered = it->first == "Files" && !condition.empty();
+        if (filtered)
         {
-            skipped = true;
+            sql += condition;
         }
-        
-        if (skipped)
+        rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+        if (rc != SQLITE_OK)
         {
-            // will skip it
-            reader.skipString();    // path
+            result = false;
+            break;
         }
-        else
+        int idx = 1;
+        for (std::vector<std::string>::const_iterator itDomain = domains.cbegin(); filtered && rc == SQLITE_OK && itDomain != domains.cend(); ++itDomain, ++idx)
         {
-            reader.read(path);
-            
-            fileId = sha1(domainInFile + "-" + path);
-            ::copyFile(combinePath(m_rootPath, fileId), combinePath(destBackupPath, fileId));
+            rc = sqlite3_bind_text(stmt, idx, itDomain->c_str(), (int)(itDomain->size()), NULL);
         }
+        if (rc == SQLITE_OK)
+        {
+            rc = sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+        result = (rc == SQLITE_DONE);
+    }
+    
+    for (std::vector<std::string>::const_iterator it = others.cbegin(); result && it != others.cend(); ++it)
+    {
+        result = sqlite3_exec(db, it->c_str(), NULL, NULL, NULL) == SQLITE_OK;
+    }
+    
+    if (!result || sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+    {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        result = false;
+    }
+    if (!bindingDomains)
+    {
+        // filter is gone once we return
+        sqlite3_create_function(db, "is_app_domain", 1, SQLITE_UTF8, NULL, NULL, NULL, NULL);
+    }
+    return result;
+}
+
+bool ITunesDb::copy(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains, unsigned int jobs/* = 0*/) const
+{
+    std::string dbPath = combinePath(m_rootPath, "Manifest.mbdb");
+    if (existsFile(dbPath))
+    {
+        return copyMbdb(destPath, backupId, domains, jobs);
+    }
+    
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+#endif
+    
+    std::string destBackupPath = backupId.empty() ? combinePath(destPath, "Backup") : combinePath(destPath, "Backup", backupId);
+    if (!existsDirectory(destBackupPath))
+    {
+        makeDirectory(destBackupPath);
+    }
+    
+    // Copy control files, Manifest.db is rebuilt below with the rows of the domains only
+    const char* files[] = {"Info.plist", "Manifest.plist", "Status.plist"};
+    for (int idx = 0; idx < sizeof(files) / sizeof(const char *); ++idx)
+    {
+        ::copyFile(combinePath(m_rootPath, files[idx]), combinePath(destBackupPath, files[idx]));
+    }
+
+    // The database is opened without SQLITE_OPEN_CREATE semantics (mode=rw), sqlite takes an empty file as an empty database
+    dbPath = combinePath(destBackupPath, "Manifest.db");
+    if (!writeFile(dbPath, std::string()))
+    {
+        return false;
+    }
+    
+    sqlite3 *db = NULL;
+    int rc = openSqlite3Database(dbPath, &db, false);
+    if (rc != SQLITE_OK)
+    {
+        // printf("Open database failed!");
+        sqlite3_close(db);
+        return false;
+    }
+
+    // The database is written once from scratch, nothing to recover if it fails
+    sqlite3_exec(db, "PRAGMA journal_mode=OFF;", NULL, NULL, NULL);
+    sqlite3_exec(db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+    
+    if (!attachSqlite3Database(db, combinePath(m_rootPath, "Manifest.db"), "src") || !copyManifestDb(db, domains))
+    {
+#ifndef NDEBUG
+        m_lastError = std::string(sqlite3_errmsg(db));
+#endif
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_exec(db, "DETACH DATABASE src;", NULL, NULL, NULL);
+    
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    std::chrono::steady_clock::time_point dbTime = std::chrono::steady_clock::now();
+#endif
+    
+    // The files are copied from the rows which were kept, directories (flags=2) and links (flags=4) have no file in the backup
+    std::string sql = "SELECT fileID FROM Files WHERE flags=1";
+    sqlite3_stmt* stmt = NULL;
+    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return false;
+    }
+    
+    CopyStage copyStage(jobs, [this](const std::string& src, const std::string& dest) {
+        return copyOrLinkFile(src, dest, 0);
+    }, m_progressHandler);
+    std::set<std::string> subFolders;
+    std::string fileId;
+    std::string subFolder;
+    std::string subPath;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char *str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if (NULL == str || std::strlen(str) < 2)
+        {
+            continue;
+        }
+        fileId = str;
+        subFolder = fileId.substr(0, 2);
         
-        reader.skipString();    // linkTarget
-        reader.skipString();    // dataHash
-        reader.skipString();    // alwaysNull
-        
-        reader.read(fixedData, 40);
-        int propertyCount = fixedData[39];
+        subPath = combinePath(destBackupPath, subFolder);
+        if (subFolders.find(subFolder) == subFolders.cend())
+        {
+            if (!existsDirectory(subPath))
+            {
+                makeDirectory(subPath);
+            }
+            subFolders.insert(subFolder);
+        }
+        copyStage.add(combinePath(m_rootPath, subFolder, fileId), combinePath(subPath, fileId));
+    }
+    
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    
+    size_t numberOfFailedFiles = copyStage.finish();
+    
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+    printf("PERF: copy: db=%lldms files=%lldms copied=%zu failed=%zu\r\n",
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(dbTime - startTime).count(),
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(endTime - dbTime).count(),
+           copyStage.getNumberOfCopiedFiles(), numberOfFailedFiles);
+#endif
 
-        for (int j = 0; j < propertyCount; ++j)
+    return numberOfFailedFiles == 0;
+}
+
+bool ITunesDb::copyMbdb(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains, unsigned int jobs) const
+{
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+#endif
+    
+    std::string destBackupPath = backupId.empty() ? combinePath(destPath, "Backup") : combinePath(destPath, "Backup", backupId);
+    if (!existsDirectory(destBackupPath))
+    {
+        makeDirectory(destBackupPath);
+    }
+    
+    // Copy control files
+    const char* files[] = {"Info.plist", "Manifest.mbdb", "Manifest.plist", "Status.plist"};
+    for (int idx = 0; idx < sizeof(files) / sizeof(const char *); ++idx)
+    {
+        ::copyFile(combinePath(m_rootPath, files[idx]), combinePath(destBackupPath, files[idx]));
+    }
+    
+    MbdbReader reader;
+    if (!reader.open(combinePath(m_rootPath, "Manifest.mbdb")))
+    {
+        return false;
+    }
+    
+    std::unordered_set<std::string> bundleIds(domains.cbegin(), domains.cend());
+    std::unordered_set<std::string> appDomains;
+    appDomains.reserve(domains.size() * 2);
+    for (std::vector<std::string>::const_iterator it = domains.cbegin(); it != domains.cend(); ++it)
+    {
+        appDomains.insert("AppDomain-" + *it);
+        appDomains.insert("AppDomainGroup-group." + *it);
+    }
+    
+    // The reader only parses and hashes the records, the files are copied by the copy stage meanwhile
+    CopyStage copyStage(jobs, [this](const std::string& src, const std::string& dest) {
+        return copyOrLinkFile(src, dest, 0);
+    }, m_progressHandler);
+    
+    Sha1Batch fileIds;
+    auto queueFiles = [this, &fileIds, &copyStage, &destBackupPath]()
+    {
+        fileIds.compute();
+        for (size_t idx = 0; idx < fileIds.size(); ++idx)
+        {
+            std::string fileId = fileIds.getHexDigest(idx);
+            copyStage.add(combinePath(m_rootPath, fileId), combinePath(destBackupPath, fileId));
+        }
+        fileIds.clear();
+    };
+    
+    std::string domain;
+    MbdbRecord record;
+    while (reader.next(record))
+    {
+        // Directories and symbolic links have no file in the backup
+        if (S_ISDIR(record.getMode()) || record.linkTarget.length > 0)
+        {
+            continue;
+        }
+        if (!domains.empty())
         {
-            reader.skipString();
-            reader.skipString();
+            domain.assign(record.domain.data, record.domain.length);
+            if (!isAppDomain(domain, appDomains, bundleIds))
+            {
+                continue;
+            }
         }
         
+        fileIds.add(record.domain.data, record.domain.length);
+        fileIds.append("-", 1);
+        fileIds.append(record.path.data, record.path.length);
+        if (fileIds.size() >= MBDB_FILEID_BATCH_SIZE)
+        {
+            queueFiles();
+        }
     }
+    queueFiles();
     
-    std::sort(m_files.begin(), m_files.end(), __string_less());
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    std::chrono::steady_clock::time_point parseTime = std::chrono::steady_clock::now();
+#endif
+    size_t numberOfFailedFiles = copyStage.finish();
+    
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+    printf("PERF: copyMbdb: parse=%lldms total=%lldms copied=%zu failed=%zu\r\n",
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(parseTime - startTime).count(),
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count(),
+           copyStage.getNumberOfCopiedFiles(), numberOfFailedFiles);
+#endif
 
-    return true;
+    return numberOfFailedFiles == 0;
 }
 
 unsigned int ITunesDb::parseModifiedTime(const std::vector<unsigned char>& data)
 {
-    if (data.empty())
+    return data.empty() ? 0 : parseModifiedTime(&data[0], data.size());
+}
+
+unsigned int ITunesDb::parseModifiedTime(const ITunesFile* file)
+{
+    if (NULL == file)
+    {
+        return 0;
+    }
+    if (file->modifiedTime == 0)
+    {
+        // The result is cached in the file
+        parseFileInfo(file);
+    }
+    return file->modifiedTime;
+}
+
+unsigned int ITunesDb::parseModifiedTime(const unsigned char* data, size_t length)
+{
+    if (NULL == data || 0 == length)
     {
         return 0;
     }
+    
+    MBFileReader reader(data, length);
+    MBFileReader::FileInfo fileInfo;
+    if (reader.read(fileInfo))
+    {
+        return static_cast<unsigned int>(fileInfo.lastModified);
+    }
+    
     uint64_t val = 0;
     plist_t node = NULL;
-    plist_from_memory(reinterpret_cast<const char *>(&data[0]), static_cast<uint32_t>(data.size()), &node);
+    plist_from_memory(reinterpret_cast<const char *>(data), static_cast<uint32_t>(length), &node);
     if (NULL != node)
     {
         plist_t lastModified = plist_access_path(node, 3, "$objects", 1, "LastModified");
@@ -903,163 +1732,800 @@ unsigned int ITunesDb::parseModifiedTime(const std::vector<unsigned char>& data)
 
 bool ITunesDb::parseFileInfo(const ITunesFile* file)
 {
-    if (NULL == file || file->blob.empty())
+    if (NULL == file)
+    {
+        return false;
+    }
+    
+    if (file->blobParsed)
+    {
+        return true;
+    }
+    
+    return parseFileInfo(file, file->blob, file->blobLength);
+}
+
+bool ITunesDb::parseFileInfo(const ITunesFile* file, const unsigned char* blob, size_t blobLength)
+{
+    if (NULL == file || NULL == blob || 0 == blobLength)
     {
         return false;
     }
     
-    if (file->blobParsed)
+    file->blobParsed = true;
+    
+    MBFileReader reader(blob, blobLength);
+    MBFileReader::FileInfo fileInfo;
+    if (reader.read(fileInfo))
+    {
+        file->modifiedTime = static_cast<unsigned int>(fileInfo.lastModified);
+        file->size = static_cast<size_t>(fileInfo.size);
+        file->birthTime = static_cast<unsigned int>(fileInfo.birth);
+        file->mode = static_cast<unsigned int>(fileInfo.mode);
+        file->fileFlags = static_cast<unsigned int>(fileInfo.flags);
+        if (fileInfo.digestLength == Sha1Digest::DIGEST_LENGTH)
+        {
+            file->digest = fileInfo.digest;
+            file->digestLength = static_cast<unsigned int>(fileInfo.digestLength);
+        }
+        return true;
+    }
+    
+    // Fall back to libplist for unexpected layouts
+    uint64_t val = 0;
+    plist_t node = NULL;
+    plist_from_memory(reinterpret_cast<const char *>(blob), static_cast<uint32_t>(blobLength), &node);
+    if (NULL != node)
+    {
+        plist_t lastModifiedNode = plist_access_path(node, 3, "$objects", 1, "LastModified");
+        if (NULL != lastModifiedNode)
+        {
+            plist_get_uint_val(lastModifiedNode, &val);
+            file->modifiedTime = (unsigned int)val;
+        }
+        
+        plist_t sizeNode = plist_access_path(node, 3, "$objects", 1, "Size");
+        if (NULL != sizeNode)
+        {
+            val = 0;
+            plist_get_uint_val(sizeNode, &val);
+            file->size = val;
+        }
+        
+        plist_free(node);
+        return true;
+    }
+    
+    return false;
+}
+
+std::string ITunesDb::findFileId(const std::string& relativePath) const
+{
+    const ITunesFile* file = findITunesFile(relativePath);
+    
+    if (NULL == file)
+    {
+        return std::string();
+    }
+    return file->fileId;
+}
+
+const ITunesFile* ITunesDb::findITunesFile(const std::string& domain, const std::string& relativePath) const
+{
+    if (!m_domainPathIndex.empty())
+    {
+        uint64_t hash = hashPath(domain.c_str(), domain.size(), relativePath.c_str(), relativePath.size());
+        size_t mask = m_domainPathIndex.size() - 1;
+        for (size_t slot = getPathIndexSlot(hash, mask); NULL != m_domainPathIndex[slot].file; slot = (slot + 1) & mask)
+        {
+            const ITunesFile* file = m_domainPathIndex[slot].file;
+            if (m_domainPathIndex[slot].hash == hash && domain.compare(file->domain) == 0 && equalsPath(file->relativePath, relativePath))
+            {
+                return file;
+            }
+        }
+        return NULL;
+    }
+    
+    std::string formatedPath = relativePath;
+    std::replace(formatedPath.begin(), formatedPath.end(), '\\', '/');
+    
+    ITunesFileRange range = getFiles(domain);
+    ITunesFilesConstIterator it = std::lower_bound(range.first, range.second, formatedPath, __string_less());
+    
+    if (it == range.second || (*it)->relativePath != formatedPath)
+    {
+        return NULL;
+    }
+    return *it;
+}
+
+const ITunesFile* ITunesDb::findITunesFile(const std::string& relativePath) const
+{
+    if (!m_pathIndex.empty())
+    {
+        uint64_t hash = hashPath(relativePath.c_str(), relativePath.size());
+        size_t mask = m_pathIndex.size() - 1;
+        for (size_t slot = getPathIndexSlot(hash, mask); NULL != m_pathIndex[slot].file; slot = (slot + 1) & mask)
+        {
+            if (m_pathIndex[slot].hash == hash && equalsPath(m_pathIndex[slot].file->relativePath, relativePath))
+            {
+                return m_pathIndex[slot].file;
+            }
+        }
+        return NULL;
+    }
+    
+    std::string formatedPath = relativePath;
+    std::replace(formatedPath.begin(), formatedPath.end(), '\\', '/');
+
+    typename std::vector<ITunesFile *>::iterator it = std::lower_bound(m_files.begin(), m_files.end(), formatedPath, __string_less());
+    
+    if (it == m_files.end() || (*it)->relativePath != formatedPath)
+    {
+        return NULL;
+    }
+    return *it;
+}
+
+std::string ITunesDb::fileIdToRealPath(const std::string& fileId) const
+{
+    if (!fileId.empty())
+    {
+        return m_isMbdb ? combinePath(m_rootPath, fileId) : combinePath(m_rootPath, fileId.substr(0, 2), fileId);
+    }
+    
+    return std::string();
+}
+
+std::string ITunesDb::getRealPath(const ITunesFile& file) const
+{
+    return fileIdToRealPath(file.fileId);
+}
+
+std::string ITunesDb::getRealPath(const ITunesFile* file) const
+{
+    return fileIdToRealPath(file->fileId);
+}
+
+std::string ITunesDb::findRealPath(const std::string& relativePath) const
+{
+    std::string fieldId = findFileId(relativePath);
+    return fileIdToRealPath(fieldId);
+}
+
+bool ITunesDb::copyFile(const std::string& vpath, const std::string& dest, bool overwrite/* = false*/) const
+{
+    std::string destPath = normalizePath(dest);
+    if (!overwrite && existsFile(destPath))
+    {
+        return true;
+    }
+    
+    const ITunesFile* file = findITunesFile(vpath);
+    if (NULL != file)
+    {
+        std::string srcPath = getRealPath(*file);
+        if (!srcPath.empty())
+        {
+            normalizePath(srcPath);
+            return copyOrLinkFile(srcPath, destPath, ITunesDb::parseModifiedTime(file));
+        }
+    }
+    
+    return false;
+}
+
+bool ITunesDb::copyFile(const std::string& vpath, const std::string& destPath, const std::string& destFileName, bool overwrite/* = false*/) const
+{
+    std::string destFullPath = normalizePath(combinePath(destPath, destFileName));
+    if (!overwrite && existsFile(destFullPath))
+    {
+        return true;
+    }
+    
+    const ITunesFile* file = findITunesFile(vpath);
+    if (NULL != file)
+    {
+        std::string srcPath = getRealPath(*file);
+        if (!srcPath.empty())
+        {
+            normalizePath(srcPath);
+            if (!existsDirectory(destPath))
+            {
+                makeDirectory(destPath);
+            }
+            return copyOrLinkFile(srcPath, destFullPath, ITunesDb::parseModifiedTime(file));
+        }
+    }
+    
+    return false;
+}
+
+// The destination was written by a previous export: same size and the modified time set by updateFileTime
+// Without the time of the backup, an unchanged copy can't be told from a changed file, so it is copied again
+static bool isExportedFileUnchanged(const std::string& src, const std::string& dest, uint64_t size, unsigned int modifiedTime, bool linking)
+{
+    uint64_t destSize = 0;
+    int64_t destModifiedTime = 0;
+    if (!getFileStat(dest, destSize, destModifiedTime) || destSize != size)
+    {
+        return false;
+    }
+    // The time of a hard link isn't updated by copyOrLinkFile
+    return (modifiedTime > 0 && destModifiedTime == modifiedTime) || (linking && isSameFile(src, dest));
+}
+
+bool ITunesDb::exportFile(const ITunesFile* file, const std::string& outputPath, uint64_t& bytes, bool& skipped) const
+{
+    std::string dest = combinePath(outputPath, file->relativePath);
+    normalizePath(dest);
+    
+    // Fill modifiedTime/size, each file is handled by one thread only
+    parseFileInfo(file);
+    unsigned int modifiedTime = parseModifiedTime(file);
+    std::string src = getRealPath(file);
+    skipped = m_incrementalExport && isExportedFileUnchanged(src, dest, file->size, modifiedTime, m_exportMethod == EXPORT_LINK);
+    if (skipped)
+    {
+        return true;
+    }
+    
+    bool result = copyOrLinkFile(src, dest, modifiedTime);
+    if (result)
+    {
+        bytes += file->size;
+    }
+    
+    return result;
+}
+
+bool ITunesDb::copyOrLinkFile(const std::string& src, const std::string& dest, unsigned int modifiedTime) const
+{
+    CopyFileMethod method = COPY_FILE_NONE;
+    bool result = (m_exportMethod == EXPORT_LINK) ? linkFile(src, dest, &method) : ::copyFile(src, dest, true, &method);
+    // Updating the time of a hard link would change the file in the backup
+    if (result && modifiedTime > 0 && method != COPY_FILE_HARD_LINK)
+    {
+        updateFileTime(dest, static_cast<time_t>(modifiedTime));
+    }
+    return result;
+}
+
+bool ITunesDb::exportFiles(const ITunesFileRange& range, const std::string& outputPath, unsigned int jobs, ExportStats* stats/* = NULL*/, const std::atomic_bool* cancelled/* = NULL*/) const
+{
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    
+    // Pre-pass: create all the directories serially, so the workers only copy files
+    std::set<std::string> directories;
+    std::vector<const ITunesFile *> files;
+    std::vector<const ITunesFile *> dirs;
+    files.reserve(std::distance(range.first, range.second));
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        const char *relativePath = (*it)->relativePath;
+        if ((*it)->isDir())
+        {
+            directories.insert(relativePath);
+            dirs.push_back(*it);
+        }
+        else
+        {
+            const char *sep = std::strrchr(relativePath, '/');
+            directories.insert(NULL == sep ? std::string() : std::string(relativePath, sep - relativePath));
+            files.push_back(*it);
+        }
+    }
+    
+    size_t numberOfFailures = 0;
+    for (std::set<std::string>::const_iterator it = directories.cbegin(); it != directories.cend(); ++it)
+    {
+        std::string dest = it->empty() ? outputPath : combinePath(outputPath, *it);
+        normalizePath(dest);
+        if (!existsDirectory(dest) && !makeDirectory(dest))
+        {
+            ++numberOfFailures;
+        }
+    }
+    
+    if (0 == jobs)
+    {
+        jobs = std::thread::hardware_concurrency();
+    }
+    jobs = std::max(1u, std::min(jobs, static_cast<unsigned int>((files.size() + 1) / 2)));
+    
+    // Workers take chunks of the sorted files from a shared cursor, so a slow chunk (big files) doesn't stall the others
+    const size_t chunkSize = 32;
+    std::atomic<size_t> nextChunk(0);
+    std::atomic<size_t> numberOfCopiedFiles(0);
+    std::atomic<size_t> numberOfFailedFiles(0);
+    std::atomic<size_t> numberOfSkippedFiles(0);
+    std::atomic<uint64_t> totalBytes(0);
+    
+    auto worker = [&]() {
+        uint64_t bytes = 0;
+        size_t copied = 0;
+        size_t failed = 0;
+        size_t skipped = 0;
+        size_t start = 0;
+        while ((start = nextChunk.fetch_add(chunkSize)) < files.size())
+        {
+            if (NULL != cancelled && cancelled->load())
+            {
+                break;
+            }
+            size_t end = std::min(start + chunkSize, files.size());
+            for (size_t idx = start; idx < end; ++idx)
+            {
+                bool unchanged = false;
+                if (!exportFile(files[idx], outputPath, bytes, unchanged))
+                {
+                    ++failed;
+                }
+                else
+                {
+                    unchanged ? ++skipped : ++copied;
+                }
+            }
+        }
+        numberOfCopiedFiles += copied;
+        numberOfFailedFiles += failed;
+        numberOfSkippedFiles += skipped;
+        totalBytes += bytes;
+    };
+    
+    if (jobs == 1)
+    {
+        worker();
+    }
+    else
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(jobs);
+        for (unsigned int idx = 0; idx < jobs; ++idx)
+        {
+            threads.emplace_back(worker);
+        }
+        for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+        {
+            it->join();
+        }
+    }
+    
+    // Update the time of directories at last as copying files changes it
+    for (std::vector<const ITunesFile *>::const_iterator it = dirs.cbegin(); it != dirs.cend(); ++it)
+    {
+        unsigned int modifiedTime = parseModifiedTime(*it);
+        if (modifiedTime > 0)
+        {
+            updateFileTime(normalizePath(combinePath(outputPath, (*it)->relativePath)), modifiedTime);
+        }
+    }
+    
+    numberOfFailures += numberOfFailedFiles.load();
+    if (NULL != stats)
+    {
+        stats->numberOfFiles = numberOfCopiedFiles.load();
+        stats->numberOfDirectories = dirs.size();
+        stats->numberOfFailures = numberOfFailures;
+        stats->numberOfSkippedFiles = numberOfSkippedFiles.load();
+        stats->bytes = totalBytes.load();
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    printf("PERF: export %lu files (%lu unchanged) with %u jobs in %.3fs\r\n", numberOfCopiedFiles.load(), numberOfSkippedFiles.load(), jobs, std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+#endif
+    
+    return numberOfFailures == 0 && (NULL == cancelled || !cancelled->load());
+}
+
+struct ExportJob
+{
+    std::string src;
+    std::string dest;
+    unsigned int modifiedTime;
+    uint64_t size;
+    // Filled for verification only
+    std::string domain;
+    std::string relativePath;
+    std::string fileId;
+    unsigned char digest[Sha1Digest::DIGEST_LENGTH];
+    unsigned int digestLength;
+    
+    ExportJob() : modifiedTime(0), size(0), digestLength(0)
+    {
+    }
+};
+
+#define VERIFY_CHUNK_SIZE   (1024 * 1024)
+
+struct __verify_issue_less
+{
+    bool operator()(const ITunesDb::VerifyIssue& issue1, const ITunesDb::VerifyIssue& issue2) const
+    {
+        int result = issue1.domain.compare(issue2.domain);
+        return result < 0 || (result == 0 && issue1.relativePath < issue2.relativePath);
+    }
+};
+
+bool ITunesDb::exportStreaming(const std::vector<std::string>& domains, const std::string& outputPath, unsigned int jobs, ExportStats* stats/* = NULL*/, const std::atomic_bool* cancelled/* = NULL*/, VerifyReport* report/* = NULL*/)
+{
+    return streamFiles(domains, outputPath, true, jobs, stats, report, cancelled);
+}
+
+bool ITunesDb::verify(const std::vector<std::string>& domains, const std::string& outputPath, unsigned int jobs, VerifyReport& report, const std::atomic_bool* cancelled/* = NULL*/)
+{
+    return streamFiles(domains, outputPath, false, jobs, NULL, &report, cancelled);
+}
+
+bool ITunesDb::streamFiles(const std::vector<std::string>& domains, const std::string& outputPath, bool exporting, unsigned int jobs, ExportStats* stats, VerifyReport* report, const std::atomic_bool* cancelled)
+{
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    
+    std::unique_ptr<ITunesFileEnumerator> enumerator(buildEnumerator(domains, false));
+    if (!enumerator || enumerator->isInvalid())
+    {
+        return false;
+    }
+    
+    size_t numberOfFailures = 0;
+    std::set<std::string> directories;
+    for (std::vector<std::string>::const_iterator it = domains.cbegin(); exporting && it != domains.cend(); ++it)
+    {
+        std::string dest = normalizePath(combinePath(outputPath, *it));
+        if (!existsDirectory(dest) && !makeDirectory(dest))
+        {
+            ++numberOfFailures;
+        }
+        directories.insert(dest);
+    }
+    
+    if (0 == jobs)
+    {
+        jobs = std::thread::hardware_concurrency();
+    }
+    jobs = std::max(1u, jobs);
+    
+    BoundedQueue<ExportJob> queue(jobs * 64);
+    std::atomic<size_t> numberOfCopiedFiles(0);
+    std::atomic<size_t> numberOfFailedFiles(0);
+    std::atomic<size_t> numberOfSkippedFiles(0);
+    std::atomic<uint64_t> totalBytes(0);
+    std::atomic<size_t> numberOfMatches(0);
+    std::atomic<size_t> numberOfFilesWithoutDigest(0);
+    std::atomic<uint64_t> hashedBytes(0);
+    std::mutex issuesMutex;
+    if (NULL != report)
+    {
+        *report = VerifyReport();
+    }
+    
+    // The digest of the file in the backup is computed while it is copied, or read separately when only verifying
+    auto checkFile = [&](const ExportJob& job, bool readable, Sha1Digest& sourceDigest) {
+        unsigned char actual[Sha1Digest::DIGEST_LENGTH] = {0};
+        sourceDigest.finish(actual);
+        
+        VerifyIssue issue;
+        issue.status = readable ? (job.digestLength > 0 ? VERIFY_OK : VERIFY_NO_DIGEST) : VERIFY_READ_ERROR;
+        if (issue.status == VERIFY_OK && std::memcmp(actual, job.digest, Sha1Digest::DIGEST_LENGTH) != 0)
+        {
+            issue.status = VERIFY_DIGEST_MISMATCH;
+            issue.expectedDigest = toHexString(job.digest, Sha1Digest::DIGEST_LENGTH);
+            issue.actualDigest = toHexString(actual, Sha1Digest::DIGEST_LENGTH);
+        }
+        if (!exporting && !job.dest.empty() && (issue.status == VERIFY_OK || issue.status == VERIFY_NO_DIGEST))
+        {
+            Sha1Digest outputDigest;
+            unsigned char output[Sha1Digest::DIGEST_LENGTH] = {0};
+            if (!digestFile(job.dest, outputDigest))
+            {
+                issue.status = VERIFY_READ_ERROR;
+            }
+            else
+            {
+                outputDigest.finish(output);
+                if (std::memcmp(actual, output, Sha1Digest::DIGEST_LENGTH) != 0)
+                {
+                    issue.status = VERIFY_OUTPUT_MISMATCH;
+                    issue.expectedDigest = toHexString(actual, Sha1Digest::DIGEST_LENGTH);
+                    issue.actualDigest = toHexString(output, Sha1Digest::DIGEST_LENGTH);
+                }
+            }
+        }
+        
+        if (issue.status == VERIFY_OK)
+        {
+            ++numberOfMatches;
+        }
+        else if (issue.status == VERIFY_NO_DIGEST)
+        {
+            ++numberOfFilesWithoutDigest;
+        }
+        else
+        {
+            issue.domain = job.domain;
+            issue.relativePath = job.relativePath;
+            issue.fileId = job.fileId;
+            std::lock_guard<std::mutex> lock(issuesMutex);
+            report->issues.push_back(std::move(issue));
+        }
+    };
+    
+    std::atomic<size_t> numberOfQueuedFiles(0);
+    std::atomic<size_t> numberOfProcessedFiles(0);
+    std::mutex progressMutex;
+    auto reportProgress = [&]() {
+        size_t processed = ++numberOfProcessedFiles;
+        if (m_progressHandler && processed % PROGRESS_INTERVAL == 0)
+        {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            m_progressHandler(processed, numberOfQueuedFiles, false);
+        }
+    };
+    
+    auto worker = [&]() {
+        ExportJob job;
+        uint64_t bytes = 0;
+        size_t copied = 0;
+        size_t failed = 0;
+        size_t skipped = 0;
+        while (queue.pop(job))
+        {
+            // The stat is done by the workers, so the producer only reads the manifest
+            if (exporting && m_incrementalExport && isExportedFileUnchanged(job.src, job.dest, job.size, job.modifiedTime, m_exportMethod == EXPORT_LINK))
+            {
+                ++skipped;
+                reportProgress();
+                continue;
+            }
+            bool result = true;
+            if (NULL == report)
+            {
+                result = copyOrLinkFile(job.src, job.dest, job.modifiedTime);
+            }
+            else
+            {
+                Sha1Digest sourceDigest;
+                uint64_t sourceBytes = 0;
+                auto observer = [&sourceDigest, &sourceBytes](const unsigned char* data, size_t length) {
+                    sourceDigest.update(data, length);
+                    sourceBytes += length;
+                };
+                bool readable = false;
+                if (exporting && m_exportMethod == EXPORT_COPY)
+                {
+                    readable = copyFileInChunks(job.src, job.dest, VERIFY_CHUNK_SIZE, observer);
+                    result = readable;
+                    if (result && job.modifiedTime > 0)
+                    {
+                        updateFileTime(job.dest, job.modifiedTime);
+                    }
+                }
+                else
+                {
+                    // A linked file shares the data with the backup, so only the backup is read
+                    readable = readFile(job.src, VERIFY_CHUNK_SIZE, [&observer](const unsigned char* data, size_t length) {
+                        observer(data, length);
+                        return true;
+                    });
+                    result = !exporting || copyOrLinkFile(job.src, job.dest, job.modifiedTime);
+                }
+                hashedBytes += sourceBytes;
+                checkFile(job, readable, sourceDigest);
+            }
+            reportProgress();
+            if (!exporting)
+            {
+                continue;
+            }
+            if (!result)
+            {
+                ++failed;
+                continue;
+            }
+            ++copied;
+            bytes += job.size;
+        }
+        numberOfCopiedFiles += copied;
+        numberOfFailedFiles += failed;
+        numberOfSkippedFiles += skipped;
+        totalBytes += bytes;
+    };
+    
+    std::vector<std::thread> threads;
+    threads.reserve(jobs);
+    for (unsigned int idx = 0; idx < jobs; ++idx)
+    {
+        threads.emplace_back(worker);
+    }
+    
+    // Directories are created by the producer, their time is updated after all the files are copied
+    std::vector<std::pair<std::string, unsigned int>> dirs;
+    size_t numberOfFiles = 0;
+    ITunesFile file;
+    while (enumerator->nextFile(file))
+    {
+        if (NULL != cancelled && cancelled->load())
+        {
+            break;
+        }
+        
+        // The blob is only valid until the next row, decode it now
+        parseFileInfo(&file);
+        
+        std::string dest = (exporting || !outputPath.empty()) ? normalizePath(combinePath(outputPath, file.domain, file.relativePath)) : std::string();
+        if (file.isDir())
+        {
+            if (exporting)
+            {
+                if (directories.insert(dest).second && !existsDirectory(dest) && !makeDirectory(dest))
+                {
+                    ++numberOfFailures;
+                }
+                dirs.push_back(std::make_pair(dest, parseModifiedTime(&file)));
+            }
+            continue;
+        }
+        
+        std::string::size_type pos = exporting ? dest.find_last_of(DIR_SEP) : std::string::npos;
+        if (pos != std::string::npos)
+        {
+            std::string parent = dest.substr(0, pos);
+            if (directories.insert(parent).second && !existsDirectory(parent) && !makeDirectory(parent))
+            {
+                ++numberOfFailures;
+            }
+        }
+        
+        ExportJob job;
+        job.src = getRealPath(file);
+        job.dest.swap(dest);
+        job.modifiedTime = file.modifiedTime;
+        job.size = file.size;
+        if (NULL != report)
+        {
+            job.domain = file.domain;
+            job.relativePath = file.relativePath;
+            job.fileId = file.fileId;
+            if (NULL != file.digest && file.digestLength == Sha1Digest::DIGEST_LENGTH)
+            {
+                std::memcpy(job.digest, file.digest, Sha1Digest::DIGEST_LENGTH);
+                job.digestLength = file.digestLength;
+            }
+        }
+        ++numberOfFiles;
+        ++numberOfQueuedFiles;
+        queue.push(std::move(job));
+    }
+    
+    queue.close();
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
     {
-        return true;
+        it->join();
+    }
+    if (m_progressHandler)
+    {
+        m_progressHandler(numberOfProcessedFiles, numberOfFiles, true);
     }
     
-    file->blobParsed = true;
-    
-    uint64_t val = 0;
-    plist_t node = NULL;
-    plist_from_memory(reinterpret_cast<const char *>(&file->blob[0]), static_cast<uint32_t>(file->blob.size()), &node);
-    if (NULL != node)
+    for (std::vector<std::pair<std::string, unsigned int>>::const_iterator it = dirs.cbegin(); it != dirs.cend(); ++it)
     {
-        plist_t lastModifiedNode = plist_access_path(node, 3, "$objects", 1, "LastModified");
-        if (NULL != lastModifiedNode)
-        {
-            plist_get_uint_val(lastModifiedNode, &val);
-            file->modifiedTime = (unsigned int)val;
-        }
-        
-        plist_t sizeNode = plist_access_path(node, 3, "$objects", 1, "Size");
-        if (NULL != sizeNode)
+        if (it->second > 0)
         {
-            val = 0;
-            plist_get_uint_val(sizeNode, &val);
-            file->size = val;
+            updateFileTime(it->first, it->second);
         }
-        
-        plist_free(node);
-        return true;
     }
     
-    return false;
-}
-
-std::string ITunesDb::findFileId(const std::string& relativePath) const
-{
-    const ITunesFile* file = findITunesFile(relativePath);
-    
-    if (NULL == file)
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    numberOfFailures += numberOfFailedFiles.load();
+    if (NULL != stats)
     {
-        return std::string();
+        stats->numberOfFiles = numberOfCopiedFiles.load();
+        stats->numberOfDirectories = dirs.size();
+        stats->numberOfFailures = numberOfFailures;
+        stats->numberOfSkippedFiles = numberOfSkippedFiles.load();
+        stats->bytes = totalBytes.load();
+        stats->seconds = seconds;
+    }
+    if (NULL != report)
+    {
+        report->numberOfFiles = numberOfFiles - numberOfSkippedFiles.load();
+        report->numberOfMatches = numberOfMatches.load();
+        report->numberOfFilesWithoutDigest = numberOfFilesWithoutDigest.load();
+        report->bytes = hashedBytes.load();
+        report->seconds = seconds;
+        std::sort(report->issues.begin(), report->issues.end(), __verify_issue_less());
     }
-    return file->fileId;
-}
-
-const ITunesFile* ITunesDb::findITunesFile(const std::string& relativePath) const
-{
-    std::string formatedPath = relativePath;
-    std::replace(formatedPath.begin(), formatedPath.end(), '\\', '/');
-
-    typename std::vector<ITunesFile *>::iterator it = std::lower_bound(m_files.begin(), m_files.end(), formatedPath, __string_less());
     
-    if (it == m_files.end() || (*it)->relativePath != formatedPath)
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    if (exporting)
     {
-        return NULL;
+        printf("PERF: stream export %lu files (%lu unchanged) with %u jobs in %.3fs\r\n", numberOfCopiedFiles.load(), numberOfSkippedFiles.load(), jobs, seconds);
     }
-    return *it;
-}
-
-std::string ITunesDb::fileIdToRealPath(const std::string& fileId) const
-{
-    if (!fileId.empty())
+    else
     {
-        return m_isMbdb ? combinePath(m_rootPath, fileId) : combinePath(m_rootPath, fileId.substr(0, 2), fileId);
+        printf("PERF: verify %lu files with %u jobs in %.3fs\r\n", numberOfFiles, jobs, seconds);
     }
+#endif
     
-    return std::string();
-}
-
-std::string ITunesDb::getRealPath(const ITunesFile& file) const
-{
-    return fileIdToRealPath(file.fileId);
-}
-
-std::string ITunesDb::getRealPath(const ITunesFile* file) const
-{
-    return fileIdToRealPath(file->fileId);
-}
-
-std::string ITunesDb::findRealPath(const std::string& relativePath) const
-{
-    std::string fieldId = findFileId(relativePath);
-    return fileIdToRealPath(fieldId);
+    return numberOfFailures == 0 && (NULL == cancelled || !cancelled->load());
 }
 
-bool ITunesDb::copyFile(const std::string& vpath, const std::string& dest, bool overwrite/* = false*/) const
+// Decoded apps of the backups found by a ManifestParser, the same app (bundle id + iTunesMetadata) is usually in many backups
+// The metadata is compared byte by byte, so a hit is always the same app
+class AppInfoCache
 {
-    std::string destPath = normalizePath(dest);
-    if (!overwrite && existsFile(destPath))
-    {
-        return true;
-    }
-    
-    const ITunesFile* file = findITunesFile(vpath);
-    if (NULL != file)
+public:
+    bool find(const std::string& bundleId, const char* metadata, size_t length, BackupManifest::AppInfo& appInfo) const
     {
-        std::string srcPath = getRealPath(*file);
-        if (!srcPath.empty())
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::map<std::string, std::vector<Entry>>::const_iterator it = m_entries.find(bundleId);
+        if (it == m_entries.cend())
         {
-            normalizePath(srcPath);
-            bool result = ::copyFile(srcPath, destPath, true);
-            if (result)
+            return false;
+        }
+        for (std::vector<Entry>::const_iterator itEntry = it->second.cbegin(); itEntry != it->second.cend(); ++itEntry)
+        {
+            if (itEntry->metadata.size() == length && std::memcmp(itEntry->metadata.c_str(), metadata, length) == 0)
             {
-                updateFileTime(dest, ITunesDb::parseModifiedTime(file->blob));
+                appInfo = itEntry->appInfo;
+                return true;
             }
-            return result;
         }
+        return false;
     }
     
-    return false;
-}
+    void add(const std::string& bundleId, const char* metadata, size_t length, const BackupManifest::AppInfo& appInfo)
+    {
+        Entry entry;
+        entry.metadata.assign(metadata, length);
+        entry.appInfo = appInfo;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries[bundleId].push_back(std::move(entry));
+    }
+    
+private:
+    struct Entry
+    {
+        std::string metadata;
+        BackupManifest::AppInfo appInfo;
+    };
+    
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::vector<Entry>> m_entries;
+};
 
-bool ITunesDb::copyFile(const std::string& vpath, const std::string& destPath, const std::string& destFileName, bool overwrite/* = false*/) const
+const std::vector<BackupManifest::AppInfo>& BackupManifest::getApps() const
 {
-    std::string destFullPath = normalizePath(combinePath(destPath, destFileName));
-    if (!overwrite && existsFile(destFullPath))
+    std::lock_guard<std::mutex> lock(m_apps->mutex);
+    if (!m_apps->loaded)
     {
-        return true;
+        m_apps->loaded = true;
+        m_apps->failed = !ManifestParser::parseApps(m_apps->backupPath, m_apps->apps, m_apps->appCache.get());
+        m_apps->appCache.reset();
     }
-    
-    const ITunesFile* file = findITunesFile(vpath);
-    if (NULL != file)
+    return m_apps->apps;
+}
+
+ManifestParser::ManifestParser(const std::string& manifestPath, bool incudingApps) : m_manifestPath(manifestPath), m_incudingApps(incudingApps), m_appCache(std::make_shared<AppInfoCache>()), m_jobs(0)
+{
+}
+
+void ManifestParser::setCachePath(const std::string& cachePath)
+{
+    if (cachePath.empty())
     {
-        std::string srcPath = getRealPath(*file);
-        if (!srcPath.empty())
-        {
-            normalizePath(srcPath);
-            if (!existsDirectory(destPath))
-            {
-                makeDirectory(destPath);
-            }
-            bool result = ::copyFile(srcPath, destFullPath, true);
-            if (result)
-            {
-                if (file->modifiedTime != 0)
-                {
-                    updateFileTime(destFullPath, static_cast<time_t>(file->modifiedTime));
-                }
-                else if (!file->blob.empty())
-                {
-                    updateFileTime(destFullPath, ITunesDb::parseModifiedTime(file->blob));
-                }
-            }
-            return result;
-        }
+        m_cache.reset();
+        return;
     }
-    
-    return false;
+    m_cache = std::make_shared<ManifestCache>(cachePath);
+    m_cache->load();
 }
 
-ManifestParser::ManifestParser(const std::string& manifestPath, bool incudingApps) : m_manifestPath(manifestPath), m_incudingApps(incudingApps)
+bool ManifestParser::saveCache() const
 {
+    return !m_cache || m_cache->save();
 }
 
 std::string ManifestParser::getLastError() const
@@ -1068,6 +2534,11 @@ std::string ManifestParser::getLastError() const
 }
 
 bool ManifestParser::parse(std::vector<BackupManifest>& manifests) const
+{
+    return parse(manifests, std::function<void(const BackupManifest&)>());
+}
+
+bool ManifestParser::parse(std::vector<BackupManifest>& manifests, const std::function<void(const BackupManifest&)>& handler) const
 {
     bool res = false;
     
@@ -1075,7 +2546,7 @@ bool ManifestParser::parse(std::vector<BackupManifest>& manifests) const
     if (endsWith(path, normalizePath("/MobileSync")) || endsWith(path, normalizePath("/MobileSync/")) || isValidMobileSync(path))
     {
         path = combinePath(path, "Backup");
-        res = parseDirectory(path, manifests);
+        res = parseDirectory(path, manifests, handler);
     }
     else if (isValidBackupItem(path))
     {
@@ -1083,19 +2554,28 @@ bool ManifestParser::parse(std::vector<BackupManifest>& manifests) const
         if (parse(path, manifest) && manifest.isValid())
         {
             manifests.push_back(manifest);
+            if (handler)
+            {
+                handler(manifests.back());
+            }
             res = true;
         }
     }
     else
     {
         // Assume the directory is ../../Backup/../
-        res = parseDirectory(path, manifests);
+        res = parseDirectory(path, manifests, handler);
+    }
+    
+    if (m_cache)
+    {
+        m_cache->save();
     }
     
     return res;
 }
 
-bool ManifestParser::parseDirectory(const std::string& path, std::vector<BackupManifest>& manifests) const
+bool ManifestParser::parseDirectory(const std::string& path, std::vector<BackupManifest>& manifests, const std::function<void(const BackupManifest&)>& handler) const
 {
     std::vector<std::string> subDirectories;
     if (!listSubDirectories(path, subDirectories))
@@ -1106,20 +2586,74 @@ bool ManifestParser::parseDirectory(const std::string& path, std::vector<BackupM
         return false;
     }
     
+    // The backups are checked and parsed by a pool of threads as it is mostly waiting for the disk,
+    // the results are kept in the slots of the subdirectories to preserve the order
+    enum { PARSING_PENDING = 0, PARSING_VALID, PARSING_INVALID };
+    size_t numberOfItems = subDirectories.size();
+    std::vector<BackupManifest> results(numberOfItems);
+    std::vector<std::string> errors(numberOfItems);
+    std::vector<int> states(numberOfItems, PARSING_PENDING);
+    std::atomic<size_t> nextItem(0);
+    size_t nextOutput = 0;
+    std::mutex mutex;
+    
+    auto worker = [&]() {
+        size_t idx = 0;
+        while ((idx = nextItem.fetch_add(1)) < numberOfItems)
+        {
+            std::string backupPath = combinePath(path, subDirectories[idx]);
+            BackupManifest& manifest = results[idx];
+            bool valid = false;
+            if (isValidBackupItem(backupPath, errors[idx]))
+            {
+                manifest.setBackupId(subDirectories[idx]);
+                valid = parse(backupPath, manifest, errors[idx]) && manifest.isValid();
+            }
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            states[idx] = valid ? PARSING_VALID : PARSING_INVALID;
+            // Output the finished backups which have no pending ones before them
+            for (; nextOutput < numberOfItems && states[nextOutput] != PARSING_PENDING; ++nextOutput)
+            {
+                if (states[nextOutput] == PARSING_VALID && handler)
+                {
+                    handler(results[nextOutput]);
+                }
+            }
+        }
+    };
+    
+    unsigned int jobs = m_jobs;
+    if (0 == jobs)
+    {
+        jobs = std::max(4u, std::thread::hardware_concurrency());
+    }
+    jobs = static_cast<unsigned int>(std::min(static_cast<size_t>(jobs), numberOfItems));
+    if (jobs <= 1)
+    {
+        worker();
+    }
+    else
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(jobs);
+        for (unsigned int idx = 0; idx < jobs; ++idx)
+        {
+            threads.emplace_back(worker);
+        }
+        for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+        {
+            it->join();
+        }
+    }
+    
     bool res = false;
-    for (std::vector<std::string>::const_iterator it = subDirectories.cbegin(); it != subDirectories.cend(); ++it)
+    for (size_t idx = 0; idx < numberOfItems; ++idx)
     {
-        std::string backupPath = combinePath(path, *it);
-		if (!isValidBackupItem(backupPath))
-		{
-			continue;
-		}
-        
-        BackupManifest manifest;
-        manifest.setBackupId(*it);
-        if (parse(backupPath, manifest) && manifest.isValid())
+        m_lastError += errors[idx];
+        if (states[idx] == PARSING_VALID)
         {
-            manifests.push_back(manifest);
+            manifests.push_back(results[idx]);
             res = true;
         }
     }
@@ -1133,18 +2667,23 @@ bool ManifestParser::parseDirectory(const std::string& path, std::vector<BackupM
 }
 
 bool ManifestParser::isValidBackupItem(const std::string& path) const
+{
+    return isValidBackupItem(path, m_lastError);
+}
+
+bool ManifestParser::isValidBackupItem(const std::string& path, std::string& error) const
 {
     std::string fileName = combinePath(path, "Info.plist");
     if (!existsFile(fileName))
     {
-        m_lastError += "Info.plist not found\r\n";
+        error += "Info.plist not found\r\n";
         return false;
     }
 
     fileName = combinePath(path, "Manifest.plist");
     if (!existsFile(fileName))
     {
-        m_lastError += "Manifest.plist not found\r\n";
+        error += "Manifest.plist not found\r\n";
         return false;
     }
 
@@ -1152,7 +2691,7 @@ bool ManifestParser::isValidBackupItem(const std::string& path) const
     // >= iOS 10: Manifest.db
     if (!existsFile(combinePath(path, "Manifest.db")) && !existsFile(combinePath(path, "Manifest.mbdb")))
     {
-        m_lastError += "Manifest.db/Manifest.mbdb not found\r\n";
+        error += "Manifest.db/Manifest.mbdb not found\r\n";
         return false;
     }
     
@@ -1172,11 +2711,42 @@ bool ManifestParser::isValidMobileSync(const std::string& path) const
 }
 
 bool ManifestParser::parse(const std::string& path, BackupManifest& manifest) const
+{
+    return parse(path, manifest, m_lastError);
+}
+
+bool ManifestParser::parse(const std::string& path, BackupManifest& manifest, std::string& error) const
+{
+    if (m_cache)
+    {
+        std::string backupId = manifest.getBackupId();
+        if (m_cache->find(path, m_incudingApps, manifest))
+        {
+            manifest.setBackupId(backupId);
+            manifest.setAppInfoCache(m_appCache);
+            return true;
+        }
+    }
+    
+    if (!parseImpl(path, manifest, error))
+    {
+        return false;
+    }
+    manifest.setAppInfoCache(m_appCache);
+    
+    if (m_cache)
+    {
+        m_cache->update(path, m_incudingApps, manifest);
+    }
+    return true;
+}
+
+bool ManifestParser::parseImpl(const std::string& path, BackupManifest& manifest, std::string& error) const
 {
     //Info.plist is a xml file
     if (!parseInfoPlist(path, manifest, m_incudingApps))
     {
-		m_lastError += "Failed to parse xml: Info.plist\r\n";
+		error += "Failed to parse xml: Info.plist\r\n";
         return false;
     }
     
@@ -1207,7 +2777,7 @@ bool ManifestParser::parse(const std::string& path, BackupManifest& manifest) co
     }
 	else
 	{
-		m_lastError = "Failed to read Manifest.plist\r\n";
+		error += "Failed to read Manifest.plist\r\n";
 		return false;
 	}
 
@@ -1217,6 +2787,32 @@ bool ManifestParser::parse(const std::string& path, BackupManifest& manifest) co
 bool ManifestParser::parseInfoPlist(const std::string& backupIdPath, BackupManifest& manifest, bool includingApps)
 {
     std::string fileName = combinePath(backupIdPath, "Info.plist");
+    
+    // Only the header keys are needed, scan them instead of building the tree of the whole file
+    std::vector<std::string> keys = {"Last Backup Date", "Display Name", "Device Name", "iTunes Version", "macOS Version", "Product Version"};
+    std::map<std::string, PlistScanner::Value> values;
+    if (PlistScanner::scanFile(fileName, keys, values))
+    {
+        manifest.setPath(backupIdPath);
+        manifest.setDeviceName(values["Device Name"].str);
+        manifest.setDisplayName(values["Display Name"].str);
+        const PlistScanner::Value& backupDate = values["Last Backup Date"];
+        if (backupDate.type == PlistScanner::Value::VALUE_DATE)
+        {
+            manifest.setBackupTime(fromUnixTime(static_cast<unsigned int>(static_cast<int64_t>(backupDate.real) + 978278400)));
+        }
+        manifest.setITunesVersion(values["iTunes Version"].str);
+        manifest.setIOSVersion(values["Product Version"].str);
+        manifest.setMacOSVersion(values["macOS Version"].str);
+        
+        if (includingApps)
+        {
+            // The apps are decoded by the first BackupManifest::getApps()
+            manifest.setAppsSource(backupIdPath);
+        }
+        return true;
+    }
+    
     std::string contents = readFile(fileName);
     plist_t node = NULL;
     plist_from_memory(contents.c_str(), static_cast<uint32_t>(contents.size()), &node);
@@ -1227,17 +2823,12 @@ bool ManifestParser::parseInfoPlist(const std::string& backupIdPath, BackupManif
     
     manifest.setPath(backupIdPath);
     
-    const char* ptr = NULL;
-    uint64_t length = 0;
-    std::string val;
-
     const char* ValueLastBackupDate = "Last Backup Date";
     const char* ValueDisplayName = "Display Name";
     const char* ValueDeviceName = "Device Name";
     const char* ValueITunesVersion = "iTunes Version";
     const char* ValueMacOSVersion = "macOS Version";
     const char* ValueProductVersion = "Product Version";
-    const char* ValueInstalledApps = "Installed Applications";
     
     plist_t subNode = NULL;
     
@@ -1258,64 +2849,84 @@ bool ManifestParser::parseInfoPlist(const std::string& backupIdPath, BackupManif
     
     if (includingApps)
     {
-        subNode = plist_dict_get_item(node, ValueInstalledApps);
-        if (NULL != subNode && PLIST_IS_ARRAY(subNode))
+        // The apps are decoded by the first BackupManifest::getApps()
+        manifest.setAppsSource(backupIdPath);
+    }
+    
+    plist_free(node);
+
+    return true;
+}
+
+bool ManifestParser::parseApps(const std::string& backupIdPath, std::vector<BackupManifest::AppInfo>& apps, AppInfoCache* appCache/* = NULL*/)
+{
+    std::string fileName = combinePath(backupIdPath, "Info.plist");
+    std::string contents = readFile(fileName);
+    plist_t node = NULL;
+    plist_from_memory(contents.c_str(), static_cast<uint32_t>(contents.size()), &node);
+    if (NULL == node)
+    {
+        return false;
+    }
+    
+    const char* ValueInstalledApps = "Installed Applications";
+    plist_t subNode = plist_dict_get_item(node, ValueInstalledApps);
+    if (NULL != subNode && PLIST_IS_ARRAY(subNode))
+    {
+        uint32_t arraySize = plist_array_get_size(subNode);
+        plist_t itemNode = NULL;
+        for (uint32_t idx = 0; idx < arraySize; ++idx)
         {
-            uint32_t arraySize = plist_array_get_size(subNode);
-            plist_t itemNode = NULL;
-            for (uint32_t idx = 0; idx < arraySize; ++idx)
+            itemNode = plist_array_get_item(subNode, idx);
+            if (itemNode == NULL)
+            {
+                continue;
+            }
+            std::string bundleId = getPlistStringValue(itemNode);
+            if (bundleId.empty())
+            {
+                continue;
+            }
+            
+            plist_t appNode = plist_access_path(node, 2, "Applications", bundleId.c_str());
+            plist_t appSubNode = (NULL != appNode) ? plist_dict_get_item(appNode, "iTunesMetadata") : NULL;
+            if (NULL == appSubNode)
+            {
+                continue;
+            }
+            
+            uint64_t length = 0;
+            const char* ptr = plist_get_data_ptr(appSubNode, &length);
+            if (ptr == NULL || length == 0)
+            {
+                continue;
+            }
+            
+            BackupManifest::AppInfo appInfo;
+            if (NULL != appCache && appCache->find(bundleId, ptr, static_cast<size_t>(length), appInfo))
+            {
+                apps.push_back(appInfo);
+                continue;
+            }
+            
+            appInfo.bundleId = bundleId;
+            if (!parseITunesMetadata(ptr, length, appInfo))
             {
-                itemNode = plist_array_get_item(subNode, idx);
-                if (itemNode == NULL)
-                {
-                    continue;
-                }
-                std::string bundleId = getPlistStringValue(itemNode);
-#ifndef NDEBUG
-                if (bundleId == "hk.itools.apper")
-                {
-                    int aa = 0;
-                }
-#endif
-                if (!bundleId.empty())
-                {
-                    plist_t appNode = plist_access_path(node, 2, "Applications", bundleId.c_str());
-                    
-                    if (NULL != appNode)
-                    {
-                        plist_t appSubNode = NULL;
-                        
-                        appSubNode = plist_dict_get_item(appNode, "iTunesMetadata");
-                        if (NULL != appSubNode)
-                        {
-                            plist_type ptype = plist_get_node_type(appSubNode);
-                            ptr = plist_get_data_ptr(appSubNode, &length);
-                            if (ptr != NULL && length > 0)
-                            {
-                                // std::string metadata(ptr, length);
-                                BackupManifest::AppInfo appInfo;
-                                appInfo.bundleId = bundleId;
-								if (!parseITunesMetadata(ptr, length, appInfo))
-								{
 #ifndef NDEBUG
-									writeFile("Z:\\Documents\\WxExp\\dbg\\" + bundleId + ".plist", (const unsigned char *)ptr, length);
+                writeFile("Z:\\Documents\\WxExp\\dbg\\" + bundleId + ".plist", (const unsigned char *)ptr, length);
 #endif
-								}
-                                manifest.addApp(appInfo);
-                            }
-                            
-                        }
-                        
-                    }
-                }
-                
             }
-        
+            else if (NULL != appCache)
+            {
+                // Failures are not cached, the next backup tries again
+                appCache->add(bundleId, ptr, static_cast<size_t>(length), appInfo);
+            }
+            apps.push_back(appInfo);
         }
     }
     
     plist_free(node);
-
+    
     return true;
 }
 
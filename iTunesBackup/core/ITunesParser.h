@@ -9,26 +9,45 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #include <sstream>
 #include <iomanip>
 #include <ctime>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include "Utils.h"
+#include "Arena.h"
 
 #ifndef ITunesParser_h
 #define ITunesParser_h
 
+class ManifestCache;
+class AppInfoCache;
+
+// The strings and the blob are owned by the ITunesDb (or the enumerator) which produces the file
 struct ITunesFile
 {
-    std::string fileId;
-    std::string relativePath;
+    const char* fileId;
+    const char* domain;     // Empty unless the domain was requested in ITunesDb::load
+    const char* relativePath;
     unsigned int flags;
-    std::vector<unsigned char> blob;
+    const unsigned char* blob;
+    unsigned int blobLength;
+    // Decoded from the blob by ITunesDb::parseFileInfo
     mutable unsigned int modifiedTime;
     mutable size_t size;
+    mutable unsigned int birthTime;
+    mutable unsigned int mode;
+    mutable unsigned int fileFlags;
+    // SHA-1 of the content recorded by the backup (DataHash of Manifest.mbdb, Digest of the blob), NULL if there is none
+    mutable const unsigned char* digest;
+    mutable unsigned int digestLength;
     mutable bool blobParsed;
     
-    ITunesFile() : flags(0), modifiedTime(0), size(0), blobParsed(false)
+    ITunesFile() : fileId(""), domain(""), relativePath(""), flags(0), blob(NULL), blobLength(0), modifiedTime(0), size(0), birthTime(0), mode(0), fileFlags(0), digest(NULL), digestLength(0), blobParsed(false)
     {
     }
     
@@ -66,14 +85,31 @@ protected:
     std::string m_iOSVersion;
 	bool m_encrypted;
     
-    std::vector<AppInfo> m_apps;    // Installed Applications
+    // Installed Applications, decoded from Info.plist by the first getApps()
+    // It is shared by the copies of the manifest, so the apps are decoded once
+    struct AppList
+    {
+        std::mutex mutex;
+        bool loaded;
+        bool failed;                // Info.plist couldn't be decoded, the apps are not cached
+        std::string backupPath;     // Where Info.plist is
+        std::vector<AppInfo> apps;
+        std::shared_ptr<AppInfoCache> appCache;     // Apps decoded from the other backups of the parser, may be NULL
+        
+        AppList() : loaded(true), failed(false)
+        {
+        }
+    };
+    std::shared_ptr<AppList> m_apps;
+    
+    friend class ManifestCache;
     
 public:
-    BackupManifest() : m_encrypted(false)
+    BackupManifest() : m_encrypted(false), m_apps(std::make_shared<AppList>())
     {
     }
 
-	BackupManifest(const std::string& path, const std::string& deviceName, const std::string& displayName, const std::string& backupTime) : m_path(path), m_deviceName(deviceName), m_displayName(displayName), m_encrypted(false)
+	BackupManifest(const std::string& path, const std::string& deviceName, const std::string& displayName, const std::string& backupTime) : m_path(path), m_deviceName(deviceName), m_displayName(displayName), m_encrypted(false), m_apps(std::make_shared<AppList>())
 	{
 	}
     
@@ -143,13 +179,29 @@ public:
     
     void addApp(const AppInfo& appInfo)
     {
-        m_apps.push_back(appInfo);
+        std::lock_guard<std::mutex> lock(m_apps->mutex);
+        m_apps->apps.push_back(appInfo);
+    }
+    
+    // Let getApps() decode the apps from Info.plist in the backup path when it is called
+    void setAppsSource(const std::string& backupPath)
+    {
+        m_apps = std::make_shared<AppList>();
+        m_apps->loaded = false;
+        m_apps->backupPath = backupPath;
+    }
+    
+    // Let getApps() reuse the apps decoded from other backups (if they are not decoded yet)
+    void setAppInfoCache(const std::shared_ptr<AppInfoCache>& appCache)
+    {
+        std::lock_guard<std::mutex> lock(m_apps->mutex);
+        if (!m_apps->loaded)
+        {
+            m_apps->appCache = appCache;
+        }
     }
 
-	const std::vector<AppInfo>& getApps() const
-	{
-		return m_apps;
-	}
+	const std::vector<AppInfo>& getApps() const;
     
 	bool isEncrypted() const
 	{
@@ -180,6 +232,21 @@ public:
     {
         return m_backupId;
     }
+    
+    std::string getDeviceName() const
+    {
+        return m_deviceName;
+    }
+    
+    std::string getDisplayName() const
+    {
+        return m_displayName;
+    }
+    
+    std::string getBackupTime() const
+    {
+        return m_backupTime;
+    }
 };
 
 class ITunesDb
@@ -195,6 +262,69 @@ public:
         virtual ~ITunesFileEnumerator() {}
     };
     
+    struct ExportStats
+    {
+        size_t numberOfFiles;
+        size_t numberOfDirectories;
+        size_t numberOfFailures;
+        size_t numberOfSkippedFiles;    // Unchanged files of the incremental export, not counted in numberOfFiles
+        uint64_t bytes;
+        double seconds;
+        
+        ExportStats() : numberOfFiles(0), numberOfDirectories(0), numberOfFailures(0), numberOfSkippedFiles(0), bytes(0), seconds(0.0)
+        {
+        }
+        
+        double getFilesPerSecond() const
+        {
+            return seconds > 0.0 ? numberOfFiles / seconds : 0.0;
+        }
+        
+        double getBytesPerSecond() const
+        {
+            return seconds > 0.0 ? bytes / seconds : 0.0;
+        }
+    };
+    
+    enum VerifyStatus
+    {
+        VERIFY_OK = 0,
+        VERIFY_NO_DIGEST,           // The backup has no digest of the file (e.g. iOS 10+), it can only be compared with the output
+        VERIFY_DIGEST_MISMATCH,     // The file in the backup doesn't match the digest recorded by the backup
+        VERIFY_OUTPUT_MISMATCH,     // The exported file differs from the file in the backup
+        VERIFY_READ_ERROR,          // The file in the backup or the exported file can't be read
+    };
+    
+    struct VerifyIssue
+    {
+        VerifyStatus status;
+        std::string domain;
+        std::string relativePath;
+        std::string fileId;
+        // Hex SHA-1, expected is the digest of the backup (or of the file in the backup for VERIFY_OUTPUT_MISMATCH)
+        std::string expectedDigest;
+        std::string actualDigest;
+        
+        VerifyIssue() : status(VERIFY_OK)
+        {
+        }
+    };
+    
+    // The files without digest are counted but not reported unless their output differs
+    struct VerifyReport
+    {
+        size_t numberOfFiles;
+        size_t numberOfMatches;
+        size_t numberOfFilesWithoutDigest;
+        uint64_t bytes;
+        double seconds;
+        std::vector<VerifyIssue> issues;    // Sorted by domain and relativePath
+        
+        VerifyReport() : numberOfFiles(0), numberOfMatches(0), numberOfFilesWithoutDigest(0), bytes(0), seconds(0.0)
+        {
+        }
+    };
+    
     ITunesDb(const std::string& rootPath, const std::string& manifestFileName);
     ~ITunesDb();
     
@@ -208,50 +338,167 @@ public:
         return m_iOSVersion;
     }
     
+    // Columns/fields of the files kept in memory by load
+    enum LoadingMode
+    {
+        LOADING_PATH_ONLY = 0,  // fileId, relativePath and flags, the blob is not even read
+        LOADING_METADATA,       // modifiedTime/size/... are decoded while loading, the blob is dropped
+        LOADING_BLOB,           // The raw blob is kept (default)
+    };
+    
     void setLoadingFilter(std::function<bool(const char *, int flags)> loadingFilter)
     {
         m_loadingFilter = std::move(loadingFilter);
     }
     
+    void setLoadingMode(LoadingMode loadingMode)
+    {
+        m_loadingMode = loadingMode;
+    }
+    
+    // Hash tables of the relative paths (and of domain + relative path) built by load, so findITunesFile is a probe
+    // of the table without copying the path instead of a binary search. Each table takes 32 to 64 bytes per file. Off by default
+    void setPathIndexEnabled(bool enabled)
+    {
+        m_pathIndexEnabled = enabled;
+    }
+    
+    // Sidecar index of Manifest.mbdb (domain -> record offsets), it is built by the first load of a domain
+    // and lets the later loads read the records of the domains only. Empty path (default) disables it
+    void setMbdbIndexPath(const std::string& indexPath)
+    {
+        m_mbdbIndexPath = indexPath;
+    }
+    
+    // Skip the files whose destination has the size and modified time of the file in the backup,
+    // i.e. it was exported by a previous run and hasn't changed since, so a re-export costs a stat per unchanged file
+    // Skipped files are not hashed by the verification of exportStreaming either
+    // With EXPORT_LINK, a hard link of a previous run has the time of the backup file, it is unchanged while it is still the same file
+    void setIncrementalExport(bool incremental)
+    {
+        m_incrementalExport = incremental;
+    }
+    
+    enum ExportMethod
+    {
+        EXPORT_COPY = 0,
+        // Clone or hard link the files of the backup (they are never modified) by linkFile, so an export
+        // to the volume of the backup takes no space. Other volumes fall back to a copy.
+        // The modified time of a hard link is shared with the backup, so it isn't updated
+        EXPORT_LINK,
+    };
+    
+    // Used by copyFile, exportFiles and exportStreaming
+    void setExportMethod(ExportMethod exportMethod)
+    {
+        m_exportMethod = exportMethod;
+    }
+    
+    // Progress of copy, exportStreaming and verify: numberOfFiles is the count of the files queued so far by the manifest reader,
+    // it is final when done is true. numberOfProcessedFiles includes the failed (and skipped) files.
+    // Called from the worker threads (never concurrently) every PROGRESS_INTERVAL files and once at the end
+    typedef std::function<void(size_t numberOfProcessedFiles, size_t numberOfFiles, bool done)> ProgressHandler;
+    
+    void setProgressHandler(ProgressHandler progressHandler)
+    {
+        m_progressHandler = std::move(progressHandler);
+    }
+    
     bool load();
     bool load(const std::string& domain);
     bool load(const std::string& domain, bool onlyFile);
+    // Load all the domains in one pass, files of each domain can be accessed via getFiles/enumFiles(domain, ...)
+    bool load(const std::vector<std::string>& domains, bool onlyFile);
     
+    // Caller owns the enumerator, the file returned by nextFile is only valid until the next call
     ITunesFileEnumerator* buildEnumerator(const std::string& domain, bool onlyFile);
+    ITunesFileEnumerator* buildEnumerator(const std::vector<std::string>& domains, bool onlyFile);
 
-    bool copy(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains) const;
+    // Create a backup with the apps (bundle ids) of domains only: their AppDomain-, AppDomainGroup-group. and AppDomainPlugin- domains.
+    // An empty domains copies the whole backup. The files are copied by jobs threads (0: one per core)
+    bool copy(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains, unsigned int jobs = 0) const;
     
     const ITunesFile* findITunesFile(const std::string& relativePath) const;
+    const ITunesFile* findITunesFile(const std::string& domain, const std::string& relativePath) const;
     std::string findFileId(const std::string& relativePath) const;
     std::string findRealPath(const std::string& relativePath) const;
     template<class TFilter>
     ITunesFileVector filter(TFilter f) const;
     template<class THandler>
     void enumFiles(THandler handler) const;
+    template<class THandler>
+    void enumFiles(const std::string& domain, THandler handler) const;
+    ITunesFileRange getFiles() const;
+    ITunesFileRange getFiles(const std::string& domain) const;
+    
+    // Copy the files to outputPath/relativePath with a pool of jobs threads (0: number of cores)
+    // Directories are created up front, so the result is the same as exporting with enumFiles
+    bool exportFiles(const ITunesFileRange& range, const std::string& outputPath, unsigned int jobs, ExportStats* stats = NULL, const std::atomic_bool* cancelled = NULL) const;
+    // Copy the files of the domains to outputPath/domain/relativePath straight from the manifest without load()
+    // Rows are read by an enumerator and handed to the copy threads through a bounded queue, so memory doesn't grow with the backup
+    // With a report, the files are copied through user space and hashed on the way (each byte is read once) and checked as verify does
+    bool exportStreaming(const std::vector<std::string>& domains, const std::string& outputPath, unsigned int jobs, ExportStats* stats = NULL, const std::atomic_bool* cancelled = NULL, VerifyReport* report = NULL);
+    // Hash the files of the domains with jobs threads and check them with the digests recorded in the backup
+    // If outputPath isn't empty, the files exported there by exportStreaming are hashed too and compared with the backup
+    // Returns false if the manifest can't be read, the result of the check is in the report
+    bool verify(const std::vector<std::string>& domains, const std::string& outputPath, unsigned int jobs, VerifyReport& report, const std::atomic_bool* cancelled = NULL);
     
     std::string getRealPath(const ITunesFile& file) const;
     std::string getRealPath(const ITunesFile* file) const;
     
     static unsigned int parseModifiedTime(const std::vector<unsigned char>& data);
+    static unsigned int parseModifiedTime(const unsigned char* data, size_t length);
+    static unsigned int parseModifiedTime(const ITunesFile* file);
     static bool parseFileInfo(const ITunesFile* file);
+    static bool parseFileInfo(const ITunesFile* file, const unsigned char* blob, size_t blobLength);
     bool copyFile(const std::string& vpath, const std::string& dest, bool overwrite = false) const;
     bool copyFile(const std::string& vpath, const std::string& destPath, const std::string& destFileName, bool overwrite = false) const;
 #ifndef NDEBUG
     std::string getLastError() const { return m_lastError; }
 #endif
 protected:
-    bool loadMbdb(const std::string& domain, bool onlyFile);
-    bool copyMbdb(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains) const;
+    bool loadMbdb(bool onlyFile);
+    void buildFileIndex();
+    void buildPathIndex();
+    int findDomainIndex(const char* domain) const;
+    bool copyMbdb(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains, unsigned int jobs) const;
     std::string fileIdToRealPath(const std::string& fileId) const;
+    bool exportFile(const ITunesFile* file, const std::string& outputPath, uint64_t& bytes, bool& skipped) const;
+    bool copyOrLinkFile(const std::string& src, const std::string& dest, unsigned int modifiedTime) const;
+    bool streamFiles(const std::vector<std::string>& domains, const std::string& outputPath, bool exporting, unsigned int jobs, ExportStats* stats, VerifyReport* report, const std::atomic_bool* cancelled);
     
 protected:
+    // Slot of the open addressing (linear probing) tables of the paths, file is NULL for an empty slot
+    struct PathIndexSlot
+    {
+        uint64_t hash;
+        const ITunesFile* file;
+    };
+    
     bool m_isMbdb;
+    // All files are stored by value in m_fileSlab and their strings/blobs in m_arena,
+    // m_files is the sorted view used for lookups
+    std::vector<ITunesFile> m_fileSlab;
+    Arena m_arena;
     mutable std::vector<ITunesFile *> m_files;
+    // Sorted domains passed to load and the files of each of them (sorted by relativePath)
+    std::vector<std::string> m_domains;
+    std::vector<const char *> m_domainNames;
+    std::vector<ITunesFileVector> m_domainFiles;
+    // Power of 2 sizes, empty unless the path index is enabled
+    std::vector<PathIndexSlot> m_pathIndex;
+    std::vector<PathIndexSlot> m_domainPathIndex;
     std::string m_rootPath;
     std::string m_manifestFileName;
     std::string m_version;
     std::string m_iOSVersion;
     std::function<bool(const char *, int flags)> m_loadingFilter;
+    LoadingMode m_loadingMode;
+    bool m_pathIndexEnabled;
+    std::string m_mbdbIndexPath;
+    bool m_incrementalExport;
+    ExportMethod m_exportMethod;
+    ProgressHandler m_progressHandler;
     
 #ifndef NDEBUG
     mutable std::string m_lastError;
@@ -289,24 +536,59 @@ void ITunesDb::enumFiles(THandler handler) const
     }
 }
 
+template<class THandler>
+void ITunesDb::enumFiles(const std::string& domain, THandler handler) const
+{
+    ITunesFileRange range = getFiles(domain);
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        if (!handler(this, *it))
+        {
+            break;
+        }
+    }
+}
+
 class ManifestParser
 {
 protected:
     std::string m_manifestPath;
     bool m_incudingApps;
 	mutable std::string m_lastError;
+    std::shared_ptr<ManifestCache> m_cache;
+    // Shared by the manifests found by the parser, so the apps in many backups are decoded once
+    std::shared_ptr<AppInfoCache> m_appCache;
+    unsigned int m_jobs;
 
 public:
     ManifestParser(const std::string& manifestPath, bool includingApps);
+    // Keep the parsed backups in the file and reuse them until their plists change
+    void setCachePath(const std::string& cachePath);
+    // parse() saves the cache, call it again once getApps() of the manifests decoded their apps, so they are cached too
+    bool saveCache() const;
+    // Number of threads to parse the backups of a folder (0: default)
+    void setJobs(unsigned int jobs)
+    {
+        m_jobs = jobs;
+    }
     bool parse(std::vector<BackupManifest>& manifets) const;
+    // The handler is called with each valid backup as soon as it and the backups before it are parsed,
+    // in the same order as manifests. Calls are serialized but may come from the worker threads
+    bool parse(std::vector<BackupManifest>& manifets, const std::function<void(const BackupManifest&)>& handler) const;
+    // Decode the installed apps listed in Info.plist of the backup
+    static bool parseApps(const std::string& backupIdPath, std::vector<BackupManifest::AppInfo>& apps, AppInfoCache* appCache = NULL);
 	std::string getLastError() const;
 
     friend ITunesDb;
     
 protected:
-    bool parseDirectory(const std::string& path, std::vector<BackupManifest>& manifests) const;
+    bool parseDirectory(const std::string& path, std::vector<BackupManifest>& manifests, const std::function<void(const BackupManifest&)>& handler) const;
     bool parse(const std::string& path, BackupManifest& manifest) const;
+    // Thread-safe versions, the error is appended to the string instead of m_lastError
+    bool parse(const std::string& path, BackupManifest& manifest, std::string& error) const;
+    bool parseImpl(const std::string& path, BackupManifest& manifest, std::string& error) const;
 	bool isValidBackupItem(const std::string& path) const;
+	bool isValidBackupItem(const std::string& path, std::string& error) const;
     bool isValidMobileSync(const std::string& path) const;
     
     static bool parseInfoPlist(const std::string& backupIdPath, BackupManifest& manifest, bool includingApps);
@@ -0,0 +1,320 @@
+//
+//  ManifestCache.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "ManifestCache.h"
+#include <cstring>
+#include "FileSystem.h"
+
+// Bump it when the layout of the file changes, the old files are ignored then
+#define MANIFEST_CACHE_VERSION  1
+
+class CacheWriter
+{
+public:
+    void write(uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            m_data.push_back(static_cast<unsigned char>((value >> shift) & 0xFF));
+        }
+    }
+
+    void write(uint64_t value)
+    {
+        write(static_cast<uint32_t>(value >> 32));
+        write(static_cast<uint32_t>(value & 0xFFFFFFFF));
+    }
+
+    void write(const std::string& value)
+    {
+        write(static_cast<uint32_t>(value.size()));
+        m_data.insert(m_data.end(), value.cbegin(), value.cend());
+    }
+
+    const std::vector<unsigned char>& getData() const
+    {
+        return m_data;
+    }
+
+private:
+    std::vector<unsigned char> m_data;
+};
+
+// All the reads are bounds-checked, it fails once the data is exhausted
+class CacheReader
+{
+public:
+    CacheReader(const std::vector<unsigned char>& data) : m_data(data), m_pos(0), m_failed(false)
+    {
+    }
+
+    bool read(uint32_t& value)
+    {
+        if (m_failed || m_data.size() - m_pos < 4)
+        {
+            m_failed = true;
+            return false;
+        }
+        value = (static_cast<uint32_t>(m_data[m_pos]) << 24) | (static_cast<uint32_t>(m_data[m_pos + 1]) << 16) | (static_cast<uint32_t>(m_data[m_pos + 2]) << 8) | m_data[m_pos + 3];
+        m_pos += 4;
+        return true;
+    }
+
+    bool read(uint64_t& value)
+    {
+        uint32_t high = 0;
+        uint32_t low = 0;
+        if (!read(high) || !read(low))
+        {
+            return false;
+        }
+        value = (static_cast<uint64_t>(high) << 32) | low;
+        return true;
+    }
+
+    bool read(int64_t& value)
+    {
+        uint64_t val = 0;
+        if (!read(val))
+        {
+            return false;
+        }
+        value = static_cast<int64_t>(val);
+        return true;
+    }
+
+    bool read(std::string& value)
+    {
+        uint32_t length = 0;
+        if (!read(length))
+        {
+            return false;
+        }
+        if (m_data.size() - m_pos < length)
+        {
+            m_failed = true;
+            return false;
+        }
+        value.assign(reinterpret_cast<const char *>(&m_data[m_pos]), length);
+        m_pos += length;
+        return true;
+    }
+
+    bool hasMoreData() const
+    {
+        return !m_failed && m_pos < m_data.size();
+    }
+
+private:
+    const std::vector<unsigned char>& m_data;
+    size_t m_pos;
+    bool m_failed;
+};
+
+ManifestCache::ManifestCache(const std::string& path) : m_path(path), m_dirty(false)
+{
+}
+
+bool ManifestCache::load()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_dirty = false;
+
+    std::vector<unsigned char> data;
+    if (!readFile(m_path, data))
+    {
+        return false;
+    }
+
+    CacheReader reader(data);
+    std::string signature;
+    uint32_t version = 0;
+    uint32_t numberOfEntries = 0;
+    if (!reader.read(signature) || signature != "MFCA" || !reader.read(version) || version != MANIFEST_CACHE_VERSION || !reader.read(numberOfEntries))
+    {
+        return false;
+    }
+
+    for (uint32_t idx = 0; idx < numberOfEntries; ++idx)
+    {
+        std::string backupPath;
+        Entry entry;
+        uint32_t flags = 0;
+        uint32_t numberOfApps = 0;
+        BackupManifest& manifest = entry.manifest;
+        if (!reader.read(backupPath) || !reader.read(entry.stamp.infoPlistSize) || !reader.read(entry.stamp.infoPlistTime) ||
+            !reader.read(entry.stamp.manifestPlistSize) || !reader.read(entry.stamp.manifestPlistTime) || !reader.read(flags) ||
+            !reader.read(manifest.m_path) || !reader.read(manifest.m_backupId) || !reader.read(manifest.m_deviceName) ||
+            !reader.read(manifest.m_displayName) || !reader.read(manifest.m_backupTime) || !reader.read(manifest.m_iTunesVersion) ||
+            !reader.read(manifest.m_macOSVersion) || !reader.read(manifest.m_iOSVersion) || !reader.read(numberOfApps))
+        {
+            m_entries.clear();
+            return false;
+        }
+        entry.includingApps = (flags & 1) != 0;
+        entry.appsSaved = entry.includingApps;
+        manifest.m_encrypted = (flags & 2) != 0;
+
+        for (uint32_t appIdx = 0; appIdx < numberOfApps; ++appIdx)
+        {
+            BackupManifest::AppInfo appInfo;
+            if (!reader.read(appInfo.bundleId) || !reader.read(appInfo.name) || !reader.read(appInfo.bundleShortVersion) || !reader.read(appInfo.bundleVersion))
+            {
+                m_entries.clear();
+                return false;
+            }
+            manifest.m_apps->apps.push_back(appInfo);
+        }
+
+        m_entries[backupPath] = entry;
+    }
+
+    return true;
+}
+
+bool ManifestCache::save()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (std::map<std::string, Entry>::const_iterator it = m_entries.cbegin(); !m_dirty && it != m_entries.cend(); ++it)
+    {
+        if (it->second.includingApps && !it->second.appsSaved)
+        {
+            std::lock_guard<std::mutex> appsLock(it->second.manifest.m_apps->mutex);
+            m_dirty = it->second.manifest.m_apps->loaded && !it->second.manifest.m_apps->failed;
+        }
+    }
+    if (!m_dirty)
+    {
+        return true;
+    }
+
+    CacheWriter writer;
+    writer.write(std::string("MFCA"));
+    writer.write(static_cast<uint32_t>(MANIFEST_CACHE_VERSION));
+
+    // Drop the backups which were deleted
+    Stamp stamp;
+    for (std::map<std::string, Entry>::iterator it = m_entries.begin(); it != m_entries.end();)
+    {
+        if (getStamp(it->first, stamp))
+        {
+            ++it;
+        }
+        else
+        {
+            it = m_entries.erase(it);
+        }
+    }
+    writer.write(static_cast<uint32_t>(m_entries.size()));
+
+    std::vector<Entry*> entriesWithNewApps;
+    entriesWithNewApps.reserve(m_entries.size());
+    for (std::map<std::string, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        Entry& entry = it->second;
+        const BackupManifest& manifest = entry.manifest;
+        std::lock_guard<std::mutex> appsLock(manifest.m_apps->mutex);
+        // The apps are saved once they have been decoded, a failure is retried by the next parser
+        bool includingApps = entry.includingApps && manifest.m_apps->loaded && !manifest.m_apps->failed;
+        if (includingApps && !entry.appsSaved)
+        {
+            entriesWithNewApps.push_back(&entry);
+        }
+        writer.write(it->first);
+        writer.write(entry.stamp.infoPlistSize);
+        writer.write(static_cast<uint64_t>(entry.stamp.infoPlistTime));
+        writer.write(entry.stamp.manifestPlistSize);
+        writer.write(static_cast<uint64_t>(entry.stamp.manifestPlistTime));
+        writer.write(static_cast<uint32_t>((includingApps ? 1 : 0) | (manifest.m_encrypted ? 2 : 0)));
+        writer.write(manifest.m_path);
+        writer.write(manifest.m_backupId);
+        writer.write(manifest.m_deviceName);
+        writer.write(manifest.m_displayName);
+        writer.write(manifest.m_backupTime);
+        writer.write(manifest.m_iTunesVersion);
+        writer.write(manifest.m_macOSVersion);
+        writer.write(manifest.m_iOSVersion);
+        const std::vector<BackupManifest::AppInfo>& apps = manifest.m_apps->apps;
+        writer.write(static_cast<uint32_t>(includingApps ? apps.size() : 0));
+        for (std::vector<BackupManifest::AppInfo>::const_iterator itApp = apps.cbegin(); includingApps && itApp != apps.cend(); ++itApp)
+        {
+            writer.write(itApp->bundleId);
+            writer.write(itApp->name);
+            writer.write(itApp->bundleShortVersion);
+            writer.write(itApp->bundleVersion);
+        }
+    }
+
+    // Replace the file only once it is complete, so a crash or another process never sees a truncated cache
+    std::string tempPath = m_path + ".tmp";
+    if (!writeFile(tempPath, writer.getData()) || !moveFile(tempPath, m_path))
+    {
+        deleteFile(tempPath);
+        return false;
+    }
+
+    for (std::vector<Entry*>::iterator it = entriesWithNewApps.begin(); it != entriesWithNewApps.end(); ++it)
+    {
+        (*it)->appsSaved = true;
+    }
+    m_dirty = false;
+    return true;
+}
+
+bool ManifestCache::find(const std::string& backupPath, bool includingApps, BackupManifest& manifest)
+{
+    // stat the plists before taking the lock, the workers of parseDirectory call it in parallel
+    Stamp stamp;
+    if (!getStamp(backupPath, stamp))
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<std::string, Entry>::iterator it = m_entries.find(backupPath);
+    if (it == m_entries.end() || !(stamp == it->second.stamp))
+    {
+        return false;
+    }
+
+    Entry& entry = it->second;
+    if (includingApps && !entry.includingApps)
+    {
+        // The apps weren't decoded when the entry was saved, getApps() decodes them into the entry
+        entry.manifest.setAppsSource(backupPath);
+        entry.includingApps = true;
+        entry.appsSaved = false;
+    }
+    manifest = entry.manifest;
+    if (!includingApps)
+    {
+        manifest.m_apps = std::make_shared<BackupManifest::AppList>();
+    }
+    return true;
+}
+
+void ManifestCache::update(const std::string& backupPath, bool includingApps, const BackupManifest& manifest)
+{
+    Entry entry;
+    if (!getStamp(backupPath, entry.stamp))
+    {
+        return;
+    }
+    entry.includingApps = includingApps;
+    entry.manifest = manifest;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[backupPath] = entry;
+    m_dirty = true;
+}
+
+bool ManifestCache::getStamp(const std::string& backupPath, Stamp& stamp)
+{
+    return getFileStat(combinePath(backupPath, "Info.plist"), stamp.infoPlistSize, stamp.infoPlistTime) &&
+        getFileStat(combinePath(backupPath, "Manifest.plist"), stamp.manifestPlistSize, stamp.manifestPlistTime);
+}
@@ -0,0 +1,73 @@
+//
+//  ManifestCache.h
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include "ITunesParser.h"
+
+#ifndef ManifestCache_h
+#define ManifestCache_h
+
+// Parsed BackupManifest records saved in a binary file, so the plists of the backups are parsed once
+// An entry is used only if Info.plist and Manifest.plist of the backup have the same size and modified time
+// find/update can be called from multiple threads
+class ManifestCache
+{
+public:
+    explicit ManifestCache(const std::string& path);
+
+    bool load();
+    // Write the file if any entry was updated or got its apps decoded by BackupManifest::getApps() since the last save
+    bool save();
+
+    // The manifest shares its apps with the entry, so the apps which getApps() decodes later are saved too
+    bool find(const std::string& backupPath, bool includingApps, BackupManifest& manifest);
+    void update(const std::string& backupPath, bool includingApps, const BackupManifest& manifest);
+
+protected:
+    struct Stamp
+    {
+        uint64_t infoPlistSize;
+        int64_t infoPlistTime;
+        uint64_t manifestPlistSize;
+        int64_t manifestPlistTime;
+
+        Stamp() : infoPlistSize(0), infoPlistTime(0), manifestPlistSize(0), manifestPlistTime(0)
+        {
+        }
+
+        bool operator==(const Stamp& rhs) const
+        {
+            return infoPlistSize == rhs.infoPlistSize && infoPlistTime == rhs.infoPlistTime && manifestPlistSize == rhs.manifestPlistSize && manifestPlistTime == rhs.manifestPlistTime;
+        }
+    };
+
+    struct Entry
+    {
+        Stamp stamp;
+        bool includingApps;
+        bool appsSaved;     // The apps are in the file
+        BackupManifest manifest;
+
+        Entry() : includingApps(false), appsSaved(false)
+        {
+        }
+    };
+
+    static bool getStamp(const std::string& backupPath, Stamp& stamp);
+
+protected:
+    std::string m_path;
+    std::map<std::string, Entry> m_entries;
+    bool m_dirty;
+    mutable std::mutex m_mutex;
+};
+
+#endif /* ManifestCache_h */
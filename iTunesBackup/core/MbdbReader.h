@@ -6,7 +6,13 @@
 //  Copyright © 2021 Matthew. All rights reserved.
 //
 
-#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "FileSystem.h"
 
 #ifndef MbdbReader_h
 #define MbdbReader_h
@@ -35,184 +41,458 @@
     // string name
     // string value can be a string or a binary content
 
+// View of a string in the mapped file, it is not null-terminated
+struct MbdbString
+{
+    const char* data;
+    size_t length;
+    
+    MbdbString() : data(""), length(0)
+    {
+    }
+    
+    bool empty() const
+    {
+        return 0 == length;
+    }
+    
+    std::string str() const
+    {
+        return std::string(data, length);
+    }
+    
+    bool equals(const std::string& value) const
+    {
+        return value.size() == length && (0 == length || std::memcmp(value.c_str(), data, length) == 0);
+    }
+};
+
+struct MbdbRecord
+{
+    MbdbString domain;
+    MbdbString path;
+    MbdbString linkTarget;
+    MbdbString dataHash;    // Raw bytes (SHA-1 for most of the files)
+    MbdbString alwaysNull;
+    const unsigned char* fixedData;     // 40 bytes from Mode to PropertyCount
+    
+    MbdbRecord() : fixedData(NULL)
+    {
+    }
+    
+    unsigned short getMode() const
+    {
+        return static_cast<unsigned short>((fixedData[0] << 8) | fixedData[1]);
+    }
+    
+    unsigned int getTime1() const
+    {
+        return readUInt32(18);
+    }
+    
+    unsigned int getTime2() const
+    {
+        return readUInt32(22);
+    }
+    
+    unsigned int getTime3() const
+    {
+        return readUInt32(26);
+    }
+    
+    uint64_t getFileLength() const
+    {
+        return (static_cast<uint64_t>(readUInt32(30)) << 32) | readUInt32(34);
+    }
+    
+    unsigned char getFlag() const
+    {
+        return fixedData[38];
+    }
+    
+    unsigned int getPropertyCount() const
+    {
+        return fixedData[39];
+    }
+    
+private:
+    unsigned int readUInt32(size_t offset) const
+    {
+        return (static_cast<unsigned int>(fixedData[offset]) << 24) | (static_cast<unsigned int>(fixedData[offset + 1]) << 16) | (static_cast<unsigned int>(fixedData[offset + 2]) << 8) | fixedData[offset + 3];
+    }
+};
+
+// Cursor over the memory-mapped Manifest.mbdb, records are parsed in place with one linear pass
+// All the reads are bounds-checked, a truncated record stops the scan
 class MbdbReader {
     
-    std::ifstream m_ifs;
-    std::vector<char> m_buffer;
+    MappedFile m_file;
+    const unsigned char* m_data;
+    size_t m_size;
+    size_t m_pos;
+    // Record offsets to visit instead of the whole file
+    std::vector<uint32_t> m_offsets;
+    size_t m_offsetIndex;
+    bool m_useOffsets;
     
-#ifndef NDEBUG
-    std::ifstream::streampos m_pos;
-#endif
 public:
-    
-    ~MbdbReader()
+    MbdbReader() : m_data(NULL), m_size(0), m_pos(0), m_offsetIndex(0), m_useOffsets(false)
     {
-        if (m_ifs.is_open())
-        {
-            m_ifs.close();
-        }
     }
     
     bool open(const std::string& fileName)
     {
-        m_ifs.open(fileName, std::ios_base::in | std::ios_base::binary);
-        if (!m_ifs.is_open())
+        if (!m_file.open(fileName))
         {
             return false;
         }
         
-        char signature[7] = { 0 };
-        m_ifs.read(&signature[0], 6);
-        if (strcmp(signature, "mbdb\5\0") != 0)
+        m_data = m_file.getData();
+        m_size = m_file.getSize();
+        if (m_size < 6 || std::memcmp(m_data, "mbdb\5\0", 6) != 0)
         {
-            m_ifs.close();
+            close();
             return false;
         }
         
+        m_pos = 6;
         return true;
     }
     
-    bool hasMoreData()
+    void close()
     {
-        return !m_ifs.eof();
+        m_file.close();
+        m_data = NULL;
+        m_size = 0;
+        m_pos = 0;
+        m_offsets.clear();
+        m_offsetIndex = 0;
+        m_useOffsets = false;
     }
     
-    bool read(unsigned char *buffer, size_t length)
+    bool hasMoreData() const
     {
-        m_ifs.read(reinterpret_cast<char *>(buffer), length);
-
+        return m_useOffsets ? m_offsetIndex < m_offsets.size() : m_pos < m_size;
+    }
+    
+    // Let next() visit only the records at the offsets (e.g. from MbdbIndex) and skip the others
+    void setOffsets(std::vector<uint32_t>& offsets)
+    {
+        m_offsets.swap(offsets);
+        m_offsetIndex = 0;
+        m_useOffsets = true;
+    }
+    
+    const unsigned char* getData() const
+    {
+        return m_data;
+    }
+    
+    size_t getSize() const
+    {
+        return m_size;
+    }
+    
+    // Offset of the next record in the file
+    size_t getPosition() const
+    {
+        return m_pos;
+    }
+    
+    // Move the cursor to a record boundary returned by getPosition()
+    bool seek(size_t pos)
+    {
+        if (pos < 6 || pos > m_size)
+        {
+            return false;
+        }
+        m_pos = pos;
         return true;
     }
     
-    bool read(std::string& str)
+    // The strings of the record refer to the mapped file and stay valid until close()
+    bool next(MbdbRecord& record)
     {
-        int b0 = m_ifs.get();
-        int b1 = m_ifs.get();
+        if (m_useOffsets)
+        {
+            if (m_offsetIndex >= m_offsets.size() || !seek(m_offsets[m_offsetIndex++]))
+            {
+                return false;
+            }
+        }
         
-        if ((b0 == 255 && b1 == 255) || (b0 == 0 && b1 == 0))
+        size_t pos = m_pos;
+        if (!readString(pos, record.domain) || !readString(pos, record.path) || !readString(pos, record.linkTarget) ||
+            !readString(pos, record.dataHash) || !readString(pos, record.alwaysNull))
         {
-            str.clear();
-            return true;
+            m_pos = m_size;
+            return false;
         }
         
-        if (b0 == std::ifstream::traits_type::eof() || b1 == std::ifstream::traits_type::eof())
+        if (m_size - pos < 40)
         {
+            m_pos = m_size;
             return false;
         }
+        record.fixedData = m_data + pos;
+        pos += 40;
         
-        int lengthOfString = b0 * 256 + b1;
-        m_buffer.resize(lengthOfString);
-        m_ifs.read(&m_buffer[0], lengthOfString);
-
-        str.clear();
-        std::copy(m_buffer.begin(), m_buffer.end(), std::back_inserter(str));
+        unsigned int propertyCount = record.getPropertyCount();
+        MbdbString str;
+        for (unsigned int idx = 0; idx < propertyCount; ++idx)
+        {
+            if (!readString(pos, str) || !readString(pos, str))
+            {
+                m_pos = m_size;
+                return false;
+            }
+        }
         
+        m_pos = pos;
         return true;
     }
     
-    bool readD(std::string& str)
+    // Hexadecimal dump of the binary value (e.g. DataHash), printable ASCII strings are returned as they are
+    static std::string toDisplayString(const MbdbString& str)
     {
-        if (!read(str))
-        {
-            return false;
-        }
-        
-        // if we have only ASCII printable characters, we return the string
-        size_t i = 0, length = str.size();
-        for (; i < length; ++i)
+        size_t i = 0;
+        for (; i < str.length; ++i)
         {
-            if (str[i] < 32 || str[i] >= 128)
+            if (str.data[i] < 32 || static_cast<unsigned char>(str.data[i]) >= 128)
             {
                 break;
             }
         }
-        if (i == length)
+        if (i == str.length)
         {
-            return true;
+            return str.str();
         }
-
-        // otherwise the hexadecimal dump
+        
         std::string result;
-        for (i = 0; i < length; ++i)
+        result.reserve(str.length * 2);
+        for (i = 0; i < str.length; ++i)
         {
-            result.push_back(toHex(str[i] >> 4));
-            result.push_back(toHex(str[i] & 15));
+            result.push_back(toHex(static_cast<unsigned char>(str.data[i]) >> 4));
+            result.push_back(toHex(str.data[i] & 15));
         }
-
-        str.swap(result);
-        return true;
+        return result;
     }
-
-    bool read(int32_t& value)
+    
+protected:
+    bool readString(size_t& pos, MbdbString& str) const
     {
+        if (m_size - pos < 2)
+        {
+            return false;
+        }
+        
+        unsigned int b0 = m_data[pos];
+        unsigned int b1 = m_data[pos + 1];
+        pos += 2;
+        
+        str.data = "";
+        str.length = 0;
+        if ((b0 == 255 && b1 == 255) || (b0 == 0 && b1 == 0))
+        {
+            return true;
+        }
+        
+        size_t lengthOfString = b0 * 256 + b1;
+        if (m_size - pos < lengthOfString)
+        {
+            return false;
+        }
+        
+        str.data = reinterpret_cast<const char *>(m_data + pos);
+        str.length = lengthOfString;
+        pos += lengthOfString;
         return true;
     }
     
-    bool read(uint32_t& value)
+    static char toHex(int value)
+    {
+        value &= 0xF;
+        return (value >= 0 && value <= 9) ? (char)('0' + value) : (char)('A' + (value - 10));
+    }
+};
+
+// Sidecar index of Manifest.mbdb: record offsets grouped by domain
+// It is bound to the content of the mbdb with its size and checksum, a stale index is rebuilt
+class MbdbIndex
+{
+public:
+    MbdbIndex() : m_mbdbSize(0), m_checksum(0)
     {
-        unsigned char buf[4];
-        
-        return true;
     }
     
-    bool read(int16_t& value)
+    static uint64_t computeChecksum(const unsigned char* data, size_t length)
     {
-        unsigned char buf[4];
-        
-        return true;
+        // FNV-1a on 8-byte words, it only needs to detect a changed file
+        const uint64_t prime = 0x100000001B3ULL;
+        uint64_t hash = 0xCBF29CE484222325ULL ^ length;
+        size_t pos = 0;
+        for (; pos + 8 <= length; pos += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + pos, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for (; pos < length; ++pos)
+        {
+            hash = (hash ^ data[pos]) * prime;
+        }
+        return hash;
     }
-    bool read(uint16_t& value)
+    
+    // Scan all the records of the reader (before setOffsets), its position is moved to the end
+    bool build(MbdbReader& reader)
     {
-        unsigned char buf[4];
+        m_offsets.clear();
+        m_mbdbSize = reader.getSize();
+        m_checksum = computeChecksum(reader.getData(), reader.getSize());
+        if (m_mbdbSize > UINT32_MAX)
+        {
+            return false;
+        }
         
+        if (!reader.seek(6))
+        {
+            return false;
+        }
+        MbdbRecord record;
+        size_t pos = reader.getPosition();
+        while (reader.next(record))
+        {
+            m_offsets[record.domain.str()].push_back(static_cast<uint32_t>(pos));
+            pos = reader.getPosition();
+        }
         return true;
     }
     
-    bool skipString()
+    // Return false if the file is missing, broken or built from other content
+    bool load(const std::string& path, const MbdbReader& reader)
     {
-        int b0 = m_ifs.get();
-        int b1 = m_ifs.get();
-        
-        if ((b0 == 255 && b1 == 255) || (b0 == 0 && b1 == 0))
+        m_offsets.clear();
+        std::vector<unsigned char> data;
+        if (!readFile(path, data) || data.size() < HEADER_SIZE || std::memcmp(&data[0], "MBIX", 4) != 0)
         {
-            return true;
+            return false;
         }
         
-        if (b0 == std::ifstream::traits_type::eof() || b1 == std::ifstream::traits_type::eof())
+        size_t pos = 4;
+        m_mbdbSize = readUInt64(data, pos);
+        m_checksum = readUInt64(data, pos);
+        uint32_t domainCount = readUInt32(data, pos);
+        if (m_mbdbSize != reader.getSize() || m_checksum != computeChecksum(reader.getData(), reader.getSize()))
         {
             return false;
         }
         
-        int lengthOfString = b0 * 256 + b1;
-        m_ifs.seekg(lengthOfString, std::ios_base::cur);
-        
-#ifndef NDEBUG
-        m_pos = m_ifs.tellg();
-#endif
+        for (uint32_t idx = 0; idx < domainCount; ++idx)
+        {
+            if (data.size() - pos < 2)
+            {
+                m_offsets.clear();
+                return false;
+            }
+            size_t length = (data[pos] << 8) | data[pos + 1];
+            pos += 2;
+            if (data.size() - pos < length + 4)
+            {
+                m_offsets.clear();
+                return false;
+            }
+            std::vector<uint32_t>& offsets = m_offsets[std::string(reinterpret_cast<const char *>(&data[pos]), length)];
+            pos += length;
+            uint32_t offsetCount = readUInt32(data, pos);
+            if ((data.size() - pos) / 4 < offsetCount)
+            {
+                m_offsets.clear();
+                return false;
+            }
+            offsets.reserve(offsetCount);
+            for (uint32_t offsetIdx = 0; offsetIdx < offsetCount; ++offsetIdx)
+            {
+                offsets.push_back(readUInt32(data, pos));
+            }
+        }
         
         return true;
     }
-    // static size_t skipString(const unsigned char *data, size_t length);
     
-    bool skip(size_t length)
+    bool save(const std::string& path) const
     {
-        m_ifs.seekg(length, std::ios_base::cur);
-        return true;
+        const char signature[] = "MBIX";
+        std::vector<unsigned char> data(signature, signature + 4);
+        writeUInt64(data, m_mbdbSize);
+        writeUInt64(data, m_checksum);
+        writeUInt32(data, static_cast<uint32_t>(m_offsets.size()));
+        for (std::map<std::string, std::vector<uint32_t>>::const_iterator it = m_offsets.cbegin(); it != m_offsets.cend(); ++it)
+        {
+            size_t length = std::min(it->first.size(), static_cast<size_t>(0xFFFE));
+            data.push_back(static_cast<unsigned char>(length >> 8));
+            data.push_back(static_cast<unsigned char>(length & 0xFF));
+            data.insert(data.end(), it->first.cbegin(), it->first.cbegin() + length);
+            writeUInt32(data, static_cast<uint32_t>(it->second.size()));
+            for (std::vector<uint32_t>::const_iterator itOffset = it->second.cbegin(); itOffset != it->second.cend(); ++itOffset)
+            {
+                writeUInt32(data, *itOffset);
+            }
+        }
+        return writeFile(path, data);
     }
     
-protected:
-    char toHex(int value)
+    // Offsets of the records of the domains in file order
+    void getOffsets(const std::vector<std::string>& domains, std::vector<uint32_t>& offsets) const
     {
-        value &= 0xF;
-        return (value >= 0 && value <= 9) ? (char)('0' + value) : (char)('A' + (value - 10));
+        offsets.clear();
+        for (std::vector<std::string>::const_iterator it = domains.cbegin(); it != domains.cend(); ++it)
+        {
+            std::map<std::string, std::vector<uint32_t>>::const_iterator itDomain = m_offsets.find(*it);
+            if (itDomain != m_offsets.cend())
+            {
+                offsets.insert(offsets.end(), itDomain->second.cbegin(), itDomain->second.cend());
+            }
+        }
+        std::sort(offsets.begin(), offsets.end());
+        offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
     }
-
-    char toHexLow(int value)
+    
+private:
+    // Signature, size and checksum of the mbdb, number of domains
+    static const size_t HEADER_SIZE = 24;
+    
+    static uint32_t readUInt32(const std::vector<unsigned char>& data, size_t& pos)
     {
-        value &= 0xF;
-        return (value >= 0 && value <= 9) ? (char)('0' + value) : (char)('a' + (value - 10));
+        uint32_t value = (static_cast<uint32_t>(data[pos]) << 24) | (static_cast<uint32_t>(data[pos + 1]) << 16) | (static_cast<uint32_t>(data[pos + 2]) << 8) | data[pos + 3];
+        pos += 4;
+        return value;
     }
+    
+    static uint64_t readUInt64(const std::vector<unsigned char>& data, size_t& pos)
+    {
+        uint64_t high = readUInt32(data, pos);
+        return (high << 32) | readUInt32(data, pos);
+    }
+    
+    static void writeUInt32(std::vector<unsigned char>& data, uint32_t value)
+    {
+        data.push_back(static_cast<unsigned char>(value >> 24));
+        data.push_back(static_cast<unsigned char>((value >> 16) & 0xFF));
+        data.push_back(static_cast<unsigned char>((value >> 8) & 0xFF));
+        data.push_back(static_cast<unsigned char>(value & 0xFF));
+    }
+    
+    static void writeUInt64(std::vector<unsigned char>& data, uint64_t value)
+    {
+        writeUInt32(data, static_cast<uint32_t>(value >> 32));
+        writeUInt32(data, static_cast<uint32_t>(value & 0xFFFFFFFF));
+    }
+    
+private:
+    uint64_t m_mbdbSize;
+    uint64_t m_checksum;
+    std::map<std::string, std::vector<uint32_t>> m_offsets;
 };
 
-
 #endif /* MbdbReader_h */
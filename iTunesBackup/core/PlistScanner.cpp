@@ -0,0 +1,637 @@
+//
+//  PlistScanner.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "PlistScanner.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "FileSystem.h"
+
+static void appendUtf8(std::string& str, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        str.push_back(static_cast<char>(cp));
+    }
+    else if (cp < 0x800)
+    {
+        str.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000)
+    {
+        str.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x110000)
+    {
+        str.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Days since 1970-01-01 of the date in proleptic Gregorian calendar
+static int64_t daysFromCivil(int64_t y, unsigned int m, unsigned int d)
+{
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned int yoe = static_cast<unsigned int>(y - era * 400);
+    const unsigned int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// <date>2022-07-18T10:20:30Z</date>
+static bool parseXmlDate(const std::string& text, double& value)
+{
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+    if (sscanf(text.c_str(), "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second) != 6 || month < 1 || month > 12 || day < 1 || day > 31)
+    {
+        return false;
+    }
+
+    int64_t days = daysFromCivil(year, month, day) - daysFromCivil(2001, 1, 1);
+    value = static_cast<double>(days * 86400 + hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+static std::string decodeXmlText(const char* begin, const char* end)
+{
+    std::string text;
+    text.reserve(end - begin);
+    while (begin < end)
+    {
+        const char* amp = reinterpret_cast<const char *>(std::memchr(begin, '&', end - begin));
+        if (NULL == amp)
+        {
+            text.append(begin, end);
+            break;
+        }
+        text.append(begin, amp);
+        const char* semicolon = reinterpret_cast<const char *>(std::memchr(amp, ';', end - amp));
+        if (NULL == semicolon)
+        {
+            text.append(amp, end);
+            break;
+        }
+
+        std::string entity(amp + 1, semicolon);
+        if (entity == "amp")
+        {
+            text.push_back('&');
+        }
+        else if (entity == "lt")
+        {
+            text.push_back('<');
+        }
+        else if (entity == "gt")
+        {
+            text.push_back('>');
+        }
+        else if (entity == "quot")
+        {
+            text.push_back('"');
+        }
+        else if (entity == "apos")
+        {
+            text.push_back('\'');
+        }
+        else if (entity.size() > 1 && entity[0] == '#')
+        {
+            bool hex = entity[1] == 'x' || entity[1] == 'X';
+            appendUtf8(text, static_cast<uint32_t>(std::strtoul(entity.c_str() + (hex ? 2 : 1), NULL, hex ? 16 : 10)));
+        }
+        else
+        {
+            text.append(amp, semicolon + 1);
+        }
+        begin = semicolon + 1;
+    }
+    return text;
+}
+
+bool PlistScanner::scanFile(const std::string& path, const std::vector<std::string>& keys, std::map<std::string, Value>& values)
+{
+    // Pages are only read when they are touched, so the scan costs what it reads
+    MappedFile file;
+    if (!file.open(path, false))
+    {
+        return false;
+    }
+
+    return scan(file.getData(), file.getSize(), keys, values);
+}
+
+bool PlistScanner::scan(const unsigned char* data, size_t length, const std::vector<std::string>& keys, std::map<std::string, Value>& values)
+{
+    if (NULL == data || length == 0)
+    {
+        return false;
+    }
+
+    if (length >= 8 && std::memcmp(data, "bplist00", 8) == 0)
+    {
+        return scanBinary(data, length, keys, values);
+    }
+
+    return scanXml(reinterpret_cast<const char *>(data), length, keys, values);
+}
+
+// Skip the contents of a dict/array whose start tag ends before p, p is moved after its end tag
+// Only the container tags are looked at, nothing is decoded or copied (e.g. the Applications dict of Info.plist)
+static bool skipXmlContainer(const char*& p, const char* end)
+{
+    int depth = 1;
+    while (p < end)
+    {
+        const char* lt = reinterpret_cast<const char *>(std::memchr(p, '<', end - p));
+        if (NULL == lt)
+        {
+            return false;
+        }
+        const char* gt = reinterpret_cast<const char *>(std::memchr(lt, '>', end - lt));
+        if (NULL == gt)
+        {
+            return false;
+        }
+        p = gt + 1;
+
+        const char* name = lt + 1;
+        bool closing = (name < gt && *name == '/');
+        if (closing)
+        {
+            ++name;
+        }
+        size_t nameLength = 0;
+        while (name + nameLength < gt && name[nameLength] != '/' && name[nameLength] != ' ' && name[nameLength] != '\t' && name[nameLength] != '\r' && name[nameLength] != '\n')
+        {
+            ++nameLength;
+        }
+        bool container = (nameLength == 4 && std::memcmp(name, "dict", 4) == 0) || (nameLength == 5 && std::memcmp(name, "array", 5) == 0);
+        if (!container)
+        {
+            continue;
+        }
+        if (closing)
+        {
+            if (--depth == 0)
+            {
+                return true;
+            }
+        }
+        else if (*(gt - 1) != '/')
+        {
+            ++depth;
+        }
+    }
+    return false;
+}
+
+bool PlistScanner::scanXml(const char* data, size_t length, const std::vector<std::string>& keys, std::map<std::string, Value>& values)
+{
+    const char* p = data;
+    const char* end = data + length;
+    int depth = 0;
+    bool rootFound = false;
+    bool hasKey = false;
+    std::string key;
+
+    while (p < end)
+    {
+        // Contents of values (e.g. base64 of data) have no '<', so it is a fast skip
+        const char* lt = reinterpret_cast<const char *>(std::memchr(p, '<', end - p));
+        if (NULL == lt)
+        {
+            break;
+        }
+        p = lt + 1;
+        if (p >= end)
+        {
+            break;
+        }
+
+        if (*p == '?' || *p == '!')
+        {
+            // <?xml ... ?>, <!DOCTYPE ...> or <!-- ... -->
+            const char* terminator = (end - p >= 3 && std::memcmp(p, "!--", 3) == 0) ? "-->" : ">";
+            const char* found = std::search(p, end, terminator, terminator + std::strlen(terminator));
+            if (found == end)
+            {
+                break;
+            }
+            p = found + std::strlen(terminator);
+            continue;
+        }
+
+        bool closing = (*p == '/');
+        if (closing)
+        {
+            ++p;
+        }
+        const char* nameBegin = p;
+        while (p < end && *p != '>' && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        {
+            ++p;
+        }
+        std::string name(nameBegin, p);
+        const char* gt = reinterpret_cast<const char *>(std::memchr(p, '>', end - p));
+        if (NULL == gt)
+        {
+            break;
+        }
+        bool selfClosing = gt > nameBegin && *(gt - 1) == '/';
+        p = gt + 1;
+
+        if (closing)
+        {
+            if (name == "dict" || name == "array")
+            {
+                if (--depth == 0)
+                {
+                    // End of the root dict
+                    break;
+                }
+            }
+            continue;
+        }
+
+        if (name == "plist")
+        {
+            continue;
+        }
+
+        if (depth == 1 && name == "key" && !selfClosing)
+        {
+            const char* textEnd = reinterpret_cast<const char *>(std::memchr(p, '<', end - p));
+            if (NULL == textEnd)
+            {
+                break;
+            }
+            key = decodeXmlText(p, textEnd);
+            hasKey = true;
+            p = textEnd;
+            continue;
+        }
+
+        bool wanted = depth == 1 && hasKey && std::find(keys.cbegin(), keys.cend(), key) != keys.cend();
+        if (depth == 1)
+        {
+            hasKey = false;
+        }
+
+        if (name == "dict" || name == "array")
+        {
+            if (selfClosing)
+            {
+                continue;
+            }
+            if (depth == 0)
+            {
+                rootFound = (name == "dict");
+                ++depth;
+                continue;
+            }
+            // Containers are never returned, jump to their end tag
+            if (!skipXmlContainer(p, end))
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (!wanted)
+        {
+            continue;
+        }
+
+        Value value;
+        std::string text;
+        if (!selfClosing)
+        {
+            const char* textEnd = reinterpret_cast<const char *>(std::memchr(p, '<', end - p));
+            if (NULL == textEnd)
+            {
+                break;
+            }
+            text = decodeXmlText(p, textEnd);
+            p = textEnd;
+        }
+
+        if (name == "string")
+        {
+            value.type = Value::VALUE_STRING;
+            value.str.swap(text);
+        }
+        else if (name == "integer")
+        {
+            value.type = Value::VALUE_INTEGER;
+            value.integer = std::strtoll(text.c_str(), NULL, 10);
+        }
+        else if (name == "real")
+        {
+            value.type = Value::VALUE_REAL;
+            value.real = std::strtod(text.c_str(), NULL);
+        }
+        else if (name == "date")
+        {
+            if (parseXmlDate(text, value.real))
+            {
+                value.type = Value::VALUE_DATE;
+            }
+        }
+        else if (name == "true" || name == "false")
+        {
+            value.type = Value::VALUE_BOOLEAN;
+            value.integer = (name == "true") ? 1 : 0;
+        }
+
+        if (value.type != Value::VALUE_NONE)
+        {
+            values[key] = value;
+            if (values.size() >= keys.size())
+            {
+                // All the keys are found, the rest of the file is not touched
+                break;
+            }
+        }
+    }
+
+    return rootFound;
+}
+
+// All the accesses are bounds-checked
+class BinaryPlist
+{
+public:
+    BinaryPlist(const unsigned char* data, size_t length) : m_data(data), m_length(length), m_offsetSize(0), m_refSize(0), m_numberOfObjects(0), m_topObject(0), m_offsetTableOffset(0)
+    {
+    }
+
+    bool open()
+    {
+        if (m_length < 8 + 32)
+        {
+            return false;
+        }
+        const unsigned char* trailer = m_data + m_length - 32;
+        m_offsetSize = trailer[6];
+        m_refSize = trailer[7];
+        m_numberOfObjects = readBigEndian(trailer + 8, 8);
+        m_topObject = readBigEndian(trailer + 16, 8);
+        m_offsetTableOffset = readBigEndian(trailer + 24, 8);
+        if (m_offsetSize == 0 || m_offsetSize > 8 || m_refSize == 0 || m_refSize > 8 || m_topObject >= m_numberOfObjects || m_offsetTableOffset >= m_length)
+        {
+            return false;
+        }
+        return (m_length - 32 - m_offsetTableOffset) / m_offsetSize >= m_numberOfObjects;
+    }
+
+    uint64_t getTopObject() const
+    {
+        return m_topObject;
+    }
+
+    // Get the references of the keys and values of the dict
+    bool getDict(uint64_t objectRef, std::vector<uint64_t>& keyRefs, std::vector<uint64_t>& valueRefs) const
+    {
+        size_t offset = 0;
+        uint64_t count = 0;
+        if (!getObject(objectRef, 0xD0, offset, count) || count > m_length / (2 * m_refSize))
+        {
+            return false;
+        }
+        if (m_length - offset < count * 2 * m_refSize)
+        {
+            return false;
+        }
+        keyRefs.clear();
+        valueRefs.clear();
+        for (uint64_t idx = 0; idx < count; ++idx)
+        {
+            keyRefs.push_back(readBigEndian(m_data + offset + idx * m_refSize, m_refSize));
+            valueRefs.push_back(readBigEndian(m_data + offset + (count + idx) * m_refSize, m_refSize));
+        }
+        return true;
+    }
+
+    bool getString(uint64_t objectRef, std::string& value) const
+    {
+        size_t offset = 0;
+        uint64_t count = 0;
+        unsigned char marker = 0;
+        if (!getMarker(objectRef, marker))
+        {
+            return false;
+        }
+        if ((marker & 0xF0) == 0x50)
+        {
+            if (!getObject(objectRef, 0x50, offset, count) || m_length - offset < count)
+            {
+                return false;
+            }
+            value.assign(reinterpret_cast<const char *>(m_data + offset), static_cast<size_t>(count));
+            return true;
+        }
+        if ((marker & 0xF0) == 0x60)
+        {
+            // UTF-16BE
+            if (!getObject(objectRef, 0x60, offset, count) || count > m_length / 2 || m_length - offset < count * 2)
+            {
+                return false;
+            }
+            value.clear();
+            for (uint64_t idx = 0; idx < count; ++idx)
+            {
+                uint32_t cp = (m_data[offset + idx * 2] << 8) | m_data[offset + idx * 2 + 1];
+                if (cp >= 0xD800 && cp <= 0xDBFF && idx + 1 < count)
+                {
+                    uint32_t low = (m_data[offset + idx * 2 + 2] << 8) | m_data[offset + idx * 2 + 3];
+                    if (low >= 0xDC00 && low <= 0xDFFF)
+                    {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        ++idx;
+                    }
+                }
+                appendUtf8(value, cp);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool getValue(uint64_t objectRef, PlistScanner::Value& value) const
+    {
+        unsigned char marker = 0;
+        size_t offset = 0;
+        if (!getMarker(objectRef, marker) || !getObjectOffset(objectRef, offset))
+        {
+            return false;
+        }
+
+        switch (marker & 0xF0)
+        {
+            case 0x00:
+                if (marker == 0x08 || marker == 0x09)
+                {
+                    value.type = PlistScanner::Value::VALUE_BOOLEAN;
+                    value.integer = (marker == 0x09) ? 1 : 0;
+                    return true;
+                }
+                return false;
+            case 0x10:
+            {
+                size_t size = static_cast<size_t>(1) << (marker & 0x0F);
+                if (size > 8 || m_length - offset - 1 < size)
+                {
+                    return false;
+                }
+                value.type = PlistScanner::Value::VALUE_INTEGER;
+                value.integer = static_cast<int64_t>(readBigEndian(m_data + offset + 1, size));
+                return true;
+            }
+            case 0x20:
+            case 0x30:
+            {
+                size_t size = static_cast<size_t>(1) << (marker & 0x0F);
+                if ((size != 4 && size != 8) || m_length - offset - 1 < size)
+                {
+                    return false;
+                }
+                uint64_t bits = readBigEndian(m_data + offset + 1, size);
+                if (size == 4)
+                {
+                    uint32_t bits32 = static_cast<uint32_t>(bits);
+                    float val = 0;
+                    std::memcpy(&val, &bits32, 4);
+                    value.real = val;
+                }
+                else
+                {
+                    std::memcpy(&value.real, &bits, 8);
+                }
+                value.type = ((marker & 0xF0) == 0x30) ? PlistScanner::Value::VALUE_DATE : PlistScanner::Value::VALUE_REAL;
+                return true;
+            }
+            case 0x50:
+            case 0x60:
+                value.type = PlistScanner::Value::VALUE_STRING;
+                return getString(objectRef, value.str);
+            default:
+                break;
+        }
+        return false;
+    }
+
+private:
+    static uint64_t readBigEndian(const unsigned char* data, size_t size)
+    {
+        uint64_t value = 0;
+        for (size_t idx = 0; idx < size; ++idx)
+        {
+            value = (value << 8) | data[idx];
+        }
+        return value;
+    }
+
+    bool getObjectOffset(uint64_t objectRef, size_t& offset) const
+    {
+        if (objectRef >= m_numberOfObjects)
+        {
+            return false;
+        }
+        uint64_t value = readBigEndian(m_data + m_offsetTableOffset + objectRef * m_offsetSize, m_offsetSize);
+        if (value < 8 || value >= m_offsetTableOffset)
+        {
+            return false;
+        }
+        offset = static_cast<size_t>(value);
+        return true;
+    }
+
+    bool getMarker(uint64_t objectRef, unsigned char& marker) const
+    {
+        size_t offset = 0;
+        if (!getObjectOffset(objectRef, offset))
+        {
+            return false;
+        }
+        marker = m_data[offset];
+        return true;
+    }
+
+    // Get the offset of the content and the count of the object (string, data, dict, ...)
+    bool getObject(uint64_t objectRef, unsigned char type, size_t& offset, uint64_t& count) const
+    {
+        if (!getObjectOffset(objectRef, offset))
+        {
+            return false;
+        }
+        unsigned char marker = m_data[offset++];
+        if ((marker & 0xF0) != type)
+        {
+            return false;
+        }
+        count = marker & 0x0F;
+        if (count == 0x0F)
+        {
+            // The count follows as an integer object
+            if (offset >= m_length || (m_data[offset] & 0xF0) != 0x10)
+            {
+                return false;
+            }
+            size_t size = static_cast<size_t>(1) << (m_data[offset] & 0x0F);
+            if (size > 8 || m_length - offset - 1 < size)
+            {
+                return false;
+            }
+            count = readBigEndian(m_data + offset + 1, size);
+            offset += 1 + size;
+        }
+        return offset <= m_length;
+    }
+
+private:
+    const unsigned char* m_data;
+    size_t m_length;
+    size_t m_offsetSize;
+    size_t m_refSize;
+    uint64_t m_numberOfObjects;
+    uint64_t m_topObject;
+    uint64_t m_offsetTableOffset;
+};
+
+bool PlistScanner::scanBinary(const unsigned char* data, size_t length, const std::vector<std::string>& keys, std::map<std::string, Value>& values)
+{
+    BinaryPlist plist(data, length);
+    std::vector<uint64_t> keyRefs;
+    std::vector<uint64_t> valueRefs;
+    if (!plist.open() || !plist.getDict(plist.getTopObject(), keyRefs, valueRefs))
+    {
+        return false;
+    }
+
+    std::string key;
+    for (size_t idx = 0; idx < keyRefs.size(); ++idx)
+    {
+        if (!plist.getString(keyRefs[idx], key) || std::find(keys.cbegin(), keys.cend(), key) == keys.cend())
+        {
+            continue;
+        }
+        Value value;
+        if (plist.getValue(valueRefs[idx], value))
+        {
+            values[key] = value;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,57 @@
+//
+//  PlistScanner.h
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef PlistScanner_h
+#define PlistScanner_h
+
+// Reads scalar values of the top-level dictionary of a plist (XML or bplist00) without building the tree,
+// e.g. the header keys of Info.plist next to tens of MB of Applications.
+// XML is scanned from the start and the scan stops once all the keys are found. The nested containers are
+// passed over by matching their end tags without decoding them, but their bytes are still read: in an XML
+// Info.plist the Applications dict sorts before the header keys.
+// bplist is accessed via its offset table, so only the pages of the requested objects are read.
+class PlistScanner
+{
+public:
+    struct Value
+    {
+        enum Type
+        {
+            VALUE_NONE = 0,
+            VALUE_STRING,
+            VALUE_INTEGER,
+            VALUE_REAL,
+            VALUE_DATE,     // Seconds since 2001-01-01 00:00:00 UTC in real
+            VALUE_BOOLEAN,  // In integer
+        };
+
+        Type type;
+        std::string str;
+        int64_t integer;
+        double real;
+
+        Value() : type(VALUE_NONE), integer(0), real(0.0)
+        {
+        }
+    };
+
+    // Keys with container values (dict/array/data) are not returned
+    static bool scanFile(const std::string& path, const std::vector<std::string>& keys, std::map<std::string, Value>& values);
+    static bool scan(const unsigned char* data, size_t length, const std::vector<std::string>& keys, std::map<std::string, Value>& values);
+
+protected:
+    static bool scanXml(const char* data, size_t length, const std::vector<std::string>& keys, std::map<std::string, Value>& values);
+    static bool scanBinary(const unsigned char* data, size_t length, const std::vector<std::string>& keys, std::map<std::string, Value>& values);
+};
+
+#endif /* PlistScanner_h */
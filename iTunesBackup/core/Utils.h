@@ -17,7 +17,7 @@
 typedef int mode_t;
 #endif
 
-#define ENABLE_AUDIO_CONVERTION
+// ENABLE_AUDIO_CONVERTION is defined by the build (e.g. the CMake option), it needs lame and silk
 
 #ifndef Utils_h
 #define Utils_h
@@ -97,4 +97,10 @@ std::string getTimestampString(bool includingYMD = false, bool includingMs = fal
 void setThreadName(const char* threadName);
 bool isNumber(const std::string &s);
 
+// Utils_silk.cpp and Utils_audio.cpp, they do nothing unless ENABLE_AUDIO_CONVERTION is defined
+bool silkToPcm(const std::string& silkPath, std::vector<unsigned char>& pcmData);
+bool silkToPcm(const std::string& silkPath, const std::string& pcmPath);
+bool pcmToMp3(const std::string& pcmPath, const std::string& mp3Path);
+bool pcmToMp3(const std::vector<unsigned char>& pcmData, const std::string& mp3Path);
+
 #endif /* Utils_h */
@@ -12,6 +12,7 @@ extern "C"
 #include <lame/lame.h>
 }
 #include "Utils.h"
+#include "FileSystem.h"
 
 bool pcmToMp3(const std::string& pcmPath, const std::string& mp3Path)
 {
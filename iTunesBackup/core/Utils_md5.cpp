@@ -19,11 +19,10 @@
 
 #elif defined(__APPLE__)
 #import <CommonCrypto/CommonDigest.h>
-#else
-
 #endif
 
 #include "FileSystem.h"
+#include "Digest.h"
 
 std::string md5Impl(const void* data, size_t dataSize)
 {
@@ -67,7 +66,11 @@ std::string md5Impl(const void* data, size_t dataSize)
         stream << std::setw(2) << ((unsigned int) digest[idx]);
     }
 #else
-#error "Md5 Not implemented."
+    unsigned char digest[Md5Digest::DIGEST_LENGTH] = {0};
+    Md5Digest md5Digest;
+    md5Digest.update(data, dataSize);
+    md5Digest.finish(digest);
+    return toHexString(digest, Md5Digest::DIGEST_LENGTH);
 #endif
 
     return stream.str();
@@ -78,16 +81,17 @@ std::string md5(const std::string& s)
     return md5Impl(s.c_str(), s.size());
 }
 
+// Streamed, so the memory use doesn't depend on the file size
 std::string md5File(const std::string& path)
 {
-    std::vector<unsigned char> data;
-    
-    if (readFile(path, data) && !data.empty())
+    unsigned char digest[Md5Digest::DIGEST_LENGTH] = {0};
+    Md5Digest md5Digest;
+    if (!digestFile(path, md5Digest))
     {
-        return md5Impl(&data[0], data.size());
+        return "";
     }
-    
-    return "";
+    md5Digest.finish(digest);
+    return toHexString(digest, Md5Digest::DIGEST_LENGTH);
 }
 
 std::string sha1(const std::string& s)
@@ -132,7 +136,11 @@ std::string sha1(const std::string& s)
         stream << std::setw(2) << ((unsigned int) digest[idx]);
     }
 #else
-#error "SHA1 Not implemented."
+    unsigned char digest[Sha1Digest::DIGEST_LENGTH] = {0};
+    Sha1Digest sha1Digest;
+    sha1Digest.update(s.c_str(), s.size());
+    sha1Digest.finish(digest);
+    return toHexString(digest, Sha1Digest::DIGEST_LENGTH);
 #endif
 
     return stream.str();
@@ -3,6 +3,7 @@
 #endif
 
 #include "Utils.h"
+#include "FileSystem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -0,0 +1,1095 @@
+//
+//  core_tests.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include "BackupGenerator.h"
+#include "Digest.h"
+#include "FileSystem.h"
+#include "ITunesParser.h"
+#include "ManifestCache.h"
+#include "MbdbReader.h"
+#include "PlistScanner.h"
+#include "Utils.h"
+
+// Minimal harness, no test framework is required to build the tests
+static int g_failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++g_failures; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+static std::string g_tempPath;
+
+static std::string sha1Hex(const std::string& data)
+{
+    Sha1Digest digest;
+    digest.update(data.c_str(), data.size());
+    unsigned char value[Sha1Digest::DIGEST_LENGTH];
+    digest.finish(value);
+    return toHexString(value, Sha1Digest::DIGEST_LENGTH);
+}
+
+static std::string md5Hex(const std::string& data)
+{
+    Md5Digest digest;
+    digest.update(data.c_str(), data.size());
+    unsigned char value[Md5Digest::DIGEST_LENGTH];
+    digest.finish(value);
+    return toHexString(value, Md5Digest::DIGEST_LENGTH);
+}
+
+// Files of the fixtures per directory, see getFilePath
+#define FILES_PER_DIRECTORY     50
+
+// Synthetic backup of the generator with numberOfFiles per app. The full blobs carry the Digest of the files,
+// the sizes go from empty to a few chunks so the copies cover the small and the chunked paths
+static bool makeBackup(const std::string& root, bool mbdb, unsigned int numberOfApps, unsigned int numberOfFiles)
+{
+    GeneratorOptions options;
+    options.outputPath = root;
+    options.mbdb = mbdb;
+    options.numberOfDomains = numberOfApps;
+    options.numberOfFiles = static_cast<uint64_t>(numberOfFiles) * numberOfApps;
+    options.filesPerDirectory = FILES_PER_DIRECTORY;
+    options.sizeDistribution = GeneratorOptions::SIZE_UNIFORM;
+    options.sizeParam1 = 0;
+    options.sizeParam2 = 20000;
+    options.blobShape = GeneratorOptions::BLOB_FULL;
+    return generateBackup(options);
+}
+
+// Relative path of the file idx of an app in the fixtures
+static std::string getFilePath(unsigned int idx)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "Documents/d%05u/f%07u.dat", idx / FILES_PER_DIRECTORY, idx);
+    return path;
+}
+
+// Files and directories of an app: the root, Documents, Library and one directory per FILES_PER_DIRECTORY files
+static size_t getNumberOfEntries(unsigned int numberOfFiles)
+{
+    return numberOfFiles + 3 + (numberOfFiles + FILES_PER_DIRECTORY - 1) / FILES_PER_DIRECTORY;
+}
+
+// The payload of the file in the backup matches its size and digest of the manifest
+static bool checkBackupFile(ITunesDb& db, const ITunesFile* file)
+{
+    if (NULL == file || !db.parseFileInfo(file) || file->digestLength != Sha1Digest::DIGEST_LENGTH)
+    {
+        return false;
+    }
+    std::string content = readFile(db.getRealPath(file));
+    return content.size() == file->size && sha1Hex(content) == toHexString(file->digest, Sha1Digest::DIGEST_LENGTH);
+}
+
+static size_t countFiles(const std::string& path)
+{
+    size_t count = 0;
+    DIR* dir = opendir(path.c_str());
+    if (NULL == dir)
+    {
+        return 0;
+    }
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        std::string subPath = combinePath(path, entry->d_name);
+        count += existsDirectory(subPath) ? countFiles(subPath) : 1;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Size and modified time of the files (and directories) under path, by relative path
+struct FileStat
+{
+    bool dir;
+    uint64_t size;
+    int64_t modifiedTime;
+};
+
+static void listFiles(const std::string& path, const std::string& relativePath, std::map<std::string, FileStat>& files)
+{
+    DIR* dir = opendir(combinePath(path, relativePath).c_str());
+    if (NULL == dir)
+    {
+        return;
+    }
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        std::string subPath = relativePath.empty() ? std::string(entry->d_name) : combinePath(relativePath, entry->d_name);
+        FileStat& fileStat = files[subPath];
+        fileStat.dir = existsDirectory(combinePath(path, subPath));
+        fileStat.size = 0;
+        fileStat.modifiedTime = 0;
+        if (fileStat.dir)
+        {
+            listFiles(path, subPath, files);
+        }
+        else
+        {
+            getFileStat(combinePath(path, subPath), fileStat.size, fileStat.modifiedTime);
+        }
+    }
+    closedir(dir);
+}
+
+static void testDigestVectors()
+{
+    CHECK_EQ(sha1Hex(""), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    CHECK_EQ(sha1Hex("abc"), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    CHECK_EQ(sha1Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"), "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    CHECK_EQ(sha1Hex(std::string(1000000, 'a')), "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+
+    CHECK_EQ(md5Hex(""), "d41d8cd98f00b204e9800998ecf8427e");
+    CHECK_EQ(md5Hex("abc"), "900150983cd24fb0d6963f7d28e17f72");
+    CHECK_EQ(md5Hex("message digest"), "f96b697d7cb7938d525a2f31aaf161d0");
+    CHECK_EQ(md5Hex(std::string(1000000, 'a')), "7707d6ae4e027c70eea2a935c2296f21");
+
+    // Fed in pieces which don't line up with the blocks
+    std::string data(10000, 'x');
+    Sha1Digest digest;
+    for (size_t offset = 0; offset < data.size(); offset += 37)
+    {
+        digest.update(data.c_str() + offset, std::min(static_cast<size_t>(37), data.size() - offset));
+    }
+    unsigned char value[Sha1Digest::DIGEST_LENGTH];
+    digest.finish(value);
+    CHECK_EQ(toHexString(value, Sha1Digest::DIGEST_LENGTH), sha1Hex(data));
+}
+
+static void checkSha1Batch()
+{
+    Sha1Batch batch;
+    std::vector<std::string> messages;
+    for (int idx = 0; idx < 300; ++idx)
+    {
+        // 55/56/64 bytes are the padding edges
+        std::string message = "AppDomain-com.test.app-" + std::string(static_cast<size_t>(idx % 130), 'p') + std::to_string(idx);
+        messages.push_back(message);
+        size_t index = batch.add(message.c_str(), message.size() / 2);
+        batch.append(message.c_str() + message.size() / 2, message.size() - message.size() / 2);
+        CHECK_EQ(index, static_cast<size_t>(idx));
+    }
+    batch.compute();
+    CHECK_EQ(batch.size(), messages.size());
+    for (size_t idx = 0; idx < messages.size(); ++idx)
+    {
+        CHECK_EQ(batch.getHexDigest(idx), sha1Hex(messages[idx]));
+    }
+
+    batch.clear();
+    CHECK(batch.empty());
+}
+
+static void testSha1Batch()
+{
+    // The SHA-NI path wins on the CPUs which have it, mask it to run the AVX2 lanes as well
+    unsigned int simd = getDigestSimd();
+    checkSha1Batch();
+    if ((simd & DIGEST_SIMD_AVX2) != 0)
+    {
+        setDigestSimdMask(DIGEST_SIMD_AVX2);
+        CHECK_EQ(getDigestSimd(), static_cast<unsigned int>(DIGEST_SIMD_AVX2));
+        checkSha1Batch();
+    }
+    else
+    {
+        printf("sha1_batch: no AVX2, the lanes are not covered\n");
+    }
+    setDigestSimdMask(0);
+    CHECK_EQ(getDigestSimd(), 0u);
+    checkSha1Batch();
+    setDigestSimdMask(DIGEST_SIMD_ALL);
+}
+
+static void testFileSystem()
+{
+    std::string root = combinePath(g_tempPath, "fs");
+    CHECK(makeDirectory(root));
+
+    std::string data;
+    for (int idx = 0; idx < 300000; ++idx)
+    {
+        data += static_cast<char>(idx * 31);
+    }
+    std::string src = combinePath(root, "src.bin");
+    CHECK(writeFile(src, data));
+    CHECK_EQ(getFileSize(src), data.size());
+
+    std::string chunked;
+    size_t numberOfChunks = 0;
+    CHECK(readFile(src, 4096, [&chunked, &numberOfChunks](const unsigned char* chunk, size_t length) {
+        chunked.append(reinterpret_cast<const char *>(chunk), length);
+        ++numberOfChunks;
+        return true;
+    }));
+    CHECK(chunked == data);
+    CHECK_EQ(numberOfChunks, (data.size() + 4095) / 4096);
+
+    CopyFileMethod method = COPY_FILE_NONE;
+    std::string copied = combinePath(root, "copied.bin");
+    CHECK(copyFile(src, copied, true, &method));
+    CHECK(method != COPY_FILE_NONE);
+    CHECK(readFile(copied) == data);
+
+    std::string linked = combinePath(root, "linked.bin");
+    CHECK(linkFile(src, linked, &method));
+    CHECK(readFile(linked) == data);
+
+    uint64_t observed = 0;
+    std::string observedCopy = combinePath(root, "observed.bin");
+    CHECK(copyFileInChunks(src, observedCopy, 65536, [&observed](const unsigned char*, size_t length) {
+        observed += length;
+    }));
+    CHECK_EQ(observed, static_cast<uint64_t>(data.size()));
+    CHECK(readFile(observedCopy) == data);
+
+#ifdef __linux__
+    // procfs reports 0 bytes and copy_file_range/sendfile copy nothing, the copy has to fall back to read/write
+    std::string procData;
+    CHECK(readFile("/proc/version", 4096, [&procData](const unsigned char* chunk, size_t length) {
+        procData.append(reinterpret_cast<const char *>(chunk), length);
+        return true;
+    }));
+    CHECK(!procData.empty());
+    std::string procCopy = combinePath(root, "version.txt");
+    CHECK(copyFile("/proc/version", procCopy, true, &method));
+    CHECK_EQ(method, COPY_FILE_READ_WRITE);
+    CHECK(readFile(procCopy) == procData);
+#endif
+
+    MappedFile mapped;
+    CHECK(mapped.open(src));
+    CHECK_EQ(mapped.getSize(), data.size());
+    CHECK(mapped.getData() != NULL && std::memcmp(mapped.getData(), data.c_str(), data.size()) == 0);
+}
+
+static void testPlistScanner()
+{
+    // Applications sorts before the header keys and holds the same key names, they must not be taken
+    std::string plist = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n<dict>\n"
+        "\t<key>Applications</key>\n\t<dict>\n"
+        "\t\t<key>com.test.app</key>\n\t\t<dict>\n"
+        "\t\t\t<key>Device Name</key>\n\t\t\t<string>Nested</string>\n"
+        "\t\t\t<key>List</key>\n\t\t\t<array>\n\t\t\t\t<dict/>\n\t\t\t\t<array><integer>1</integer></array>\n\t\t\t</array>\n"
+        "\t\t\t<key>iTunesMetadata</key>\n\t\t\t<data>\n\t\t\tYnBsaXN0MDA=\n\t\t\t</data>\n"
+        "\t\t</dict>\n\t</dict>\n"
+        "\t<key>Device Name</key>\n\t<string>Test &amp; iPhone</string>\n"
+        "\t<key>Last Backup Date</key>\n\t<date>2001-01-02T00:00:00Z</date>\n"
+        "\t<key>Product Version</key>\n\t<string>15.4</string>\n"
+        "</dict>\n</plist>\n";
+    std::vector<std::string> keys;
+    keys.push_back("Device Name");
+    keys.push_back("Last Backup Date");
+    keys.push_back("Product Version");
+    keys.push_back("Missing");
+    std::map<std::string, PlistScanner::Value> values;
+    CHECK(PlistScanner::scan(reinterpret_cast<const unsigned char *>(plist.c_str()), plist.size(), keys, values));
+    CHECK_EQ(values["Device Name"].str, "Test & iPhone");
+    CHECK_EQ(values["Product Version"].str, "15.4");
+    CHECK(values["Last Backup Date"].type == PlistScanner::Value::VALUE_DATE);
+    CHECK(values["Last Backup Date"].real == 86400.0);
+    CHECK(values["Missing"].type == PlistScanner::Value::VALUE_NONE);
+}
+
+static void testSqliteBackup()
+{
+    std::string root = combinePath(g_tempPath, "sqlite");
+    CHECK(makeBackup(root, false, 3, 120));
+
+    const std::string domain = getSyntheticDomain(1);
+    ITunesDb db(root, "Manifest.db");
+    std::vector<std::string> domains(1, domain);
+    CHECK(db.load(domains, false));
+    const ITunesFile* file = db.findITunesFile(domain, getFilePath(7));
+    CHECK(checkBackupFile(db, file));
+    CHECK(db.findITunesFile(domain, "Documents/missing.dat") == NULL);
+    CHECK(db.findITunesFile(getSyntheticDomain(0), getFilePath(7)) == NULL);
+
+    ITunesDb::VerifyReport report;
+    CHECK(db.verify(domains, "", 2, report));
+    CHECK_EQ(report.numberOfFiles, static_cast<size_t>(120));
+    CHECK_EQ(report.numberOfMatches, static_cast<size_t>(120));
+    CHECK(report.issues.empty());
+
+    std::string outputPath = combinePath(g_tempPath, "sqlite-export");
+    CHECK(makeDirectory(outputPath));
+    size_t numberOfProgressCalls = 0;
+    bool done = false;
+    db.setProgressHandler([&numberOfProgressCalls, &done](size_t numberOfProcessedFiles, size_t numberOfFiles, bool finished) {
+        ++numberOfProgressCalls;
+        done = finished && numberOfProcessedFiles == numberOfFiles;
+    });
+    db.setIncrementalExport(true);
+    ITunesDb::ExportStats stats;
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(120));
+    CHECK_EQ(stats.numberOfFailures, static_cast<size_t>(0));
+    CHECK(numberOfProgressCalls >= 1 && done);
+    file = db.findITunesFile(domain, getFilePath(119));
+    CHECK(file != NULL);
+    if (NULL != file)
+    {
+        CHECK(readFile(combinePath(outputPath, domain, getFilePath(119))) == readFile(db.getRealPath(file)));
+    }
+    db.setProgressHandler(ITunesDb::ProgressHandler());
+
+    // The second export finds all the files unchanged
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(0));
+    CHECK_EQ(stats.numberOfSkippedFiles, static_cast<size_t>(120));
+    CHECK(db.verify(domains, outputPath, 2, report));
+    CHECK_EQ(report.numberOfMatches, static_cast<size_t>(120));
+    CHECK(report.issues.empty());
+
+    // More domains than the 999 variables of old sqlite3, they are filtered with the code
+    std::vector<std::string> manyDomains(domains);
+    for (int idx = 0; idx < 1000; ++idx)
+    {
+        manyDomains.push_back("AppDomain-com.test.none" + std::to_string(idx));
+    }
+    CHECK(db.verify(manyDomains, "", 2, report));
+    CHECK_EQ(report.numberOfFiles, static_cast<size_t>(120));
+
+    // Subset backup of app2: the payloads, Manifest.db and the 3 plists
+    std::string copyPath = combinePath(g_tempPath, "sqlite-copy");
+    std::vector<std::string> bundleIds(1, getSyntheticBundleId(2));
+    CHECK(db.copy(copyPath, "subset", bundleIds));
+    std::string subsetPath = combinePath(copyPath, "Backup", "subset");
+    CHECK_EQ(countFiles(subsetPath), static_cast<size_t>(120 + 4));
+
+    ITunesDb subset(subsetPath, "Manifest.db");
+    std::vector<std::string> subsetDomains;
+    subsetDomains.push_back(getSyntheticDomain(1));
+    subsetDomains.push_back(getSyntheticDomain(2));
+    CHECK(subset.load(subsetDomains, false));
+    CHECK(checkBackupFile(subset, subset.findITunesFile(getSyntheticDomain(2), getFilePath(3))));
+    CHECK(subset.findITunesFile(getSyntheticDomain(1), getFilePath(3)) == NULL);
+
+    // 3 variables per app, more than 999 with 400 apps
+    for (int idx = 0; idx < 399; ++idx)
+    {
+        bundleIds.push_back("com.test.none" + std::to_string(idx));
+    }
+    CHECK(db.copy(copyPath, "many", bundleIds, 1));
+    CHECK_EQ(countFiles(combinePath(copyPath, "Backup", "many")), static_cast<size_t>(120 + 4));
+
+    // Corrupt a file of the backup
+    file = db.findITunesFile(domain, getFilePath(7));
+    if (NULL != file)
+    {
+        CHECK(writeFile(db.getRealPath(file), std::string("corrupted")));
+    }
+    CHECK(db.verify(domains, "", 2, report));
+    CHECK_EQ(report.issues.size(), static_cast<size_t>(1));
+    if (!report.issues.empty())
+    {
+        CHECK_EQ(report.issues[0].status, ITunesDb::VERIFY_DIGEST_MISMATCH);
+        CHECK_EQ(report.issues[0].relativePath, getFilePath(7));
+    }
+}
+
+static void testMbdbBackup()
+{
+    std::string root = combinePath(g_tempPath, "mbdb");
+    CHECK(makeBackup(root, true, 3, 80));
+
+    const std::string domain = getSyntheticDomain(0);
+    ITunesDb db(root, "Manifest.mbdb");
+    std::vector<std::string> domains(1, domain);
+    CHECK(db.load(domains, false));
+    const ITunesFile* file = db.findITunesFile(domain, getFilePath(5));
+    CHECK(file != NULL);
+    if (NULL != file)
+    {
+        // Manifest.mbdb holds the metadata, there is no blob
+        std::string content = readFile(db.getRealPath(file));
+        CHECK_EQ(file->size, content.size());
+        CHECK(file->modifiedTime >= 1600000000u);
+        CHECK(file->digestLength == Sha1Digest::DIGEST_LENGTH && toHexString(file->digest, file->digestLength) == sha1Hex(content));
+    }
+
+    ITunesDb::VerifyReport report;
+    CHECK(db.verify(domains, "", 2, report));
+    CHECK_EQ(report.numberOfFiles, static_cast<size_t>(80));
+    CHECK_EQ(report.numberOfMatches, static_cast<size_t>(80));
+    CHECK(report.issues.empty());
+
+    // The second export finds all the files unchanged
+    std::string outputPath = combinePath(g_tempPath, "mbdb-export");
+    CHECK(makeDirectory(outputPath));
+    db.setIncrementalExport(true);
+    ITunesDb::ExportStats stats;
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(80));
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(0));
+    CHECK_EQ(stats.numberOfSkippedFiles, static_cast<size_t>(80));
+
+    // Corrupt a file of the backup
+    if (NULL != file)
+    {
+        CHECK(writeFile(db.getRealPath(file), std::string("corrupted")));
+    }
+    CHECK(db.verify(domains, "", 2, report));
+    CHECK_EQ(report.issues.size(), static_cast<size_t>(1));
+    if (!report.issues.empty())
+    {
+        CHECK_EQ(report.issues[0].status, ITunesDb::VERIFY_DIGEST_MISMATCH);
+        CHECK_EQ(report.issues[0].relativePath, getFilePath(5));
+    }
+
+    // The payloads, Manifest.mbdb and the 3 plists
+    std::string copyPath = combinePath(g_tempPath, "mbdb-copy");
+    std::vector<std::string> bundleIds(1, getSyntheticBundleId(1));
+    CHECK(db.copy(copyPath, "subset", bundleIds));
+    CHECK_EQ(countFiles(combinePath(copyPath, "Backup", "subset")), static_cast<size_t>(80 + 4));
+    CHECK(db.copy(copyPath, "serial", bundleIds, 1));
+    CHECK_EQ(countFiles(combinePath(copyPath, "Backup", "serial")), static_cast<size_t>(80 + 4));
+}
+
+// LOADING_METADATA decodes the blob and drops it, LOADING_PATH_ONLY doesn't read it
+static void testLoadingModes()
+{
+    std::string root = combinePath(g_tempPath, "loading-modes");
+    CHECK(makeBackup(root, false, 2, 100));
+
+    const std::string domain = getSyntheticDomain(1);
+    ITunesDb blobDb(root, "Manifest.db");
+    CHECK(blobDb.load(domain));
+    ITunesDb metadataDb(root, "Manifest.db");
+    metadataDb.setLoadingMode(ITunesDb::LOADING_METADATA);
+    CHECK(metadataDb.load(domain));
+    ITunesDb pathDb(root, "Manifest.db");
+    pathDb.setLoadingMode(ITunesDb::LOADING_PATH_ONLY);
+    CHECK(pathDb.load(domain));
+
+    size_t numberOfFiles = 0;
+    ITunesFileRange range = blobDb.getFiles(domain);
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        const ITunesFile* file = *it;
+        const ITunesFile* metadataFile = metadataDb.findITunesFile(domain, file->relativePath);
+        const ITunesFile* pathFile = pathDb.findITunesFile(domain, file->relativePath);
+        CHECK(NULL != metadataFile && NULL != pathFile);
+        if (NULL == metadataFile || NULL == pathFile)
+        {
+            continue;
+        }
+        CHECK_EQ(std::string(metadataFile->fileId), std::string(file->fileId));
+        CHECK_EQ(std::string(pathFile->fileId), std::string(file->fileId));
+        CHECK_EQ(metadataFile->flags, file->flags);
+        CHECK_EQ(pathFile->flags, file->flags);
+
+        // Only the paths
+        CHECK(NULL == pathFile->blob && 0 == pathFile->blobLength && !pathFile->blobParsed);
+        CHECK(0 == pathFile->size && 0 == pathFile->modifiedTime && NULL == pathFile->digest);
+        CHECK(!ITunesDb::parseFileInfo(pathFile));
+        if (file->isDir())
+        {
+            continue;
+        }
+
+        // The blob is dropped and its metadata kept
+        CHECK(NULL != file->blob && file->blobLength > 0);
+        CHECK(NULL == metadataFile->blob && 0 == metadataFile->blobLength && metadataFile->blobParsed);
+        CHECK(ITunesDb::parseFileInfo(file));
+        CHECK(ITunesDb::parseFileInfo(metadataFile));
+        CHECK_EQ(metadataFile->size, file->size);
+        CHECK_EQ(metadataFile->modifiedTime, file->modifiedTime);
+        CHECK_EQ(metadataFile->birthTime, file->birthTime);
+        CHECK_EQ(metadataFile->mode, file->mode);
+        CHECK(metadataFile->digestLength == Sha1Digest::DIGEST_LENGTH && file->digestLength == Sha1Digest::DIGEST_LENGTH);
+        if (NULL != metadataFile->digest && NULL != file->digest)
+        {
+            CHECK(std::memcmp(metadataFile->digest, file->digest, Sha1Digest::DIGEST_LENGTH) == 0);
+        }
+        CHECK(checkBackupFile(metadataDb, metadataFile));
+        ++numberOfFiles;
+    }
+    CHECK_EQ(numberOfFiles, static_cast<size_t>(100));
+}
+
+// fileId and relativePath of the files of the domain loaded with the index (if indexPath isn't empty)
+static std::vector<std::string> loadMbdbFiles(const std::string& root, const std::string& indexPath, const std::string& domain)
+{
+    std::vector<std::string> files;
+    ITunesDb db(root, "Manifest.mbdb");
+    db.setMbdbIndexPath(indexPath);
+    if (!db.load(domain))
+    {
+        return files;
+    }
+    ITunesFileRange range = db.getFiles(domain);
+    for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+    {
+        files.push_back(std::string((*it)->fileId) + ":" + (*it)->relativePath);
+    }
+    return files;
+}
+
+// The index matches the current Manifest.mbdb of the backup
+static bool isMbdbIndexValid(const std::string& root, const std::string& indexPath)
+{
+    MbdbReader reader;
+    MbdbIndex index;
+    return reader.open(combinePath(root, "Manifest.mbdb")) && index.load(indexPath, reader);
+}
+
+static int64_t getModifiedTime(const std::string& path)
+{
+    uint64_t size = 0;
+    int64_t modifiedTime = 0;
+    return getFileStat(path, size, modifiedTime) ? modifiedTime : -1;
+}
+
+static void testMbdbIndex()
+{
+    std::string root = combinePath(g_tempPath, "mbdb-index");
+    CHECK(makeBackup(root, true, 3, 60));
+    const std::string domain = getSyntheticDomain(1);
+    std::string indexPath = combinePath(g_tempPath, "mbdb-index.idx");
+    std::vector<std::string> expectedFiles = loadMbdbFiles(root, "", domain);
+    CHECK_EQ(expectedFiles.size(), getNumberOfEntries(60));
+
+    // The first filtered load builds and saves the index
+    CHECK(loadMbdbFiles(root, indexPath, domain) == expectedFiles);
+    CHECK(isMbdbIndexValid(root, indexPath));
+
+    // The second one reads it without rebuilding it (which would update the time of the file)
+    updateFileTime(indexPath, 1000000000);
+    CHECK(loadMbdbFiles(root, indexPath, domain) == expectedFiles);
+    CHECK(loadMbdbFiles(root, indexPath, getSyntheticDomain(2)) == loadMbdbFiles(root, "", getSyntheticDomain(2)));
+    CHECK_EQ(getModifiedTime(indexPath), static_cast<int64_t>(1000000000));
+
+    // A corrupt or truncated index falls back to the full scan and is rebuilt
+    std::string data = readFile(indexPath);
+    std::string corruptData = data;
+    corruptData[0] = 'X';
+    CHECK(writeFile(indexPath, corruptData));
+    CHECK(loadMbdbFiles(root, indexPath, domain) == expectedFiles);
+    CHECK(isMbdbIndexValid(root, indexPath));
+    CHECK(writeFile(indexPath, data.substr(0, data.size() / 2)));
+    CHECK(!isMbdbIndexValid(root, indexPath));
+    CHECK(loadMbdbFiles(root, indexPath, domain) == expectedFiles);
+    CHECK(isMbdbIndexValid(root, indexPath));
+    CHECK_EQ(readFile(indexPath), data);
+
+    // Another Manifest.mbdb doesn't match the checksum of the index
+    updateFileTime(indexPath, 1000000000);
+    CHECK(makeBackup(root, true, 3, 70));
+    CHECK(!isMbdbIndexValid(root, indexPath));
+    expectedFiles = loadMbdbFiles(root, "", domain);
+    CHECK_EQ(expectedFiles.size(), getNumberOfEntries(70));
+    CHECK(loadMbdbFiles(root, indexPath, domain) == expectedFiles);
+    CHECK(isMbdbIndexValid(root, indexPath));
+    CHECK(getModifiedTime(indexPath) != static_cast<int64_t>(1000000000));
+}
+
+// A copy export over a link export must not write through the hard links into the backup
+static void testExportLink()
+{
+    std::string root = combinePath(g_tempPath, "export-link");
+    CHECK(makeBackup(root, false, 1, 20));
+
+    const std::string domain = getSyntheticDomain(0);
+    ITunesDb db(root, "Manifest.db");
+    std::vector<std::string> domains(1, domain);
+    CHECK(db.load(domains, false));
+    std::vector<std::string> contents;
+    for (unsigned int idx = 0; idx < 20; ++idx)
+    {
+        const ITunesFile* file = db.findITunesFile(domain, getFilePath(idx));
+        CHECK(file != NULL);
+        contents.push_back(NULL == file ? std::string() : readFile(db.getRealPath(file)));
+    }
+
+    std::string outputPath = combinePath(g_tempPath, "export-link-output");
+    CHECK(makeDirectory(outputPath));
+    ITunesDb::ExportStats stats;
+    db.setExportMethod(ITunesDb::EXPORT_LINK);
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(20));
+    // The links of the first run are unchanged, so they are skipped
+    db.setIncrementalExport(true);
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(0));
+    CHECK_EQ(stats.numberOfSkippedFiles, static_cast<size_t>(20));
+    CHECK(db.exportFiles(db.getFiles(domain), combinePath(outputPath, domain), 2, &stats));
+    CHECK_EQ(stats.numberOfSkippedFiles, static_cast<size_t>(20));
+    db.setIncrementalExport(false);
+    db.setExportMethod(ITunesDb::EXPORT_COPY);
+    CHECK(db.exportStreaming(domains, outputPath, 2, &stats));
+    CHECK_EQ(stats.numberOfFiles, static_cast<size_t>(20));
+
+    const ITunesFile* file = db.findITunesFile(domain, getFilePath(3));
+    if (NULL != file)
+    {
+        std::string exportedPath = combinePath(outputPath, domain, getFilePath(3));
+        CHECK(linkFile(db.getRealPath(file), exportedPath));
+        CHECK(copyFileInChunks(db.getRealPath(file), exportedPath, 4096, [](const unsigned char*, size_t) {}));
+    }
+    for (unsigned int idx = 0; idx < 20; ++idx)
+    {
+        file = db.findITunesFile(domain, getFilePath(idx));
+        if (NULL != file)
+        {
+            CHECK(readFile(db.getRealPath(file)) == contents[idx]);
+        }
+        CHECK(readFile(combinePath(outputPath, domain, getFilePath(idx))) == contents[idx]);
+    }
+}
+
+// Exposes the export of a single file to the reference export of the tests
+class ExportTestDb : public ITunesDb
+{
+public:
+    ExportTestDb(const std::string& rootPath, const std::string& manifestFileName) : ITunesDb(rootPath, manifestFileName)
+    {
+    }
+
+    // The serial export the apps did before exportFiles: enumFiles + exportFile
+    bool exportSerially(const std::string& domain, const std::string& outputPath, ExportStats& stats) const
+    {
+        stats = ExportStats();
+        enumFiles(domain, [&](const ITunesDb*, const ITunesFile* file) {
+            std::string destPath = combinePath(outputPath, file->relativePath);
+            if (file->isDir())
+            {
+                ++stats.numberOfDirectories;
+                if (!existsDirectory(destPath) && !makeDirectory(destPath))
+                {
+                    ++stats.numberOfFailures;
+                }
+                return true;
+            }
+            bool skipped = false;
+            if (!exportFile(file, outputPath, stats.bytes, skipped))
+            {
+                ++stats.numberOfFailures;
+            }
+            else
+            {
+                skipped ? ++stats.numberOfSkippedFiles : ++stats.numberOfFiles;
+            }
+            return true;
+        });
+        return stats.numberOfFailures == 0;
+    }
+};
+
+static void checkExportStats(const ITunesDb::ExportStats& stats, const ITunesDb::ExportStats& expectedStats)
+{
+    CHECK_EQ(stats.numberOfFiles, expectedStats.numberOfFiles);
+    CHECK_EQ(stats.numberOfDirectories, expectedStats.numberOfDirectories);
+    CHECK_EQ(stats.numberOfFailures, expectedStats.numberOfFailures);
+    CHECK_EQ(stats.numberOfSkippedFiles, expectedStats.numberOfSkippedFiles);
+    CHECK_EQ(stats.bytes, expectedStats.bytes);
+}
+
+// exportFiles with several jobs produces the same tree and stats as the serial export
+static void testExportFiles()
+{
+    std::string root = combinePath(g_tempPath, "export-files");
+    CHECK(makeBackup(root, false, 2, 300));
+
+    const std::string domain = getSyntheticDomain(1);
+    ExportTestDb db(root, "Manifest.db");
+    CHECK(db.load(domain));
+
+    std::string expectedPath = combinePath(g_tempPath, "export-files-serial");
+    std::string outputPath = combinePath(g_tempPath, "export-files-parallel");
+    CHECK(makeDirectory(expectedPath) && makeDirectory(outputPath));
+    ITunesDb::ExportStats expectedStats;
+    CHECK(db.exportSerially(domain, expectedPath, expectedStats));
+    CHECK_EQ(expectedStats.numberOfFiles, static_cast<size_t>(300));
+    ITunesDb::ExportStats stats;
+    CHECK(db.exportFiles(db.getFiles(domain), outputPath, 4, &stats));
+    checkExportStats(stats, expectedStats);
+
+    std::map<std::string, FileStat> expectedFiles;
+    std::map<std::string, FileStat> files;
+    listFiles(expectedPath, "", expectedFiles);
+    listFiles(outputPath, "", files);
+    CHECK_EQ(files.size(), expectedFiles.size());
+    CHECK_EQ(files.size(), getNumberOfEntries(300) - 1);
+    for (std::map<std::string, FileStat>::const_iterator it = expectedFiles.cbegin(); it != expectedFiles.cend(); ++it)
+    {
+        std::map<std::string, FileStat>::const_iterator it2 = files.find(it->first);
+        CHECK(it2 != files.cend());
+        if (it2 != files.cend())
+        {
+            CHECK_EQ(it2->second.dir, it->second.dir);
+            CHECK_EQ(it2->second.size, it->second.size);
+            if (!it->second.dir)
+            {
+                CHECK_EQ(it2->second.modifiedTime, it->second.modifiedTime);
+            }
+        }
+    }
+
+    // The incremental export skips the same files
+    db.setIncrementalExport(true);
+    CHECK(db.exportSerially(domain, expectedPath, expectedStats));
+    CHECK_EQ(expectedStats.numberOfSkippedFiles, static_cast<size_t>(300));
+    CHECK(db.exportFiles(db.getFiles(domain), outputPath, 4, &stats));
+    checkExportStats(stats, expectedStats);
+}
+
+static void testPathIndex()
+{
+    std::string root = combinePath(g_tempPath, "path-index");
+    CHECK(makeBackup(root, false, 3, 200));
+
+    std::vector<std::string> domains;
+    domains.push_back(getSyntheticDomain(0));
+    domains.push_back(getSyntheticDomain(1));
+    ITunesDb db(root, "Manifest.db");
+    CHECK(db.load(domains, false));
+    ITunesDb indexedDb(root, "Manifest.db");
+    indexedDb.setPathIndexEnabled(true);
+    CHECK(indexedDb.load(domains, false));
+
+    // The same files as the binary search
+    size_t numberOfFiles = 0;
+    for (std::vector<std::string>::const_iterator itDomain = domains.cbegin(); itDomain != domains.cend(); ++itDomain)
+    {
+        ITunesFileRange range = indexedDb.getFiles(*itDomain);
+        for (ITunesFilesConstIterator it = range.first; it != range.second; ++it)
+        {
+            const ITunesFile* file = indexedDb.findITunesFile(*itDomain, (*it)->relativePath);
+            CHECK(file == *it);
+            const ITunesFile* expectedFile = db.findITunesFile((*it)->relativePath);
+            file = indexedDb.findITunesFile((*it)->relativePath);
+            CHECK(NULL != file && NULL != expectedFile);
+            if (NULL != file && NULL != expectedFile)
+            {
+                CHECK_EQ(std::string(file->fileId), std::string(expectedFile->fileId));
+            }
+            ++numberOfFiles;
+        }
+    }
+    CHECK_EQ(numberOfFiles, 2 * getNumberOfEntries(200));
+
+    std::string path = getFilePath(7);
+    std::string windowsPath = path;
+    std::replace(windowsPath.begin(), windowsPath.end(), '/', '\\');
+    const ITunesFile* file = indexedDb.findITunesFile(getSyntheticDomain(1), path);
+    CHECK(file != NULL);
+    CHECK(indexedDb.findITunesFile(getSyntheticDomain(1), windowsPath) == file);
+    CHECK(indexedDb.findITunesFile(windowsPath) != NULL);
+    CHECK(indexedDb.findITunesFile(getSyntheticDomain(2), path) == NULL);
+    CHECK(indexedDb.findITunesFile(getSyntheticDomain(1), path.substr(0, path.size() - 1)) == NULL);
+    CHECK(indexedDb.findITunesFile(getSyntheticDomain(1), path + "2") == NULL);
+    CHECK(indexedDb.findITunesFile("Documents/missing.dat") == NULL);
+    // The root directory of the apps has an empty path
+    file = indexedDb.findITunesFile("");
+    CHECK(file != NULL && file->isDir() && db.findITunesFile("") != NULL);
+
+    // Without domains, only the paths are indexed
+    ITunesDb allDb(root, "Manifest.db");
+    allDb.setPathIndexEnabled(true);
+    CHECK(allDb.load());
+    file = allDb.findITunesFile(getFilePath(199));
+    CHECK(checkBackupFile(allDb, file));
+    CHECK(allDb.findITunesFile(getSyntheticDomain(0), getFilePath(199)) == NULL);
+}
+
+class ManifestCacheTest : public ManifestCache
+{
+public:
+    explicit ManifestCacheTest(const std::string& path) : ManifestCache(path)
+    {
+    }
+
+    size_t getNumberOfEntries() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+};
+
+// Parse the backups of the folder with the cache
+static size_t parseBackups(const std::string& path, const std::string& cachePath)
+{
+    ManifestParser parser(path, false);
+    parser.setCachePath(cachePath);
+    std::vector<BackupManifest> manifests;
+    return parser.parse(manifests) ? manifests.size() : 0;
+}
+
+static void testManifestCache()
+{
+    std::string backupsPath = combinePath(g_tempPath, "cache-backups");
+    std::string backupPath1 = combinePath(backupsPath, "backup1");
+    std::string backupPath2 = combinePath(backupsPath, "backup2");
+    CHECK(makeBackup(backupPath1, false, 1, 1));
+    CHECK(makeBackup(backupPath2, false, 1, 1));
+    std::string cachePath = combinePath(g_tempPath, "cache-backups.bin");
+    CHECK_EQ(parseBackups(backupsPath, cachePath), static_cast<size_t>(2));
+
+    // Hit while the plists are unchanged
+    BackupManifest manifest;
+    {
+        ManifestCacheTest cache(cachePath);
+        CHECK(cache.load());
+        CHECK_EQ(cache.getNumberOfEntries(), static_cast<size_t>(2));
+        CHECK(cache.find(backupPath1, false, manifest));
+        CHECK_EQ(manifest.getPath(), backupPath1);
+        CHECK(cache.find(backupPath2, false, manifest));
+        CHECK_EQ(manifest.getPath(), backupPath2);
+    }
+
+    // Miss once the size of Info.plist or the time of Manifest.plist changes
+    std::string infoPlistPath = combinePath(backupPath1, "Info.plist");
+    CHECK(writeFile(infoPlistPath, readFile(infoPlistPath) + "\n"));
+    std::string manifestPlistPath = combinePath(backupPath2, "Manifest.plist");
+    updateFileTime(manifestPlistPath, static_cast<time_t>(getModifiedTime(manifestPlistPath) + 10));
+    {
+        ManifestCacheTest cache(cachePath);
+        CHECK(cache.load());
+        CHECK(!cache.find(backupPath1, false, manifest));
+        CHECK(!cache.find(backupPath2, false, manifest));
+    }
+    // They are parsed again and replaced in the cache
+    CHECK_EQ(parseBackups(backupsPath, cachePath), static_cast<size_t>(2));
+    {
+        ManifestCacheTest cache(cachePath);
+        CHECK(cache.load());
+        CHECK_EQ(cache.getNumberOfEntries(), static_cast<size_t>(2));
+        CHECK(cache.find(backupPath1, false, manifest));
+        CHECK(cache.find(backupPath2, false, manifest));
+    }
+
+    // Deleted backups are dropped on save
+    CHECK(deleteDirectory(backupPath2));
+    updateFileTime(infoPlistPath, static_cast<time_t>(getModifiedTime(infoPlistPath) + 10));
+    CHECK_EQ(parseBackups(backupsPath, cachePath), static_cast<size_t>(1));
+    {
+        ManifestCacheTest cache(cachePath);
+        CHECK(cache.load());
+        CHECK_EQ(cache.getNumberOfEntries(), static_cast<size_t>(1));
+        CHECK(cache.find(backupPath1, false, manifest));
+    }
+
+    // A corrupt or truncated file is ignored and rewritten by the next parser
+    std::string data = readFile(cachePath);
+    std::string corruptData = data;
+    corruptData[4] = 'X';
+    const std::string invalidFiles[] = { corruptData, data.substr(0, data.size() - 5), data.substr(0, data.size() / 2), std::string() };
+    for (size_t idx = 0; idx < sizeof(invalidFiles) / sizeof(std::string); ++idx)
+    {
+        CHECK(writeFile(cachePath, invalidFiles[idx]));
+        ManifestCacheTest cache(cachePath);
+        CHECK(!cache.load());
+        CHECK_EQ(cache.getNumberOfEntries(), static_cast<size_t>(0));
+        CHECK(!cache.find(backupPath1, false, manifest));
+        CHECK_EQ(parseBackups(backupsPath, cachePath), static_cast<size_t>(1));
+        CHECK(readFile(cachePath) == data);
+    }
+}
+
+// Paths of the backups parse() returns and the handler receives
+static bool parseBackups(const std::string& path, unsigned int jobs, std::vector<std::string>& paths, std::vector<std::string>& handledPaths)
+{
+    ManifestParser parser(path, false);
+    parser.setJobs(jobs);
+    std::vector<BackupManifest> manifests;
+    bool result = parser.parse(manifests, [&handledPaths](const BackupManifest& manifest) {
+        handledPaths.push_back(manifest.getPath());
+    });
+    for (std::vector<BackupManifest>::const_iterator it = manifests.cbegin(); it != manifests.cend(); ++it)
+    {
+        paths.push_back(it->getPath());
+    }
+    return result;
+}
+
+// The parallel discovery keeps the order of the folders, the invalid ones are left out
+static void testParseDirectory()
+{
+    std::string backupsPath = combinePath(g_tempPath, "parse-backups");
+    const unsigned int numberOfBackups = 12;
+    for (unsigned int idx = 0; idx < numberOfBackups; ++idx)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "backup%02u", idx);
+        std::string backupPath = combinePath(backupsPath, name);
+        CHECK(makeBackup(backupPath, false, 1, 1));
+        if (idx == 4)
+        {
+            // Not a backup
+            CHECK(deleteFile(combinePath(backupPath, "Manifest.plist")));
+        }
+        else if (idx == 7)
+        {
+            // A backup whose Info.plist can't be parsed
+            CHECK(writeFile(combinePath(backupPath, "Info.plist"), std::string("broken")));
+        }
+    }
+
+    std::vector<std::string> subDirectories;
+    CHECK(listSubDirectories(backupsPath, subDirectories));
+    std::vector<std::string> expectedPaths;
+    for (std::vector<std::string>::const_iterator it = subDirectories.cbegin(); it != subDirectories.cend(); ++it)
+    {
+        if (*it != "backup04" && *it != "backup07")
+        {
+            expectedPaths.push_back(combinePath(backupsPath, *it));
+        }
+    }
+    CHECK_EQ(expectedPaths.size(), static_cast<size_t>(numberOfBackups - 2));
+
+    std::vector<std::string> serialPaths;
+    std::vector<std::string> serialHandledPaths;
+    CHECK(parseBackups(backupsPath, 1, serialPaths, serialHandledPaths));
+    CHECK(serialPaths == expectedPaths);
+    CHECK(serialHandledPaths == expectedPaths);
+    for (unsigned int jobs = 2; jobs <= 8; jobs *= 2)
+    {
+        std::vector<std::string> paths;
+        std::vector<std::string> handledPaths;
+        CHECK(parseBackups(backupsPath, jobs, paths, handledPaths));
+        CHECK(paths == serialPaths);
+        CHECK(handledPaths == serialHandledPaths);
+    }
+}
+
+// The apps decoded by getApps() after parse() are saved by saveCache() and reused by the next parser
+static void testManifestCacheApps()
+{
+    std::string root = combinePath(g_tempPath, "cache-apps");
+    CHECK(makeBackup(root, false, 3, 1));
+    std::vector<BackupManifest::AppInfo> expectedApps;
+    if (!ManifestParser::parseApps(root, expectedApps))
+    {
+        printf("[SKIP] manifest_cache_apps: Info.plist can't be decoded without libplist\n");
+        return;
+    }
+    CHECK_EQ(expectedApps.size(), static_cast<size_t>(3));
+
+    std::string cachePath = combinePath(g_tempPath, "cache-apps.bin");
+    std::vector<BackupManifest> manifests;
+    {
+        ManifestParser parser(root, true);
+        parser.setCachePath(cachePath);
+        CHECK(parser.parse(manifests));
+        CHECK_EQ(manifests.size(), static_cast<size_t>(1));
+        if (!manifests.empty())
+        {
+            CHECK_EQ(manifests[0].getApps().size(), expectedApps.size());
+        }
+        CHECK(parser.saveCache());
+    }
+
+    // Same size and time: the stamp doesn't change and nothing can be decoded from the file any more
+    std::string infoPlistPath = combinePath(root, "Info.plist");
+    uint64_t size = 0;
+    int64_t modifiedTime = 0;
+    CHECK(getFileStat(infoPlistPath, size, modifiedTime));
+    CHECK(writeFile(infoPlistPath, std::string(static_cast<size_t>(size), ' ')));
+    updateFileTime(infoPlistPath, static_cast<time_t>(modifiedTime));
+
+    ManifestParser parser(root, true);
+    parser.setCachePath(cachePath);
+    manifests.clear();
+    CHECK(parser.parse(manifests));
+    CHECK_EQ(manifests.size(), static_cast<size_t>(1));
+    if (!manifests.empty())
+    {
+        const std::vector<BackupManifest::AppInfo>& apps = manifests[0].getApps();
+        CHECK_EQ(apps.size(), expectedApps.size());
+        for (size_t idx = 0; idx < apps.size() && idx < expectedApps.size(); ++idx)
+        {
+            CHECK_EQ(apps[idx].bundleId, expectedApps[idx].bundleId);
+            CHECK_EQ(apps[idx].name, expectedApps[idx].name);
+            CHECK_EQ(apps[idx].bundleVersion, expectedApps[idx].bundleVersion);
+        }
+    }
+}
+
+struct TestCase
+{
+    const char* name;
+    void (*function)();
+};
+
+int main(int argc, char* argv[])
+{
+    const TestCase testCases[] = {
+        {"digest_vectors", testDigestVectors},
+        {"sha1_batch", testSha1Batch},
+        {"file_system", testFileSystem},
+        {"plist_scanner", testPlistScanner},
+        {"sqlite_backup", testSqliteBackup},
+        {"loading_modes", testLoadingModes},
+        {"mbdb_backup", testMbdbBackup},
+        {"mbdb_index", testMbdbIndex},
+        {"export_link", testExportLink},
+        {"export_files", testExportFiles},
+        {"path_index", testPathIndex},
+        {"parse_directory", testParseDirectory},
+        {"manifest_cache", testManifestCache},
+        {"manifest_cache_apps", testManifestCacheApps},
+    };
+
+    char tempPath[] = "/tmp/itunesbackup_tests.XXXXXX";
+    if (NULL == mkdtemp(tempPath))
+    {
+        fprintf(stderr, "Failed to create the temporary folder\n");
+        return 1;
+    }
+    g_tempPath = tempPath;
+
+    int numberOfTests = 0;
+    for (size_t idx = 0; idx < sizeof(testCases) / sizeof(TestCase); ++idx)
+    {
+        // Optional argument: run the tests whose name contains it
+        if (argc > 1 && std::strstr(testCases[idx].name, argv[1]) == NULL)
+        {
+            continue;
+        }
+        int failures = g_failures;
+        testCases[idx].function();
+        printf("[%s] %s\n", g_failures == failures ? "PASS" : "FAIL", testCases[idx].name);
+        ++numberOfTests;
+    }
+
+    deleteDirectory(g_tempPath);
+    printf("%d tests, %d failed checks\n", numberOfTests, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,747 @@
+//
+//  BackupGenerator.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include "BackupGenerator.h"
+#include "Digest.h"
+#include "FileSystem.h"
+
+// Fixed point with 30 fractional bits. The sizes are computed with integers only, libm and the FPU
+// (e.g. fused multiply-add on arm64) would round differently from one platform to another
+#define FIXED_SHIFT     30
+#define FIXED_ONE       (INT64_C(1) << FIXED_SHIFT)
+#define LOG2E_Q20       INT64_C(1512775)        // log2(e) with 20 fractional bits
+#define LN2_Q30         INT64_C(744261118)      // ln(2) with 30 fractional bits
+
+// splitmix64, the same sequence on every platform (the distributions of <random> are implementation-defined)
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : m_state(seed)
+    {
+    }
+
+    uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Approximately standard normal in fixed point: the sum of 12 uniforms of [0, 1) minus 6 (Irwin-Hall), so within [-6, 6]
+    int64_t nextGaussianFixed()
+    {
+        int64_t sum = 0;
+        for (int idx = 0; idx < 12; ++idx)
+        {
+            sum += static_cast<int64_t>(next() >> (64 - FIXED_SHIFT));
+        }
+        return sum - 6 * FIXED_ONE;
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// Binary plist (bplist00) writer, the objects are serialized by finish() when the size of the refs is known
+class BplistWriter
+{
+public:
+    size_t addInteger(uint64_t value)
+    {
+        std::string bytes;
+        int length = value <= 0xFF ? 1 : (value <= 0xFFFF ? 2 : (value <= 0xFFFFFFFFULL ? 4 : 8));
+        bytes += static_cast<char>(0x10 | (length == 1 ? 0 : (length == 2 ? 1 : (length == 4 ? 2 : 3))));
+        appendBigEndian(bytes, value, length);
+        return addObject(bytes);
+    }
+
+    size_t addString(const std::string& value)
+    {
+        std::string bytes = encodeLength(0x50, value.size());
+        bytes += value;
+        return addObject(bytes);
+    }
+
+    size_t addData(const unsigned char* data, size_t length)
+    {
+        std::string bytes = encodeLength(0x40, length);
+        bytes.append(reinterpret_cast<const char *>(data), length);
+        return addObject(bytes);
+    }
+
+    size_t addUid(uint64_t value)
+    {
+        std::string bytes;
+        int length = value <= 0xFF ? 1 : (value <= 0xFFFF ? 2 : 4);
+        bytes += static_cast<char>(0x80 | (length - 1));
+        appendBigEndian(bytes, value, length);
+        return addObject(bytes);
+    }
+
+    size_t addArray(const std::vector<size_t>& refs)
+    {
+        Object object;
+        object.bytes = encodeLength(0xA0, refs.size());
+        object.refs = refs;
+        m_objects.push_back(object);
+        return m_objects.size() - 1;
+    }
+
+    size_t addDictionary(const std::vector<size_t>& keys, const std::vector<size_t>& values)
+    {
+        Object object;
+        object.bytes = encodeLength(0xD0, keys.size());
+        object.refs = keys;
+        object.refs.insert(object.refs.end(), values.cbegin(), values.cend());
+        m_objects.push_back(object);
+        return m_objects.size() - 1;
+    }
+
+    void clear()
+    {
+        m_objects.clear();
+    }
+
+    void finish(size_t topObject, std::string& output)
+    {
+        int refSize = m_objects.size() <= 0xFF ? 1 : (m_objects.size() <= 0xFFFF ? 2 : 4);
+        output.assign("bplist00", 8);
+        std::vector<uint64_t> offsets;
+        offsets.reserve(m_objects.size());
+        for (std::vector<Object>::const_iterator it = m_objects.cbegin(); it != m_objects.cend(); ++it)
+        {
+            offsets.push_back(output.size());
+            output += it->bytes;
+            for (std::vector<size_t>::const_iterator itRef = it->refs.cbegin(); itRef != it->refs.cend(); ++itRef)
+            {
+                appendBigEndian(output, *itRef, refSize);
+            }
+        }
+        uint64_t offsetTableOffset = output.size();
+        int offsetSize = offsetTableOffset <= 0xFF ? 1 : (offsetTableOffset <= 0xFFFF ? 2 : 4);
+        for (std::vector<uint64_t>::const_iterator it = offsets.cbegin(); it != offsets.cend(); ++it)
+        {
+            appendBigEndian(output, *it, offsetSize);
+        }
+        output.append(6, '\0');
+        output += static_cast<char>(offsetSize);
+        output += static_cast<char>(refSize);
+        appendBigEndian(output, m_objects.size(), 8);
+        appendBigEndian(output, topObject, 8);
+        appendBigEndian(output, offsetTableOffset, 8);
+    }
+
+    static void appendBigEndian(std::string& output, uint64_t value, int length)
+    {
+        for (int idx = length - 1; idx >= 0; --idx)
+        {
+            output += static_cast<char>((value >> (idx * 8)) & 0xFF);
+        }
+    }
+
+private:
+    struct Object
+    {
+        std::string bytes;
+        std::vector<size_t> refs;
+    };
+
+    size_t addObject(const std::string& bytes)
+    {
+        Object object;
+        object.bytes = bytes;
+        m_objects.push_back(object);
+        return m_objects.size() - 1;
+    }
+
+    static std::string encodeLength(unsigned char marker, size_t length)
+    {
+        std::string bytes;
+        if (length < 15)
+        {
+            bytes += static_cast<char>(marker | length);
+            return bytes;
+        }
+        bytes += static_cast<char>(marker | 0x0F);
+        int size = length <= 0xFF ? 1 : (length <= 0xFFFF ? 2 : 4);
+        bytes += static_cast<char>(0x10 | (size == 1 ? 0 : (size == 2 ? 1 : 2)));
+        appendBigEndian(bytes, length, size);
+        return bytes;
+    }
+
+private:
+    std::vector<Object> m_objects;
+};
+
+struct SyntheticFile
+{
+    std::string domain;
+    std::string relativePath;
+    std::string fileId;
+    bool isDir;
+    uint64_t size;
+    unsigned int modifiedTime;
+    unsigned int birthTime;
+    unsigned char digest[Sha1Digest::DIGEST_LENGTH];
+};
+
+// NSKeyedArchiver of MBFile as in the file column of Manifest.db
+static void buildBlob(const GeneratorOptions& options, const SyntheticFile& file, uint64_t inode, BplistWriter& writer, std::string& blob)
+{
+    writer.clear();
+
+    std::vector<size_t> fileKeys;
+    std::vector<size_t> fileValues;
+    auto addValue = [&writer, &fileKeys, &fileValues](const char* key, size_t value) {
+        fileKeys.push_back(writer.addString(key));
+        fileValues.push_back(value);
+    };
+
+    // $objects: $null, MBFile, RelativePath, [Digest], [ExtendedAttributes], $class
+    size_t nullObject = writer.addString("$null");
+    size_t pathIndex = 2;
+    size_t nextIndex = 3;
+    bool hasDigest = options.blobShape == GeneratorOptions::BLOB_FULL && !file.isDir;
+    size_t digestIndex = hasDigest ? nextIndex++ : 0;
+    bool hasAttributes = options.blobShape == GeneratorOptions::BLOB_FULL && options.extendedAttributesSize > 0;
+    size_t attributesIndex = hasAttributes ? nextIndex++ : 0;
+    size_t classIndex = nextIndex++;
+
+    unsigned int mode = file.isDir ? 040755 : 0100644;
+    addValue("LastModified", writer.addInteger(file.modifiedTime));
+    addValue("Size", writer.addInteger(file.isDir ? 0 : file.size));
+    addValue("Mode", writer.addInteger(mode));
+    addValue("Flags", writer.addInteger(0));
+    addValue("Birth", writer.addInteger(file.birthTime));
+    addValue("RelativePath", writer.addUid(pathIndex));
+    if (options.blobShape == GeneratorOptions::BLOB_FULL)
+    {
+        addValue("LastStatusChange", writer.addInteger(file.modifiedTime));
+        addValue("InodeNumber", writer.addInteger(inode));
+        addValue("UserID", writer.addInteger(501));
+        addValue("GroupID", writer.addInteger(501));
+        addValue("ProtectionClass", writer.addInteger(file.isDir ? 0 : 3));
+        if (hasDigest)
+        {
+            addValue("Digest", writer.addUid(digestIndex));
+        }
+        if (hasAttributes)
+        {
+            addValue("ExtendedAttributes", writer.addUid(attributesIndex));
+        }
+    }
+    addValue("$class", writer.addUid(classIndex));
+    size_t fileObject = writer.addDictionary(fileKeys, fileValues);
+
+    std::vector<size_t> objects;
+    objects.push_back(nullObject);
+    objects.push_back(fileObject);
+    objects.push_back(writer.addString(file.relativePath));
+    if (hasDigest)
+    {
+        objects.push_back(writer.addData(file.digest, Sha1Digest::DIGEST_LENGTH));
+    }
+    if (hasAttributes)
+    {
+        std::vector<unsigned char> attributes(options.extendedAttributesSize, 0x5A);
+        objects.push_back(writer.addData(&attributes[0], attributes.size()));
+    }
+    std::vector<size_t> classes;
+    classes.push_back(writer.addString("MBFile"));
+    classes.push_back(writer.addString("NSObject"));
+    std::vector<size_t> classKeys;
+    std::vector<size_t> classValues;
+    classKeys.push_back(writer.addString("$classname"));
+    classValues.push_back(writer.addString("MBFile"));
+    classKeys.push_back(writer.addString("$classes"));
+    classValues.push_back(writer.addArray(classes));
+    objects.push_back(writer.addDictionary(classKeys, classValues));
+
+    std::vector<size_t> topKeys;
+    std::vector<size_t> topValues;
+    topKeys.push_back(writer.addString("root"));
+    topValues.push_back(writer.addUid(1));
+
+    std::vector<size_t> keys;
+    std::vector<size_t> values;
+    keys.push_back(writer.addString("$version"));
+    values.push_back(writer.addInteger(100000));
+    keys.push_back(writer.addString("$archiver"));
+    values.push_back(writer.addString("NSKeyedArchiver"));
+    keys.push_back(writer.addString("$top"));
+    values.push_back(writer.addDictionary(topKeys, topValues));
+    keys.push_back(writer.addString("$objects"));
+    values.push_back(writer.addArray(objects));
+    size_t root = writer.addDictionary(keys, values);
+
+    writer.finish(root, blob);
+}
+
+// value * 2^(exponent / 2^FIXED_SHIFT), capped at maxValue
+static uint64_t scaleByPowerOf2(uint64_t value, int64_t exponent, uint64_t maxValue)
+{
+    bool negative = exponent < 0;
+    uint64_t magnitude = static_cast<uint64_t>(negative ? -exponent : exponent);
+    uint64_t shift = magnitude >> FIXED_SHIFT;
+    int64_t fraction = static_cast<int64_t>(magnitude & (FIXED_ONE - 1));
+
+    // 2^fraction = e^(fraction * ln2) by its Taylor series, in [1, 2)
+    int64_t x = (fraction * LN2_Q30) >> FIXED_SHIFT;
+    int64_t term = FIXED_ONE;
+    int64_t factor = FIXED_ONE;
+    for (int n = 1; n <= 12 && term > 0; ++n)
+    {
+        term = ((term * x) >> FIXED_SHIFT) / n;
+        factor += term;
+    }
+    if (negative)
+    {
+        factor = (FIXED_ONE << FIXED_SHIFT) / factor;
+    }
+
+    // value * factor without overflowing 64 bits
+    uint64_t result = (value >> FIXED_SHIFT) * static_cast<uint64_t>(factor) + (((value & (FIXED_ONE - 1)) * static_cast<uint64_t>(factor)) >> FIXED_SHIFT);
+    if (negative)
+    {
+        return shift >= 64 ? 0 : (result >> shift);
+    }
+    if (shift >= 64 || result > (maxValue >> shift))
+    {
+        return maxValue;
+    }
+    return result << shift;
+}
+
+static uint64_t nextFileSize(const GeneratorOptions& options, Random& random)
+{
+    uint64_t param1 = options.sizeParam1 > 0 ? static_cast<uint64_t>(options.sizeParam1) : 0;
+    uint64_t size = param1;
+    if (options.sizeDistribution == GeneratorOptions::SIZE_UNIFORM)
+    {
+        uint64_t param2 = options.sizeParam2 > 0 ? static_cast<uint64_t>(options.sizeParam2) : 0;
+        size = param2 > param1 ? param1 + random.next() % (param2 - param1 + 1) : param1;
+    }
+    else if (options.sizeDistribution == GeneratorOptions::SIZE_LOGNORMAL)
+    {
+        // median * e^(sigma * gaussian) = median * 2^(sigma * gaussian * log2(e)), sigma with 20 fractional bits keeps the products in 64 bits
+        int64_t sigma = options.sizeParam2 > 0 ? static_cast<int64_t>(options.sizeParam2 * (1 << 20)) : 0;
+        int64_t exponent = ((sigma * (random.nextGaussianFixed() / (1 << 10))) / (1 << 10)) * LOG2E_Q20 / (1 << 20);
+        size = scaleByPowerOf2(param1, exponent, options.maxSize);
+    }
+    return size > options.maxSize ? options.maxSize : size;
+}
+
+// Deterministic content of the file, hashed for the digests and written as the payload
+static void fillContent(uint64_t seed, uint64_t index, std::vector<unsigned char>& content)
+{
+    Random random(seed ^ (index * 0xD1B54A32D192ED03ULL));
+    size_t idx = 0;
+    for (; idx + 8 <= content.size(); idx += 8)
+    {
+        // Little-endian on every platform
+        uint64_t value = random.next();
+        for (int byte = 0; byte < 8; ++byte, value >>= 8)
+        {
+            content[idx + byte] = static_cast<unsigned char>(value);
+        }
+    }
+    for (uint64_t value = random.next(); idx < content.size(); ++idx, value >>= 8)
+    {
+        content[idx] = static_cast<unsigned char>(value);
+    }
+}
+
+std::string getSyntheticDomain(unsigned int index)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "AppDomain-com.synthetic.app%03u", index);
+    return name;
+}
+
+std::string getSyntheticBundleId(unsigned int index)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "com.synthetic.app%03u", index);
+    return name;
+}
+
+std::string getSyntheticAppName(unsigned int index)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "Synthetic App %03u", index);
+    return name;
+}
+
+static std::string encodeBase64(const std::string& data)
+{
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    encoded.reserve((data.size() + 2) / 3 * 4);
+    for (size_t idx = 0; idx < data.size(); idx += 3)
+    {
+        uint32_t value = static_cast<uint32_t>(static_cast<unsigned char>(data[idx])) << 16;
+        if (idx + 1 < data.size())
+        {
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(data[idx + 1])) << 8;
+        }
+        if (idx + 2 < data.size())
+        {
+            value |= static_cast<unsigned char>(data[idx + 2]);
+        }
+        encoded += chars[(value >> 18) & 0x3F];
+        encoded += chars[(value >> 12) & 0x3F];
+        encoded += idx + 1 < data.size() ? chars[(value >> 6) & 0x3F] : '=';
+        encoded += idx + 2 < data.size() ? chars[value & 0x3F] : '=';
+    }
+    return encoded;
+}
+
+// iTunesMetadata of Info.plist: a binary plist with the name and the versions of the app
+static std::string buildITunesMetadata(unsigned int index)
+{
+    BplistWriter writer;
+    std::vector<size_t> keys;
+    std::vector<size_t> values;
+    keys.push_back(writer.addString("itemName"));
+    values.push_back(writer.addString(getSyntheticAppName(index)));
+    keys.push_back(writer.addString("bundleShortVersionString"));
+    values.push_back(writer.addString("1.0"));
+    keys.push_back(writer.addString("bundleVersion"));
+    values.push_back(writer.addString("1"));
+    size_t root = writer.addDictionary(keys, values);
+    std::string metadata;
+    writer.finish(root, metadata);
+    return metadata;
+}
+
+static bool writeControlFiles(const GeneratorOptions& options)
+{
+    std::string apps;
+    std::string appsDictionary;
+    for (unsigned int idx = 0; idx < options.numberOfDomains; ++idx)
+    {
+        apps += "\t\t<string>" + getSyntheticBundleId(idx) + "</string>\n";
+        appsDictionary += "\t\t<key>" + getSyntheticBundleId(idx) + "</key>\n\t\t<dict>\n\t\t\t<key>CFBundleIdentifier</key>\n\t\t\t<string>" + getSyntheticBundleId(idx) + "</string>\n" +
+            "\t\t\t<key>iTunesMetadata</key>\n\t\t\t<data>" + encodeBase64(buildITunesMetadata(idx)) + "</data>\n\t\t</dict>\n";
+    }
+
+    const std::string header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n<dict>\n";
+    const std::string footer = "</dict>\n</plist>\n";
+
+    std::string info = header +
+        "\t<key>Applications</key>\n\t<dict>\n" + appsDictionary + "\t</dict>\n"
+        "\t<key>Device Name</key>\n\t<string>Synthetic iPhone</string>\n"
+        "\t<key>Display Name</key>\n\t<string>Synthetic iPhone</string>\n"
+        "\t<key>Installed Applications</key>\n\t<array>\n" + apps + "\t</array>\n"
+        "\t<key>Last Backup Date</key>\n\t<date>2022-07-18T00:00:00Z</date>\n"
+        "\t<key>Product Type</key>\n\t<string>iPhone14,2</string>\n"
+        "\t<key>Product Version</key>\n\t<string>" + options.iOSVersion + "</string>\n"
+        "\t<key>Unique Identifier</key>\n\t<string>00000000-0000000000000000</string>\n"
+        "\t<key>iTunes Version</key>\n\t<string>12.12.4.1</string>\n" + footer;
+
+    std::string manifest = header +
+        "\t<key>IsEncrypted</key>\n\t<false/>\n"
+        "\t<key>Lockdown</key>\n\t<dict>\n\t\t<key>ProductVersion</key>\n\t\t<string>" + options.iOSVersion + "</string>\n\t</dict>\n"
+        "\t<key>Version</key>\n\t<string>" + std::string(options.mbdb ? "9.1" : "10.0") + "</string>\n" + footer;
+
+    std::string status = header +
+        "\t<key>BackupState</key>\n\t<string>new</string>\n"
+        "\t<key>Date</key>\n\t<date>2022-07-18T00:00:00Z</date>\n"
+        "\t<key>IsFullBackup</key>\n\t<false/>\n"
+        "\t<key>SnapshotState</key>\n\t<string>finished</string>\n"
+        "\t<key>Version</key>\n\t<string>" + std::string(options.mbdb ? "2.4" : "3.3") + "</string>\n" + footer;
+
+    return writeFile(combinePath(options.outputPath, "Info.plist"), info) &&
+        writeFile(combinePath(options.outputPath, "Manifest.plist"), manifest) &&
+        writeFile(combinePath(options.outputPath, "Status.plist"), status);
+}
+
+static void appendMbdbString(std::string& data, const char* value, size_t length)
+{
+    if (NULL == value)
+    {
+        data += "\xff\xff";
+        return;
+    }
+    BplistWriter::appendBigEndian(data, length, 2);
+    data.append(value, length);
+}
+
+static void appendMbdbRecord(std::string& data, const SyntheticFile& file, uint64_t inode)
+{
+    appendMbdbString(data, file.domain.c_str(), file.domain.size());
+    appendMbdbString(data, file.relativePath.c_str(), file.relativePath.size());
+    appendMbdbString(data, NULL, 0);
+    appendMbdbString(data, file.isDir ? NULL : reinterpret_cast<const char *>(file.digest), Sha1Digest::DIGEST_LENGTH);
+    appendMbdbString(data, NULL, 0);
+    BplistWriter::appendBigEndian(data, file.isDir ? 040755 : 0100644, 2);
+    BplistWriter::appendBigEndian(data, inode, 8);
+    BplistWriter::appendBigEndian(data, 501, 4);
+    BplistWriter::appendBigEndian(data, 501, 4);
+    BplistWriter::appendBigEndian(data, file.modifiedTime, 4);
+    BplistWriter::appendBigEndian(data, file.modifiedTime, 4);
+    BplistWriter::appendBigEndian(data, file.birthTime, 4);
+    BplistWriter::appendBigEndian(data, file.isDir ? 0 : file.size, 8);
+    BplistWriter::appendBigEndian(data, file.isDir ? 0 : 3, 1);
+    BplistWriter::appendBigEndian(data, 0, 1);
+}
+
+class ManifestWriter
+{
+public:
+    ManifestWriter(const GeneratorOptions& options) : m_options(options), m_db(NULL), m_stmt(NULL)
+    {
+    }
+
+    ~ManifestWriter()
+    {
+        close();
+    }
+
+    bool open()
+    {
+        if (m_options.mbdb)
+        {
+            m_mbdb.assign("mbdb\x05\x00", 6);
+            return true;
+        }
+
+        std::string dbPath = combinePath(m_options.outputPath, "Manifest.db");
+        deleteFile(dbPath);
+        if (sqlite3_open(dbPath.c_str(), &m_db) != SQLITE_OK)
+        {
+            return false;
+        }
+        sqlite3_exec(m_db, "PRAGMA journal_mode=OFF;", NULL, NULL, NULL);
+        sqlite3_exec(m_db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+        const char* sql = "CREATE TABLE Files (fileID TEXT PRIMARY KEY, domain TEXT, relativePath TEXT, flags INTEGER, file BLOB);"
+            "CREATE INDEX FilesDomainIdx ON Files(domain);"
+            "CREATE INDEX FilesRelativePathIdx ON Files(relativePath);"
+            "CREATE INDEX FilesFlagsIdx ON Files(flags);"
+            "CREATE TABLE Properties (key TEXT PRIMARY KEY, value BLOB);"
+            "BEGIN TRANSACTION;";
+        return sqlite3_exec(m_db, sql, NULL, NULL, NULL) == SQLITE_OK &&
+            sqlite3_prepare_v2(m_db, "INSERT INTO Files VALUES(?,?,?,?,?)", -1, &m_stmt, NULL) == SQLITE_OK;
+    }
+
+    bool add(const SyntheticFile& file, uint64_t inode)
+    {
+        if (m_options.mbdb)
+        {
+            appendMbdbRecord(m_mbdb, file, inode);
+            return true;
+        }
+
+        sqlite3_bind_text(m_stmt, 1, file.fileId.c_str(), static_cast<int>(file.fileId.size()), SQLITE_STATIC);
+        sqlite3_bind_text(m_stmt, 2, file.domain.c_str(), static_cast<int>(file.domain.size()), SQLITE_STATIC);
+        sqlite3_bind_text(m_stmt, 3, file.relativePath.c_str(), static_cast<int>(file.relativePath.size()), SQLITE_STATIC);
+        sqlite3_bind_int(m_stmt, 4, file.isDir ? 2 : 1);
+        if (m_options.blobShape == GeneratorOptions::BLOB_NONE)
+        {
+            sqlite3_bind_null(m_stmt, 5);
+        }
+        else
+        {
+            buildBlob(m_options, file, inode, m_writer, m_blob);
+            sqlite3_bind_blob(m_stmt, 5, m_blob.c_str(), static_cast<int>(m_blob.size()), SQLITE_STATIC);
+        }
+        bool result = sqlite3_step(m_stmt) == SQLITE_DONE;
+        sqlite3_reset(m_stmt);
+        return result;
+    }
+
+    bool finish()
+    {
+        if (m_options.mbdb)
+        {
+            return writeFile(combinePath(m_options.outputPath, "Manifest.mbdb"), m_mbdb);
+        }
+        sqlite3_finalize(m_stmt);
+        m_stmt = NULL;
+        bool result = sqlite3_exec(m_db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK;
+        close();
+        return result;
+    }
+
+private:
+    void close()
+    {
+        if (NULL != m_stmt)
+        {
+            sqlite3_finalize(m_stmt);
+            m_stmt = NULL;
+        }
+        if (NULL != m_db)
+        {
+            sqlite3_close(m_db);
+            m_db = NULL;
+        }
+    }
+
+private:
+    const GeneratorOptions& m_options;
+    sqlite3* m_db;
+    sqlite3_stmt* m_stmt;
+    BplistWriter m_writer;
+    std::string m_blob;
+    std::string m_mbdb;
+};
+
+static void setFileId(SyntheticFile& file)
+{
+    Sha1Digest digest;
+    digest.update(file.domain.c_str(), file.domain.size());
+    digest.update("-", 1);
+    digest.update(file.relativePath.c_str(), file.relativePath.size());
+    unsigned char value[Sha1Digest::DIGEST_LENGTH];
+    digest.finish(value);
+    file.fileId = toHexString(value, Sha1Digest::DIGEST_LENGTH);
+}
+
+bool generateBackup(const GeneratorOptions& options, GeneratorStats* stats)
+{
+    if (!existsDirectory(options.outputPath) && !makeDirectory(options.outputPath))
+    {
+        fprintf(stderr, "Failed to create %s\n", options.outputPath.c_str());
+        return false;
+    }
+    if (!writeControlFiles(options))
+    {
+        fprintf(stderr, "Failed to write the plists\n");
+        return false;
+    }
+
+    ManifestWriter manifest(options);
+    if (!manifest.open())
+    {
+        fprintf(stderr, "Failed to create the manifest\n");
+        return false;
+    }
+
+    Random random(options.seed);
+    std::vector<unsigned char> content;
+    std::vector<bool> subFolders(256, false);
+    uint64_t inode = 1000;
+    uint64_t totalBytes = 0;
+    uint64_t fileIndex = 0;
+    uint64_t numberOfDirectories = 0;
+    SyntheticFile file;
+    file.birthTime = 1600000000;
+    std::memset(file.digest, 0, sizeof(file.digest));
+
+    for (unsigned int domainIndex = 0; domainIndex < options.numberOfDomains; ++domainIndex)
+    {
+        file.domain = getSyntheticDomain(domainIndex);
+        // The files are split evenly, the first domains take the remainder
+        uint64_t numberOfFiles = options.numberOfFiles / options.numberOfDomains + (domainIndex < options.numberOfFiles % options.numberOfDomains ? 1 : 0);
+
+        const char* rootDirectories[] = {"", "Documents", "Library"};
+        for (size_t idx = 0; idx < sizeof(rootDirectories) / sizeof(const char *); ++idx)
+        {
+            file.relativePath = rootDirectories[idx];
+            file.isDir = true;
+            file.modifiedTime = file.birthTime;
+            setFileId(file);
+            if (!manifest.add(file, inode++))
+            {
+                return false;
+            }
+            ++numberOfDirectories;
+        }
+
+        for (uint64_t idx = 0; idx < numberOfFiles; ++idx, ++fileIndex)
+        {
+            char path[128];
+            uint64_t directoryIndex = idx / options.filesPerDirectory;
+            if (idx % options.filesPerDirectory == 0)
+            {
+                snprintf(path, sizeof(path), "Documents/d%05llu", (unsigned long long)directoryIndex);
+                file.relativePath = path;
+                file.isDir = true;
+                file.modifiedTime = file.birthTime;
+                setFileId(file);
+                if (!manifest.add(file, inode++))
+                {
+                    return false;
+                }
+                ++numberOfDirectories;
+            }
+
+            snprintf(path, sizeof(path), "Documents/d%05llu/f%07llu.dat", (unsigned long long)directoryIndex, (unsigned long long)idx);
+            file.relativePath = path;
+            file.isDir = false;
+            file.size = nextFileSize(options, random);
+            file.modifiedTime = file.birthTime + static_cast<unsigned int>(random.next() % (86400 * 365));
+            setFileId(file);
+
+            // The content is only generated when it is written or its digest is recorded (DataHash of mbdb, Digest of the full blobs)
+            if (options.payload || options.mbdb || options.blobShape == GeneratorOptions::BLOB_FULL)
+            {
+                content.resize(static_cast<size_t>(file.size));
+                fillContent(options.seed, fileIndex, content);
+                Sha1Digest digest;
+                digest.update(content.empty() ? NULL : &content[0], content.size());
+                digest.finish(file.digest);
+            }
+
+            if (options.payload)
+            {
+                std::string payloadPath;
+                if (options.mbdb)
+                {
+                    payloadPath = combinePath(options.outputPath, file.fileId);
+                }
+                else
+                {
+                    size_t subFolder = std::strtoul(file.fileId.substr(0, 2).c_str(), NULL, 16);
+                    std::string subFolderPath = combinePath(options.outputPath, file.fileId.substr(0, 2));
+                    if (!subFolders[subFolder])
+                    {
+                        makeDirectory(subFolderPath);
+                        subFolders[subFolder] = true;
+                    }
+                    payloadPath = combinePath(subFolderPath, file.fileId);
+                }
+                if (!writeFile(payloadPath, content.empty() ? NULL : &content[0], content.size()))
+                {
+                    fprintf(stderr, "Failed to write %s\n", payloadPath.c_str());
+                    return false;
+                }
+            }
+            totalBytes += file.size;
+
+            if (!manifest.add(file, inode++))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (!manifest.finish())
+    {
+        fprintf(stderr, "Failed to write the manifest\n");
+        return false;
+    }
+
+    if (NULL != stats)
+    {
+        stats->numberOfFiles = fileIndex;
+        stats->numberOfDirectories = numberOfDirectories;
+        stats->bytes = totalBytes;
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+//
+//  BackupGenerator.h
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdint>
+#include <string>
+
+#ifndef BackupGenerator_h
+#define BackupGenerator_h
+
+// Writes a synthetic iTunes backup: Info.plist, Manifest.plist, Status.plist, Manifest.db (or Manifest.mbdb)
+// and the payloads (xx/<fileId>, or <fileId> for Manifest.mbdb).
+// The output only depends on the options, the same seed gives the same backup on every platform:
+// the sizes are computed with integers only and the contents are written little-endian.
+
+struct GeneratorOptions
+{
+    enum SizeDistribution
+    {
+        SIZE_FIXED = 0,
+        SIZE_UNIFORM,
+        SIZE_LOGNORMAL,
+    };
+
+    enum BlobShape
+    {
+        BLOB_NONE = 0,      // NULL blobs (the loader falls back to no metadata)
+        BLOB_MINIMAL,       // MBFile with LastModified, Size, Mode, Flags, Birth and RelativePath
+        BLOB_FULL,          // MBFile with the keys of iOS 10+ backups, the Digest and optional ExtendedAttributes
+    };
+
+    std::string outputPath;
+    bool mbdb;
+    unsigned int numberOfDomains;
+    uint64_t numberOfFiles;
+    unsigned int filesPerDirectory;
+    SizeDistribution sizeDistribution;
+    double sizeParam1;      // fixed: size, uniform: min, lognormal: median
+    double sizeParam2;      // uniform: max, lognormal: sigma (the normal variate is approximated by Irwin-Hall, within 6 sigmas)
+    uint64_t maxSize;
+    BlobShape blobShape;
+    unsigned int extendedAttributesSize;
+    uint64_t seed;
+    bool payload;
+    std::string iOSVersion;
+
+    GeneratorOptions() : mbdb(false), numberOfDomains(10), numberOfFiles(10000), filesPerDirectory(100), sizeDistribution(SIZE_LOGNORMAL), sizeParam1(16 * 1024), sizeParam2(1.5), maxSize(16 * 1024 * 1024), blobShape(BLOB_FULL), extendedAttributesSize(0), seed(1), payload(true), iOSVersion("15.4")
+    {
+    }
+};
+
+struct GeneratorStats
+{
+    uint64_t numberOfFiles;
+    uint64_t numberOfDirectories;
+    uint64_t bytes;
+
+    GeneratorStats() : numberOfFiles(0), numberOfDirectories(0), bytes(0)
+    {
+    }
+};
+
+bool generateBackup(const GeneratorOptions& options, GeneratorStats* stats = NULL);
+
+// AppDomain-com.synthetic.appNNN, the domain of the index-th app
+std::string getSyntheticDomain(unsigned int index);
+std::string getSyntheticBundleId(unsigned int index);
+// itemName of the iTunesMetadata of the index-th app
+std::string getSyntheticAppName(unsigned int index);
+
+#endif /* BackupGenerator_h */
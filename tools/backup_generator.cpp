@@ -0,0 +1,163 @@
+//
+//  backup_generator.cpp
+//  iTunesBackup
+//
+//  Created by Matthew on 2022/7/18.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "BackupGenerator.h"
+
+static void printUsage()
+{
+    fprintf(stderr,
+            "Usage: itunesbackup-gen <output-path> [options]\n"
+            "\n"
+            "  --format db|mbdb                   Manifest.db (iOS 10+, default) or Manifest.mbdb (iOS 5-9)\n"
+            "  --domains <n>                      Number of app domains (default: 10)\n"
+            "  --files <n>                        Number of files, split evenly over the domains (default: 10000)\n"
+            "  --files-per-dir <n>                Files per directory (default: 100)\n"
+            "  --size fixed:<n>                   Size of the payloads in bytes\n"
+            "         uniform:<min>:<max>\n"
+            "         lognormal:<median>:<sigma>  (default: lognormal:16384:1.5)\n"
+            "  --max-size <n>                     Upper bound of the sizes (default: 16777216)\n"
+            "  --blob none|minimal|full           Shape of the file blobs of Manifest.db (default: full)\n"
+            "  --xattr-bytes <n>                  Size of ExtendedAttributes in the full blobs (default: 0)\n"
+            "  --seed <n>                         Seed of the sizes, times and contents (default: 1)\n"
+            "  --no-payload                       Write the manifest only\n"
+            "  --ios-version <version>            Product Version of Info.plist (default: 15.4)\n");
+}
+
+static bool parseSize(const std::string& value, GeneratorOptions& options)
+{
+    std::vector<std::string> parts;
+    std::string::size_type start = 0;
+    for (std::string::size_type pos = value.find(':'); ; pos = value.find(':', start))
+    {
+        parts.push_back(value.substr(start, pos == std::string::npos ? std::string::npos : pos - start));
+        if (pos == std::string::npos)
+        {
+            break;
+        }
+        start = pos + 1;
+    }
+
+    if (parts[0] == "fixed" && parts.size() == 2)
+    {
+        options.sizeDistribution = GeneratorOptions::SIZE_FIXED;
+    }
+    else if (parts[0] == "uniform" && parts.size() == 3)
+    {
+        options.sizeDistribution = GeneratorOptions::SIZE_UNIFORM;
+    }
+    else if (parts[0] == "lognormal" && parts.size() == 3)
+    {
+        options.sizeDistribution = GeneratorOptions::SIZE_LOGNORMAL;
+    }
+    else
+    {
+        return false;
+    }
+    options.sizeParam1 = std::atof(parts[1].c_str());
+    options.sizeParam2 = parts.size() > 2 ? std::atof(parts[2].c_str()) : 0.0;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        printUsage();
+        return 2;
+    }
+
+    GeneratorOptions options;
+    options.outputPath = argv[1];
+    for (int idx = 2; idx < argc; ++idx)
+    {
+        std::string arg = argv[idx];
+        bool hasValue = idx + 1 < argc;
+        std::string value = hasValue ? argv[idx + 1] : "";
+        bool valid = true;
+        if (arg == "--no-payload")
+        {
+            options.payload = false;
+            continue;
+        }
+        if (!hasValue)
+        {
+            valid = false;
+        }
+        else if (arg == "--format")
+        {
+            valid = value == "db" || value == "mbdb";
+            options.mbdb = value == "mbdb";
+        }
+        else if (arg == "--domains")
+        {
+            options.numberOfDomains = static_cast<unsigned int>(std::strtoul(value.c_str(), NULL, 10));
+            valid = options.numberOfDomains > 0;
+        }
+        else if (arg == "--files")
+        {
+            options.numberOfFiles = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else if (arg == "--files-per-dir")
+        {
+            options.filesPerDirectory = static_cast<unsigned int>(std::strtoul(value.c_str(), NULL, 10));
+            valid = options.filesPerDirectory > 0;
+        }
+        else if (arg == "--size")
+        {
+            valid = parseSize(value, options);
+        }
+        else if (arg == "--max-size")
+        {
+            options.maxSize = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else if (arg == "--blob")
+        {
+            valid = value == "none" || value == "minimal" || value == "full";
+            options.blobShape = value == "none" ? GeneratorOptions::BLOB_NONE : (value == "minimal" ? GeneratorOptions::BLOB_MINIMAL : GeneratorOptions::BLOB_FULL);
+        }
+        else if (arg == "--xattr-bytes")
+        {
+            options.extendedAttributesSize = static_cast<unsigned int>(std::strtoul(value.c_str(), NULL, 10));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else if (arg == "--ios-version")
+        {
+            options.iOSVersion = value;
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid option: %s\n", arg.c_str());
+            printUsage();
+            return 2;
+        }
+        ++idx;
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    GeneratorStats stats;
+    if (!generateBackup(options, &stats))
+    {
+        return 1;
+    }
+    printf("%llu files in %u domains, %llu bytes of payload\n", (unsigned long long)stats.numberOfFiles, options.numberOfDomains, (unsigned long long)stats.bytes);
+    printf("Generated in %.3fs\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+    return 0;
+}
@@ -15,6 +15,8 @@ private:
 	CSortListViewCtrl		m_appListCtrl;
 
 	std::vector<BackupManifest> m_manifests;
+	// The parsers of m_manifests, kept to save the apps decoded on selection to their cache
+	std::vector<std::shared_ptr<ManifestParser>> m_parsers;
 
 	int m_itemClicked;
 
@@ -95,10 +97,12 @@ public:
 
 		CString backupDir = GetDefaultBackupDir();
 
-		ManifestParser parser((LPCSTR)CW2A(CT2W(backupDir), CP_UTF8), true);
+		std::shared_ptr<ManifestParser> parser = std::make_shared<ManifestParser>((LPCSTR)CW2A(CT2W(backupDir), CP_UTF8), true);
+		parser->setCachePath(GetManifestCachePath());
 		std::vector<BackupManifest> manifests;
-		if (parser.parse(manifests))
+		if (parser->parse(manifests))
 		{
+			m_parsers.push_back(parser);
 			// UpdateBackups(manifests);
 		}
 
@@ -106,8 +110,12 @@ public:
 		if ((_tcslen(szPrevBackup) > 0) && (_tcscmp(szPrevBackup, backupDir) != 0))
 		{
 			CW2A backupDirU8(CT2W(szPrevBackup), CP_UTF8);
-			ManifestParser parser((LPCSTR)backupDirU8, true);
-			parser.parse(manifests);
+			std::shared_ptr<ManifestParser> prevParser = std::make_shared<ManifestParser>((LPCSTR)backupDirU8, true);
+			prevParser->setCachePath(GetManifestCachePath());
+			if (prevParser->parse(manifests))
+			{
+				m_parsers.push_back(prevParser);
+			}
 		}
 #endif
 		if (!manifests.empty())
@@ -169,10 +177,12 @@ public:
 		{
 			CW2A backupDir(CT2W(folder.m_szFolderPath), CP_UTF8);
 
-			ManifestParser parser((LPCSTR)backupDir, true);
+			std::shared_ptr<ManifestParser> parser = std::make_shared<ManifestParser>((LPCSTR)backupDir, true);
+			parser->setCachePath(GetManifestCachePath());
 			std::vector<BackupManifest> manifests;
-			if (parser.parse(manifests))
+			if (parser->parse(manifests))
 			{
+				m_parsers.push_back(parser);
 				UpdateBackups(manifests);
 #ifndef NDEBUG
 				CRegKey rk;
@@ -222,6 +232,11 @@ public:
 		CW2A resDir(CT2W(buffer), CP_UTF8);
 
 		const std::vector<BackupManifest::AppInfo>& apps = manifest.getApps();
+		// Cache the apps getApps() has just decoded
+		for (std::vector<std::shared_ptr<ManifestParser>>::const_iterator it = m_parsers.cbegin(); it != m_parsers.cend(); ++it)
+		{
+			(*it)->saveCache();
+		}
 		for (std::vector<BackupManifest::AppInfo>::const_iterator it = apps.cbegin(); it != apps.cend(); ++it)
 		{
 			CW2T pszName(CA2W((*it).name.c_str(), CP_UTF8));
@@ -360,24 +375,10 @@ public:
 	bool exportApps(const std::vector<std::string> domains, const std::string backup, const std::string output)
 	{
 		bool cancelled = false;
-		for (auto it = domains.cbegin(); it != domains.cend(); ++it)
-		{
-			std::string domainOutput = combinePath(output, *it);
-			makeDirectory(domainOutput);
-
-			ITunesDb* iTunesDb = new ITunesDb(backup, "Manifest.db");
-			if (iTunesDb->load(*it))
-			{
-				iTunesDb->enumFiles(std::bind(&CView::handleFile, this, std::cref(domainOutput), std::placeholders::_1, std::placeholders::_2));
-			}
-			delete iTunesDb;
-
-			cancelled = m_cancelled.load();
-			if (cancelled)
-			{
-				break;
-			}
-		}
+		// Files are copied while Manifest.db is scanned, nothing is kept in memory
+		ITunesDb* iTunesDb = new ITunesDb(backup, "Manifest.db");
+		iTunesDb->exportStreaming(domains, output, 0, NULL, &m_cancelled);
+		delete iTunesDb;
 
 		cancelled = m_cancelled.load();
 		return cancelled ? false : true;
@@ -393,33 +394,6 @@ public:
 		return exportApps(domains, backup, output);
 	}
 
-	bool handleFile(const std::string& output, const ITunesDb* iTunesDb, ITunesFile* file)
-	{
-		std::string relativePath = file->relativePath;
-		normalizePath(relativePath);
-		std::string dest = combinePath(output, relativePath);
-		if (!dest.empty())
-		{
-			if (file->isDir())
-			{
-				makeDirectory(dest);
-			}
-			else
-			{
-				copyFile(iTunesDb->getRealPath(file), dest, true);
-			}
-
-			unsigned int modifiedTime = ITunesDb::parseModifiedTime(file->blob);
-			if (modifiedTime > 0)
-			{
-				updateFileTime(dest, modifiedTime);
-			}
-		}
-
-		bool cancelled = m_cancelled.load();
-		return cancelled ? false : true;
-	}
-
 	LRESULT OnTimer(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/)
 	{
 		std::future_status status = m_task.wait_for(std::chrono::seconds(0));
@@ -628,6 +602,23 @@ public:
 	}
 
 
+	std::string GetManifestCachePath()
+	{
+		TCHAR szPath[MAX_PATH] = { 0 };
+		if (FAILED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, szPath)))
+		{
+			return "";
+		}
+		_tcscat(szPath, TEXT("\\iTunesBackup"));
+		std::string cacheDir((LPCSTR)CW2A(CT2W(szPath), CP_UTF8));
+		if (!existsDirectory(cacheDir))
+		{
+			makeDirectory(cacheDir);
+		}
+
+		return combinePath(cacheDir, "Manifests.cache");
+	}
+
 	CString GetDefaultBackupDir(BOOL bCheckExistence = TRUE)
 	{
 		CString backupDir;